@@ -0,0 +1,186 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Actor, a state object with a private mailbox of messages, processed one at
+a time on a shared loop. Messages are functors taking the state, so state
+which is only touched by messages needs no locking.
+
+The mailbox is a concurrent functor queue with small blocks, and a count
+of messages not yet processed. The sender that raises the count from zero
+schedules an activation on the loop, and the activation only reschedules
+itself while messages remain, so idle actors cost no loop time. Each
+activation processes up to a batch of messages, to keep the state in cache
+without starving other work on the loop.
+
+Messages are stored in the mailbox blocks up to a quarter of a block, larger
+ones are moved to the heap and only a pointer is queued.
+
+Messages that are still pending when the actor is destroyed will still run.
+
+*/
+
+#pragma once
+#ifndef SEV_ACTOR_H
+#define SEV_ACTOR_H
+
+#include "platform.h"
+#include "event_loop.h"
+#include "concurrent_functor_queue.h"
+
+#ifdef __cplusplus
+
+#include <memory>
+#include <type_traits>
+
+namespace sev {
+
+namespace impl::ac {
+
+constexpr ptrdiff_t c_MailboxBlockSize = 1024; // The queue keeps three blocks, which must stay small for many mostly idle actors
+constexpr size_t c_MailboxInlineSize = c_MailboxBlockSize / 4; // Larger messages are boxed on the heap, the queue cannot hold a functor larger than a block
+
+template<typename TState>
+struct State : std::enable_shared_from_this<State<TState>>
+{
+	State(EventLoop &el, TState &&value, int batch) : Loop(el), Batch(batch), Value(std::move(value)), Mailbox(c_MailboxBlockSize), Count(0), Stalled(false)
+	{
+	}
+
+	EventLoop &Loop;
+	const int Batch;
+	TState Value; // Only touched by the activation
+
+	ConcurrentFunctorQueue<errno_t(EventLoop &el, TState &state)> Mailbox;
+	std::atomic_ptrdiff_t Count; // Messages not yet processed, an activation is scheduled while positive. Briefly negative when a message is processed before its sender counted it
+	std::atomic_bool Stalled; // Scheduling failed, the next message retries
+
+	errno_t tell(FunctorView<errno_t(EventLoop &el, TState &state)> &&fv) noexcept
+	{
+		errno_t eno = Mailbox.push(nothrow, std::move(fv));
+		if (eno)
+			return eno;
+		if (Count.fetch_add(1) == 0 || (Stalled.load(std::memory_order_relaxed) && Stalled.exchange(false)))
+			return schedule();
+		return 0;
+	}
+
+	errno_t schedule() noexcept
+	{
+		std::shared_ptr<State> self = this->shared_from_this();
+		errno_t eno = sev::post(Loop, [self](EventLoop &el) -> errno_t {
+			return self->activate(el);
+		});
+		if (eno)
+			Stalled = true;
+		return eno;
+	}
+
+	errno_t activate(EventLoop &el)
+	{
+		ExceptionHandle eh;
+		errno_t eno = 0;
+		ptrdiff_t processed = 0;
+		while (processed < Batch && !eno && !eh.raised())
+		{
+			bool success;
+			errno_t res = Mailbox.tryCallAndPop(eh, success, el, Value);
+			if (!success)
+				break;
+			eno = res;
+			++processed;
+		}
+		if (Count.fetch_sub(processed) - processed > 0)
+			schedule(); // More messages, or counted messages not yet visible in the queue
+		eh.rethrow();
+		return eno;
+	}
+
+};
+
+}
+
+template<typename TState>
+class Actor
+{
+public:
+	//! Batch is the number of messages processed by one activation before it yields the loop thread
+	explicit Actor(EventLoop &el, TState state = TState(), int batch = 64) : m_State(std::make_shared<impl::ac::State<TState>>(el, std::move(state), batch))
+	{
+	}
+
+	Actor(const Actor &other) = delete;
+	Actor &operator=(const Actor &other) = delete;
+
+	EventLoop &loop() const noexcept
+	{
+		return m_State->Loop;
+	}
+
+	//! Send a message `errno_t(EventLoop &el, TState &state)`, processed after the messages sent before it by the same thread. Errors are returned to the loop.
+	//! A message larger than c_MailboxInlineSize costs a heap allocation
+	template<typename TFn>
+	errno_t tell(TFn &&f) noexcept
+	{
+		typedef std::decay_t<TFn> TMessage;
+		if constexpr (sizeof(TMessage) > impl::ac::c_MailboxInlineSize)
+		{
+			std::shared_ptr<TMessage> box;
+			try
+			{
+				box = std::make_shared<TMessage>(std::forward<TFn>(f));
+			}
+			catch (...)
+			{
+				return ENOMEM;
+			}
+			auto boxed = [box](EventLoop &el, TState &state) -> errno_t {
+				return (*box)(el, state);
+			};
+			return m_State->tell(FunctorView<errno_t(EventLoop &el, TState &state)>(std::move(boxed)));
+		}
+		else
+		{
+			return m_State->tell(FunctorView<errno_t(EventLoop &el, TState &state)>(std::forward<TFn>(f)));
+		}
+	}
+
+private:
+	std::shared_ptr<impl::ac::State<TState>> m_State;
+
+};
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_ACTOR_H */
+
+/* end of file */
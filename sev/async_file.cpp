@@ -0,0 +1,815 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "async_file.h"
+
+#ifndef _WIN32
+
+#include "atomic_mutex.h"
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <memory>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#if defined(__linux__) && !defined(SEV_ASYNC_FILE_NO_URING)
+#define SEV_ASYNC_FILE_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "event_loop_impl.h"
+#endif
+
+namespace sev::impl::aio {
+
+enum class OpType
+{
+	Read,
+	Write,
+	Fsync,
+	OpenAt,
+};
+
+struct Op
+{
+	Op(SEV_EventLoop *el, AsyncIoFunctor &&f) : Loop(el), F(std::move(f))
+	{
+	}
+
+	OpType Type;
+	int Fd;
+	void *Data = null;
+	size_t Size = 0;
+	int64_t Offset = 0;
+	int BufferIndex = -1; // Registered buffer, for the fixed variants
+	int Flags = 0;
+	int Mode = 0;
+	std::string Path;
+
+	SEV_EventLoop *Loop;
+	AsyncIoFunctor F;
+
+	Op *Prev = null; // Submitted list
+	Op *Next = null;
+
+};
+
+constexpr size_t c_MaxTransfer = 0x7FFFF000; // Linux limit for a single read or write, larger transfers complete short
+constexpr int c_PostRetries = 64; // Yields while the completion loop is out of memory, before running the completion on the calling thread
+
+}
+
+struct SEV_AsyncIo
+{
+	std::mutex Mutex; // Staging and submission
+	std::vector<sev::impl::aio::Op *> Staged;
+	std::vector<SEV_AsyncIoBuffer> Buffers;
+	int Limit = 0; // Maximum operations in flight, so the completion queue cannot overflow
+	errno_t Failed = 0; // Set when the ring stops working, then operations complete with this error
+
+	std::atomic_int Inflight{ 0 }; // Staged or submitted, completion not yet posted
+	std::atomic_bool Stopping{ false };
+	sev::EventFlag Drained;
+
+	SEV_EventLoop *Pool = null; // Fallback, blocking calls
+
+#ifdef SEV_ASYNC_FILE_URING
+	int RingFd = -1;
+	void *SqRing = null;
+	size_t SqRingSize = 0;
+	void *CqRing = null;
+	size_t CqRingSize = 0;
+	io_uring_sqe *Sqes = null;
+	size_t SqesSize = 0;
+
+	unsigned *SqHead;
+	unsigned *SqTail;
+	unsigned SqMask;
+	unsigned SqEntries;
+	unsigned *SqArray;
+
+	unsigned *CqHead;
+	unsigned *CqTail;
+	unsigned CqMask;
+	io_uring_cqe *Cqes;
+
+	bool BuffersRegistered = false;
+	std::thread Reaper;
+
+	sev::AtomicMutex SubmittedMutex;
+	sev::impl::aio::Op *Submitted = null; // Sent to the kernel and not yet reaped, failed together if the ring stops working
+#endif
+
+};
+
+namespace sev::impl::aio {
+
+namespace /* anonymous */ {
+
+void complete(SEV_AsyncIo *aio, Op *op, int64_t result)
+{
+	auto completion = [op, result](sev::EventLoop &el) -> errno_t {
+		std::unique_ptr<Op> o(op);
+		return o->F(el, result);
+	};
+	sev::EventFunctorView fv = std::move(completion);
+	const sev::EventFunctorVt *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	errno_t eno;
+	for (int i = 0; (eno = op->Loop->Vt->PostFunctor(op->Loop, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor)) == ENOMEM && i < c_PostRetries; ++i)
+		SEV_Thread_yield();
+	if (eno)
+	{
+		// Completions must not be lost, run it here instead. The lambda only holds the pointer, so the op is still ours
+		std::unique_ptr<Op> o(op);
+		sev::ExceptionHandle eh;
+		o->F(eh, *o->Loop, result);
+		eh.discard();
+	}
+	if (--aio->Inflight == 0 && aio->Stopping)
+		aio->Drained.set();
+}
+
+// Complete the staged operations with an error, when they cannot be sent
+void failStaged(SEV_AsyncIo *aio, errno_t eno)
+{
+	std::vector<Op *> staged;
+	{
+		std::unique_lock<std::mutex> lock(aio->Mutex);
+		staged.swap(aio->Staged);
+	}
+	for (Op *op : staged)
+		complete(aio, op, -(int64_t)eno);
+}
+
+int64_t execute(Op *op)
+{
+	ssize_t res = -1;
+	switch (op->Type)
+	{
+	case OpType::Read:
+		res = pread(op->Fd, op->Data, op->Size, (off_t)op->Offset);
+		break;
+	case OpType::Write:
+		res = pwrite(op->Fd, op->Data, op->Size, (off_t)op->Offset);
+		break;
+	case OpType::Fsync:
+#ifdef __APPLE__
+		res = fsync(op->Fd);
+#else
+		res = op->Flags ? fdatasync(op->Fd) : fsync(op->Fd);
+#endif
+		break;
+	case OpType::OpenAt:
+		res = openat(op->Fd, op->Path.c_str(), op->Flags, op->Mode);
+		break;
+	}
+	return res < 0 ? -(int64_t)errno : (int64_t)res;
+}
+
+errno_t poolRun(SEV_EventLoop *pool)
+{
+	auto onError = [](SEV_ExceptionHandle *eh) -> void {
+		((sev::ExceptionHandle *)eh)->discard(); // Operations report their errors through the completion
+	};
+	sev::FunctorView<void(SEV_ExceptionHandle *eh)> fv = std::move(onError);
+	const sev::FunctorVt<void(SEV_ExceptionHandle *eh)> *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return SEV_EventLoop_run(pool, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+}
+
+// Call with Mutex locked
+errno_t poolSubmit(SEV_AsyncIo *aio)
+{
+	size_t i = 0;
+	errno_t eno = 0;
+	for (; i < aio->Staged.size(); ++i)
+	{
+		Op *op = aio->Staged[i];
+		auto run = [aio, op](sev::EventLoop &el) -> errno_t {
+			complete(aio, op, execute(op));
+			return 0;
+		};
+		sev::EventFunctorView fv = std::move(run);
+		const sev::EventFunctorVt *vt;
+		void *ptr;
+		bool movable;
+		fv.extract(vt, ptr, movable, true);
+		eno = SEV_EventLoop_postFunctor(aio->Pool, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+		if (eno) break;
+	}
+	aio->Staged.erase(aio->Staged.begin(), aio->Staged.begin() + i); // Keep what failed to post for the next submit
+	return eno;
+}
+
+#ifdef SEV_ASYNC_FILE_URING
+
+SEV_FORCE_INLINE int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, null, 0);
+}
+
+// Call with SubmittedMutex locked
+void submittedAdd(SEV_AsyncIo *aio, Op *op)
+{
+	op->Prev = null;
+	op->Next = aio->Submitted;
+	if (aio->Submitted) aio->Submitted->Prev = op;
+	aio->Submitted = op;
+}
+
+// Call with SubmittedMutex locked
+void submittedRemove(SEV_AsyncIo *aio, Op *op)
+{
+	if (op->Prev) op->Prev->Next = op->Next;
+	else aio->Submitted = op->Next;
+	if (op->Next) op->Next->Prev = op->Prev;
+}
+
+void uringRelease(SEV_AsyncIo *aio)
+{
+	if (aio->Sqes) munmap(aio->Sqes, aio->SqesSize);
+	if (aio->CqRing && aio->CqRing != aio->SqRing) munmap(aio->CqRing, aio->CqRingSize);
+	if (aio->SqRing) munmap(aio->SqRing, aio->SqRingSize);
+	if (aio->RingFd >= 0) close(aio->RingFd);
+	aio->Sqes = null;
+	aio->CqRing = null;
+	aio->SqRing = null;
+	aio->RingFd = -1;
+}
+
+bool uringCreate(SEV_AsyncIo *aio, unsigned entries)
+{
+	io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	aio->RingFd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (aio->RingFd < 0)
+		return false;
+	if (!(p.features & IORING_FEAT_RW_CUR_POS))
+	{
+		// Older than 5.6, no plain read, write, or openat
+		uringRelease(aio);
+		return false;
+	}
+	aio->SqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	aio->CqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+	if (single)
+	{
+		if (aio->CqRingSize > aio->SqRingSize) aio->SqRingSize = aio->CqRingSize;
+		aio->CqRingSize = aio->SqRingSize;
+	}
+	void *sq = mmap(null, aio->SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->RingFd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+	{
+		uringRelease(aio);
+		return false;
+	}
+	aio->SqRing = sq;
+	void *cq = sq;
+	if (!single)
+	{
+		cq = mmap(null, aio->CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->RingFd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+		{
+			uringRelease(aio);
+			return false;
+		}
+	}
+	aio->CqRing = cq;
+	aio->SqesSize = p.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = mmap(null, aio->SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->RingFd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+	{
+		uringRelease(aio);
+		return false;
+	}
+	aio->Sqes = (io_uring_sqe *)sqes;
+
+	uint8_t *sqp = (uint8_t *)sq;
+	aio->SqHead = (unsigned *)(sqp + p.sq_off.head);
+	aio->SqTail = (unsigned *)(sqp + p.sq_off.tail);
+	aio->SqMask = *(unsigned *)(sqp + p.sq_off.ring_mask);
+	aio->SqEntries = p.sq_entries;
+	aio->SqArray = (unsigned *)(sqp + p.sq_off.array);
+
+	uint8_t *cqp = (uint8_t *)cq;
+	aio->CqHead = (unsigned *)(cqp + p.cq_off.head);
+	aio->CqTail = (unsigned *)(cqp + p.cq_off.tail);
+	aio->CqMask = *(unsigned *)(cqp + p.cq_off.ring_mask);
+	aio->Cqes = (io_uring_cqe *)(cqp + p.cq_off.cqes);
+
+	aio->Limit = (int)p.cq_entries;
+	return true;
+}
+
+void uringPrepare(SEV_AsyncIo *aio, io_uring_sqe *sqe, Op *op)
+{
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (uint64_t)(uintptr_t)op;
+	sqe->fd = op->Fd;
+	switch (op->Type)
+	{
+	case OpType::Read:
+	case OpType::Write:
+	{
+		const bool fixed = op->BufferIndex >= 0 && aio->BuffersRegistered;
+		if (op->Type == OpType::Read) sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+		else sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+		sqe->addr = (uint64_t)(uintptr_t)op->Data;
+		sqe->len = (uint32_t)op->Size;
+		sqe->off = (uint64_t)op->Offset;
+		if (fixed) sqe->buf_index = (uint16_t)op->BufferIndex;
+		break;
+	}
+	case OpType::Fsync:
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fsync_flags = op->Flags ? IORING_FSYNC_DATASYNC : 0;
+		break;
+	case OpType::OpenAt:
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->addr = (uint64_t)(uintptr_t)op->Path.c_str();
+		sqe->len = (uint32_t)op->Mode;
+		sqe->open_flags = (uint32_t)op->Flags;
+		break;
+	}
+}
+
+// Call with Mutex locked. Sends all staged operations with as few syscalls as the ring size allows
+errno_t uringSubmit(SEV_AsyncIo *aio)
+{
+	size_t i = 0;
+	while (i < aio->Staged.size())
+	{
+		unsigned tail = *aio->SqTail;
+		const unsigned head = __atomic_load_n(aio->SqHead, __ATOMIC_ACQUIRE);
+		const size_t first = i;
+		while (i < aio->Staged.size() && tail - head < aio->SqEntries)
+		{
+			const unsigned idx = tail & aio->SqMask;
+			uringPrepare(aio, &aio->Sqes[idx], aio->Staged[i]);
+			aio->SqArray[idx] = idx;
+			++tail;
+			++i;
+		}
+		{
+			// Before the kernel sees them, the reaper may complete them right away
+			std::unique_lock<sev::AtomicMutex> lock(aio->SubmittedMutex);
+			for (size_t j = first; j < i; ++j)
+				submittedAdd(aio, aio->Staged[j]);
+		}
+		__atomic_store_n(aio->SqTail, tail, __ATOMIC_RELEASE);
+		int res;
+		do res = uringEnter(aio->RingFd, tail - __atomic_load_n(aio->SqHead, __ATOMIC_ACQUIRE), 0, 0);
+		while (res < 0 && errno == EINTR);
+		if (res < 0)
+		{
+			// Take back the entries the kernel did not consume, they stay staged for the next submit
+			errno_t eno = errno;
+			const unsigned consumed = __atomic_load_n(aio->SqHead, __ATOMIC_ACQUIRE);
+			const size_t unsent = tail - consumed;
+			__atomic_store_n(aio->SqTail, consumed, __ATOMIC_RELEASE);
+			{
+				std::unique_lock<sev::AtomicMutex> lock(aio->SubmittedMutex);
+				for (size_t j = i - unsent; j < i; ++j)
+					submittedRemove(aio, aio->Staged[j]);
+			}
+			aio->Staged.erase(aio->Staged.begin(), aio->Staged.begin() + (i - unsent));
+			return eno;
+		}
+	}
+	aio->Staged.clear();
+	return 0;
+}
+
+// The ring stopped working, complete what was sent with the error, and send nothing more
+void uringFail(SEV_AsyncIo *aio, errno_t eno)
+{
+	Op *op;
+	{
+		std::unique_lock<std::mutex> lock(aio->Mutex);
+		aio->Failed = eno;
+		std::unique_lock<sev::AtomicMutex> submittedLock(aio->SubmittedMutex);
+		op = aio->Submitted;
+		aio->Submitted = null;
+	}
+	while (op)
+	{
+		Op *next = op->Next;
+		complete(aio, op, -(int64_t)eno);
+		op = next;
+	}
+}
+
+void uringReap(SEV_AsyncIo *aio)
+{
+	sev::impl::el::blockSignals();
+	for (;;)
+	{
+		unsigned head = *aio->CqHead;
+		const unsigned tail = __atomic_load_n(aio->CqTail, __ATOMIC_ACQUIRE);
+		if (head == tail)
+		{
+			if (uringEnter(aio->RingFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			{
+				uringFail(aio, errno);
+				return;
+			}
+			continue;
+		}
+		{
+			std::unique_lock<sev::AtomicMutex> lock(aio->SubmittedMutex);
+			for (unsigned i = head; i != tail; ++i)
+				if (Op *op = (Op *)(uintptr_t)aio->Cqes[i & aio->CqMask].user_data)
+					submittedRemove(aio, op);
+		}
+		bool stop = false;
+		for (; head != tail; ++head)
+		{
+			const io_uring_cqe *cqe = &aio->Cqes[head & aio->CqMask];
+			Op *op = (Op *)(uintptr_t)cqe->user_data;
+			if (op) complete(aio, op, cqe->res);
+			else stop = true; // Sent by destroy after all completions were posted
+		}
+		__atomic_store_n(aio->CqHead, head, __ATOMIC_RELEASE);
+		if (stop) return;
+	}
+}
+
+void uringStop(SEV_AsyncIo *aio)
+{
+	{
+		std::unique_lock<std::mutex> lock(aio->Mutex);
+		if (aio->Failed)
+		{
+			lock.unlock();
+			aio->Reaper.join(); // Already left
+			return;
+		}
+		const unsigned tail = *aio->SqTail;
+		const unsigned idx = tail & aio->SqMask;
+		io_uring_sqe *sqe = &aio->Sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_NOP;
+		sqe->user_data = 0;
+		aio->SqArray[idx] = idx;
+		__atomic_store_n(aio->SqTail, tail + 1, __ATOMIC_RELEASE);
+		int res;
+		do res = uringEnter(aio->RingFd, tail + 1 - __atomic_load_n(aio->SqHead, __ATOMIC_ACQUIRE), 0, 0);
+		while (res < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)); // Otherwise the ring is broken, and the reaper fails on it as well
+	}
+	aio->Reaper.join();
+}
+
+#endif
+
+errno_t stage(SEV_AsyncIo *aio, std::unique_ptr<Op> &op)
+{
+	std::unique_lock<std::mutex> lock(aio->Mutex);
+	if (aio->Failed)
+		return aio->Failed;
+	if (aio->Inflight >= aio->Limit)
+		return EAGAIN;
+	try
+	{
+		aio->Staged.push_back(op.get());
+	}
+	catch (...)
+	{
+		return ENOMEM;
+	}
+	op.release();
+	++aio->Inflight;
+	return 0;
+}
+
+errno_t makeOp(std::unique_ptr<Op> &op, SEV_EventLoop *el, OpType type, int fd, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	try
+	{
+		sev::AsyncIoFunctor f((const sev::AsyncIoFunctorVt *)vt, ptr, forwardConstructor == vt->MoveConstructor);
+		op.reset(new Op(el, std::move(f)));
+	}
+	catch (...)
+	{
+		return ENOMEM;
+	}
+	op->Type = type;
+	op->Fd = fd;
+	return 0;
+}
+
+errno_t transfer(SEV_AsyncIo *aio, SEV_EventLoop *el, OpType type, int fd, void *buffer, int bufferIndex, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	if (offset < 0)
+		return EINVAL;
+	std::unique_ptr<Op> op;
+	errno_t eno = makeOp(op, el, type, fd, vt, ptr, forwardConstructor);
+	if (eno) return eno;
+	op->Data = buffer;
+	op->Size = size > c_MaxTransfer ? c_MaxTransfer : size;
+	op->Offset = offset;
+	op->BufferIndex = bufferIndex;
+	return stage(aio, op);
+}
+
+errno_t transferFixed(SEV_AsyncIo *aio, SEV_EventLoop *el, OpType type, int fd, int bufferIndex, size_t bufferOffset, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	uint8_t *data;
+	{
+		std::unique_lock<std::mutex> lock(aio->Mutex);
+		if (bufferIndex < 0 || bufferIndex >= (int)aio->Buffers.size())
+			return EINVAL;
+		const SEV_AsyncIoBuffer &buffer = aio->Buffers[bufferIndex];
+		if (bufferOffset > buffer.Size || size > buffer.Size - bufferOffset)
+			return EINVAL;
+		data = (uint8_t *)buffer.Data + bufferOffset;
+	}
+	return transfer(aio, el, type, fd, data, bufferIndex, size, offset, vt, ptr, forwardConstructor);
+}
+
+}
+
+}
+
+SEV_AsyncIo *SEV_AsyncIo_create(int entries, int fallbackThreads)
+{
+	using namespace sev::impl::aio;
+	if (entries <= 0)
+		return null;
+	SEV_AsyncIo *aio;
+	try
+	{
+		aio = new SEV_AsyncIo();
+	}
+	catch (...)
+	{
+		return null;
+	}
+#ifdef SEV_ASYNC_FILE_URING
+	if (uringCreate(aio, (unsigned)entries))
+	{
+		try
+		{
+			aio->Reaper = std::thread(uringReap, aio);
+			return aio;
+		}
+		catch (...)
+		{
+			uringRelease(aio);
+			delete aio;
+			return null;
+		}
+	}
+#endif
+	aio->Limit = entries * 2;
+	aio->Pool = SEV_EventLoop_create();
+	if (!aio->Pool)
+	{
+		delete aio;
+		return null;
+	}
+	if (fallbackThreads < 1) fallbackThreads = 1;
+	for (int i = 0; i < fallbackThreads; ++i)
+	{
+		if (poolRun(aio->Pool))
+		{
+			SEV_EventLoop_destroy(aio->Pool);
+			delete aio;
+			return null;
+		}
+	}
+	return aio;
+}
+
+void SEV_AsyncIo_destroy(SEV_AsyncIo *aio)
+{
+	using namespace sev::impl::aio;
+	if (!aio)
+		return;
+	errno_t eno = SEV_AsyncIo_submit(aio);
+	if (eno) failStaged(aio, eno); // Otherwise they would never complete, and the wait below would not end
+	aio->Stopping = true;
+	if (aio->Inflight)
+		aio->Drained.wait();
+#ifdef SEV_ASYNC_FILE_URING
+	if (aio->RingFd >= 0)
+	{
+		uringStop(aio);
+		uringRelease(aio);
+	}
+#endif
+	if (aio->Pool)
+		SEV_EventLoop_destroy(aio->Pool);
+	delete aio;
+}
+
+bool SEV_AsyncIo_isUring(SEV_AsyncIo *aio)
+{
+	return !aio->Pool;
+}
+
+errno_t SEV_AsyncIo_registerBuffers(SEV_AsyncIo *aio, const SEV_AsyncIoBuffer *buffers, int count)
+{
+	if (count <= 0 || count > UINT16_MAX)
+		return EINVAL;
+	std::unique_lock<std::mutex> lock(aio->Mutex);
+	if (!aio->Buffers.empty())
+		return EBUSY;
+	try
+	{
+		aio->Buffers.assign(buffers, buffers + count);
+#ifdef SEV_ASYNC_FILE_URING
+		if (aio->RingFd >= 0)
+		{
+			std::vector<iovec> iov(count);
+			for (int i = 0; i < count; ++i)
+			{
+				iov[i].iov_base = buffers[i].Data;
+				iov[i].iov_len = buffers[i].Size;
+			}
+			// When registration fails, usually due to the locked memory limit, the fixed variants use plain reads and writes
+			aio->BuffersRegistered = !syscall(__NR_io_uring_register, aio->RingFd, IORING_REGISTER_BUFFERS, iov.data(), (unsigned)count);
+		}
+#endif
+	}
+	catch (...)
+	{
+		aio->Buffers.clear();
+		return ENOMEM;
+	}
+	return 0;
+}
+
+errno_t SEV_AsyncIo_readAt(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, void *buffer, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::aio;
+	return transfer(aio, el, OpType::Read, fd, buffer, -1, size, offset, vt, ptr, forwardConstructor);
+}
+
+errno_t SEV_AsyncIo_writeAt(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, const void *buffer, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::aio;
+	return transfer(aio, el, OpType::Write, fd, const_cast<void *>(buffer), -1, size, offset, vt, ptr, forwardConstructor);
+}
+
+errno_t SEV_AsyncIo_readAtFixed(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, int bufferIndex, size_t bufferOffset, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::aio;
+	return transferFixed(aio, el, OpType::Read, fd, bufferIndex, bufferOffset, size, offset, vt, ptr, forwardConstructor);
+}
+
+errno_t SEV_AsyncIo_writeAtFixed(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, int bufferIndex, size_t bufferOffset, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::aio;
+	return transferFixed(aio, el, OpType::Write, fd, bufferIndex, bufferOffset, size, offset, vt, ptr, forwardConstructor);
+}
+
+errno_t SEV_AsyncIo_fsync(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, bool dataOnly, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::aio;
+	std::unique_ptr<Op> op;
+	errno_t eno = makeOp(op, el, OpType::Fsync, fd, vt, ptr, forwardConstructor);
+	if (eno) return eno;
+	op->Flags = dataOnly ? 1 : 0;
+	return stage(aio, op);
+}
+
+errno_t SEV_AsyncIo_openAt(SEV_AsyncIo *aio, SEV_EventLoop *el, int dirFd, const char *path, int flags, int mode, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::aio;
+	std::unique_ptr<Op> op;
+	errno_t eno = makeOp(op, el, OpType::OpenAt, dirFd, vt, ptr, forwardConstructor);
+	if (eno) return eno;
+	try
+	{
+		op->Path = path;
+	}
+	catch (...)
+	{
+		return ENOMEM;
+	}
+	op->Flags = flags | O_CLOEXEC;
+	op->Mode = mode;
+	return stage(aio, op);
+}
+
+errno_t SEV_AsyncIo_submit(SEV_AsyncIo *aio)
+{
+	using namespace sev::impl::aio;
+	errno_t failed;
+	{
+		std::unique_lock<std::mutex> lock(aio->Mutex);
+		if (aio->Staged.empty())
+			return 0;
+		failed = aio->Failed;
+		if (!failed)
+		{
+#ifdef SEV_ASYNC_FILE_URING
+			if (aio->RingFd >= 0)
+				return uringSubmit(aio);
+#endif
+			return poolSubmit(aio);
+		}
+	}
+	// The ring stopped working, staged operations can no longer be sent
+	failStaged(aio, failed);
+	return failed;
+}
+
+#else
+
+SEV_AsyncIo *SEV_AsyncIo_create(int entries, int fallbackThreads)
+{
+	errno = ENOSYS;
+	return null;
+}
+
+void SEV_AsyncIo_destroy(SEV_AsyncIo *aio)
+{
+}
+
+bool SEV_AsyncIo_isUring(SEV_AsyncIo *aio)
+{
+	return false;
+}
+
+errno_t SEV_AsyncIo_registerBuffers(SEV_AsyncIo *aio, const SEV_AsyncIoBuffer *buffers, int count)
+{
+	return ENOSYS;
+}
+
+errno_t SEV_AsyncIo_readAt(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, void *buffer, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return ENOSYS;
+}
+
+errno_t SEV_AsyncIo_writeAt(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, const void *buffer, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return ENOSYS;
+}
+
+errno_t SEV_AsyncIo_readAtFixed(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, int bufferIndex, size_t bufferOffset, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return ENOSYS;
+}
+
+errno_t SEV_AsyncIo_writeAtFixed(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, int bufferIndex, size_t bufferOffset, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return ENOSYS;
+}
+
+errno_t SEV_AsyncIo_fsync(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, bool dataOnly, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return ENOSYS;
+}
+
+errno_t SEV_AsyncIo_openAt(SEV_AsyncIo *aio, SEV_EventLoop *el, int dirFd, const char *path, int flags, int mode, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return ENOSYS;
+}
+
+errno_t SEV_AsyncIo_submit(SEV_AsyncIo *aio)
+{
+	return ENOSYS;
+}
+
+#endif
+
+/* end of file */
@@ -0,0 +1,108 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Asynchronous file I/O. Operations are staged, and sent to the kernel in one batch
+by SEV_AsyncIo_submit. Each completion is posted to the event loop chosen for the
+operation, with the result as a byte count or fd, or a negative errno.
+
+On Linux this uses io_uring directly, with a reaper thread posting completions.
+Buffers may be registered once, and used by the fixed variants, which saves the
+kernel from mapping the pages on every operation. When io_uring is not available,
+or is too old to support openat, operations run as blocking calls on an internal
+thread pool instead.
+
+If the ring stops working, operations sent to it and the ones staged after
+complete with the error. If the completion loop stays out of memory, the
+completion runs on the thread that finished the operation, and its errors are
+discarded.
+
+Not supported on Win32, create returns null with errno set to ENOSYS, and the
+other functions return ENOSYS.
+
+*/
+
+#pragma once
+#ifndef SEV_ASYNC_FILE_H
+#define SEV_ASYNC_FILE_H
+
+#include "platform.h"
+#include "event_loop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct SEV_AsyncIo;
+
+struct SEV_AsyncIoBuffer
+{
+	void *Data;
+	size_t Size;
+
+};
+
+SEV_LIB SEV_AsyncIo *SEV_AsyncIo_create(int entries, int fallbackThreads); // Ring size, and number of threads when falling back to blocking calls. Returns null on failure
+SEV_LIB void SEV_AsyncIo_destroy(SEV_AsyncIo *aio); // Submits staged operations, and waits for all completions to be posted. Operations that cannot be sent complete with the error
+SEV_LIB bool SEV_AsyncIo_isUring(SEV_AsyncIo *aio);
+
+SEV_LIB errno_t SEV_AsyncIo_registerBuffers(SEV_AsyncIo *aio, const SEV_AsyncIoBuffer *buffers, int count); // Once, before any fixed operation. Buffers must remain valid until destroy
+
+// Completion functor is errno_t(EventLoop &el, int64_t result). EAGAIN if too many operations are in flight
+SEV_LIB errno_t SEV_AsyncIo_readAt(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, void *buffer, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_AsyncIo_writeAt(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, const void *buffer, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_AsyncIo_readAtFixed(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, int bufferIndex, size_t bufferOffset, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_AsyncIo_writeAtFixed(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, int bufferIndex, size_t bufferOffset, size_t size, int64_t offset, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_AsyncIo_fsync(SEV_AsyncIo *aio, SEV_EventLoop *el, int fd, bool dataOnly, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_AsyncIo_openAt(SEV_AsyncIo *aio, SEV_EventLoop *el, int dirFd, const char *path, int flags, int mode, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Path is copied
+
+SEV_LIB errno_t SEV_AsyncIo_submit(SEV_AsyncIo *aio); // Send all staged operations. On error the unsent ones stay staged, or complete with the error if the ring stopped working
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#ifdef __cplusplus
+
+namespace sev {
+
+typedef SEV_AsyncIo AsyncIo;
+typedef SEV_AsyncIoBuffer AsyncIoBuffer;
+typedef FunctorVt<errno_t(EventLoop &el, int64_t result)> AsyncIoFunctorVt;
+typedef Functor<errno_t(EventLoop &el, int64_t result)> AsyncIoFunctor;
+typedef FunctorView<errno_t(EventLoop &el, int64_t result)> AsyncIoFunctorView;
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_ASYNC_FILE_H */
+
+/* end of file */
@@ -227,6 +227,17 @@ static SEV_FORCE_INLINE void SEV_Thread_yield()
 #endif
 }
 
+static SEV_FORCE_INLINE void SEV_Thread_pause()
+{
+#if defined(_MSC_VER)
+	YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
 #endif /* #ifndef SEV_ATOMIC_H */
 
 /* end of file */
@@ -0,0 +1,284 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Channel, a bounded ring of values sent to a receiving loop, for moving
+plain structs between loops without a functor per message.
+
+Values are moved into a fixed ring of slots, each with a sequence number
+telling whether it holds the value for the current lap. The receiver is
+only notified on the transition from empty to non-empty, by posting a
+drain to its loop. The drain passes up to a batch of values to the receive
+functor, one at a time, or as contiguous runs of the ring to a functor
+taking a pointer and a count, and reschedules itself when more are pending,
+so other work on the loop is not starved by a busy channel.
+
+A single producer channel only allows one thread to send at a time, and
+skips the compare and swap on the tail. Sending to a full channel fails
+with EAGAIN instead of blocking the sending loop.
+
+*/
+
+#pragma once
+#ifndef SEV_CHANNEL_H
+#define SEV_CHANNEL_H
+
+#include "platform.h"
+#include "event_loop.h"
+
+#ifdef __cplusplus
+
+#include <memory>
+#include <type_traits>
+#include <algorithm>
+
+namespace sev {
+
+namespace impl::ch {
+
+struct Slot
+{
+	std::atomic_size_t Seq; // Twice the index while free for that index, plus one while holding its value. Doubled so a single slot ring can tell holding index i from free for i + 1
+
+};
+
+// Values are kept apart from the sequence numbers, so a run of them can be received as an array
+template<typename T>
+struct Cell
+{
+	alignas(T) unsigned char Value[sizeof(T)];
+
+};
+
+template<typename T, bool MultiProducer>
+struct State : std::enable_shared_from_this<State<T, MultiProducer>>
+{
+	State(EventLoop &el, size_t capacity, Functor<errno_t(EventLoop &el, T &value)> &&f, Functor<errno_t(EventLoop &el, T *values, size_t count)> &&fs, bool spans, int batch) : Loop(el), Mask(capacity - 1), Batch(batch),
+		Spans(spans), OnReceive(std::move(f)), OnReceiveSpan(std::move(fs)), Slots(new Slot[capacity]), Cells(new Cell<T>[capacity]), Tail(0), Head(0)
+	{
+		for (size_t i = 0; i < capacity; ++i)
+			Slots[i].Seq.store(2 * i, std::memory_order_relaxed);
+	}
+
+	~State()
+	{
+		// Values that were never received
+		for (; ready(Head); ++Head)
+			value(Head)->~T();
+	}
+
+	EventLoop &Loop;
+	const size_t Mask;
+	const int Batch;
+	const bool Spans; // Receiving runs of values
+	Functor<errno_t(EventLoop &el, T &value)> OnReceive;
+	Functor<errno_t(EventLoop &el, T *values, size_t count)> OnReceiveSpan;
+	std::unique_ptr<Slot[]> Slots;
+	std::unique_ptr<Cell<T>[]> Cells;
+
+	alignas(64) std::atomic_size_t Tail; // Next index to send
+	DrainSchedule Scheduled;
+
+	alignas(64) size_t Head; // Next index to receive, only touched by the drain
+
+	T *value(size_t pos) noexcept
+	{
+		return reinterpret_cast<T *>(Cells[pos & Mask].Value);
+	}
+
+	bool ready(size_t pos) const noexcept
+	{
+		return Slots[pos & Mask].Seq.load(std::memory_order_acquire) == 2 * pos + 1;
+	}
+
+	errno_t send(T &&v) noexcept
+	{
+		size_t pos = Tail.load(std::memory_order_relaxed);
+		Slot *slot;
+		for (;;)
+		{
+			slot = &Slots[pos & Mask];
+			const size_t seq = slot->Seq.load(std::memory_order_acquire);
+			if (seq != 2 * pos)
+			{
+				if ((ptrdiff_t)(seq - 2 * pos) < 0)
+					return EAGAIN; // Full, the receiver has not freed the slot from the previous lap
+				pos = Tail.load(std::memory_order_relaxed); // Claimed by another producer
+				continue;
+			}
+			if constexpr (MultiProducer)
+			{
+				if (Tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else
+			{
+				Tail.store(pos + 1, std::memory_order_relaxed);
+				break;
+			}
+		}
+		new (value(pos)) T(std::move(v));
+		slot->Seq.store(2 * pos + 1, std::memory_order_release);
+		return Scheduled.request([this]() -> errno_t {
+			return schedule();
+		});
+	}
+
+	errno_t schedule() noexcept
+	{
+		std::shared_ptr<State> self = this->shared_from_this();
+		return sev::post(Loop, [self](EventLoop &el) -> errno_t {
+			return self->drain(el);
+		});
+	}
+
+	// Called after a drain, schedules the next one if there is more to receive
+	void done() noexcept
+	{
+		const size_t head = Head; // The next drain owns Head
+		Scheduled.finish([this, head]() -> bool {
+			return ready(head);
+		}, [this]() -> errno_t {
+			return schedule();
+		});
+	}
+
+	errno_t drain(EventLoop &el)
+	{
+		auto fin = gsl::finally([this]() -> void {
+			done();
+		});
+		errno_t eno = 0;
+		if (Spans)
+		{
+			for (size_t received = 0; received < (size_t)Batch && !eno && ready(Head);)
+			{
+				// Contiguous up to the end of the ring, the rest is the next run
+				const size_t limit = std::min((size_t)Batch - received, Mask + 1 - (Head & Mask));
+				size_t count = 1;
+				while (count < limit && ready(Head + count))
+					++count;
+				T *v = value(Head);
+				auto release = gsl::finally([&]() -> void {
+					for (size_t i = 0; i < count; ++i)
+					{
+						v[i].~T();
+						Slots[(Head + i) & Mask].Seq.store(2 * (Head + i + Mask + 1), std::memory_order_release);
+					}
+					Head += count;
+				});
+				received += count;
+				eno = OnReceiveSpan(el, v, count);
+			}
+			return eno;
+		}
+		for (int i = 0; i < Batch && !eno && ready(Head); ++i)
+		{
+			T *v = value(Head);
+			auto release = gsl::finally([&]() -> void {
+				v->~T();
+				Slots[Head & Mask].Seq.store(2 * (Head + Mask + 1), std::memory_order_release);
+				++Head;
+			});
+			eno = OnReceive(el, *v);
+		}
+		return eno;
+	}
+
+};
+
+}
+
+//! Bounded channel of values to a receiving loop. A single producer channel only allows one thread to send at a time
+template<typename T, bool MultiProducer = false>
+class Channel
+{
+public:
+	static_assert(std::is_nothrow_move_constructible_v<T>, "Values are moved into claimed slots, which cannot be given back");
+
+	//! Capacity is rounded up to a power of two, a capacity of 1 holds a single value. Receive functor `errno_t(EventLoop &el, T &value)` runs on the receiving loop for one value at a time,
+	//! or `errno_t(EventLoop &el, T *values, size_t count)` for runs of values, which are released when it returns.
+	//! Batch is the number of values received by one drain before it yields the loop thread
+	template<typename TFn>
+	Channel(EventLoop &receiver, ptrdiff_t capacity, TFn &&onReceive, int batch = 64)
+		: m_State(makeState(receiver, roundUp(capacity), std::forward<TFn>(onReceive), batch))
+	{
+	}
+
+	Channel(const Channel &other) = delete;
+	Channel &operator=(const Channel &other) = delete;
+
+	EventLoop &receiver() const noexcept
+	{
+		return m_State->Loop;
+	}
+
+	//! EAGAIN when full. Otherwise the value is queued, and other errors come from notifying the receiver, which the next send retries
+	errno_t send(T value) noexcept
+	{
+		return m_State->send(std::move(value));
+	}
+
+	//! Construct the value in place of the argument, same results as send
+	template<typename... TArgs>
+	errno_t emplace(TArgs &&... args)
+	{
+		return m_State->send(T(std::forward<TArgs>(args)...));
+	}
+
+private:
+	std::shared_ptr<impl::ch::State<T, MultiProducer>> m_State;
+
+	template<typename TFn>
+	static std::shared_ptr<impl::ch::State<T, MultiProducer>> makeState(EventLoop &receiver, size_t capacity, TFn &&onReceive, int batch)
+	{
+		if constexpr (std::is_invocable_r_v<errno_t, TFn &, EventLoop &, T *, size_t>)
+			return std::make_shared<impl::ch::State<T, MultiProducer>>(receiver, capacity, Functor<errno_t(EventLoop &el, T &value)>(), Functor<errno_t(EventLoop &el, T *values, size_t count)>(std::forward<TFn>(onReceive)), true, batch);
+		else
+			return std::make_shared<impl::ch::State<T, MultiProducer>>(receiver, capacity, Functor<errno_t(EventLoop &el, T &value)>(std::forward<TFn>(onReceive)), Functor<errno_t(EventLoop &el, T *values, size_t count)>(), false, batch);
+	}
+
+	static size_t roundUp(ptrdiff_t capacity) noexcept
+	{
+		size_t res = 1;
+		while (res < (size_t)capacity)
+			res <<= 1;
+		return res;
+	}
+
+};
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_CHANNEL_H */
+
+/* end of file */
@@ -213,12 +213,20 @@ public:
 	inline ConcurrentFunctorQueue(nothrow_t, ptrdiff_t blockSize = (64 * 1024)) noexcept : impl::q::ConcurrentFunctorQueue<TRes, TArgs...>(nothrow, blockSize) { }
 
 	inline TRes tryCallAndPop(ExceptionHandle &eh, bool &success, TArgs... args) noexcept
+	{
+		return tryCallAndPop(eh, success, null, null, args...);
+	}
+
+	// Stores the vtable of the popped functor to running, and decrements started, before calling it, so other threads can sample what runs and what still waits
+	inline TRes tryCallAndPop(ExceptionHandle &eh, bool &success, std::atomic<const SEV_FunctorVt *> *running, std::atomic_int *started, TArgs... args) noexcept
 	{
 		TRes res;
 		const SEV_FunctorVt *rvt = null;
 		auto invokeData = [&](void *ptr, const SEV_FunctorVt *vt) -> errno_t {
 			typedef FunctorVt<TRes(TArgs...)>::TTryInvoke TFn; // typedef TRes(*TFn)(void *ptr, void **err, TArgs...);
 			rvt = vt;
+			if (running) running->store(vt, std::memory_order_relaxed);
+			if (started) --*started;
 			res = ((TFn)vt->TryInvoke)(ptr, eh, args...);
 			return eh.raised() ? eh.errNo() : SEV_ESUCCESS;
 		};
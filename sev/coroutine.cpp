@@ -0,0 +1,116 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "coroutine.h"
+
+#include <stdlib.h>
+
+namespace /* anonymous */ {
+
+constexpr size_t c_FrameSizes[] = { 256, 512, 1024, 2048 };
+constexpr int c_NbFrameSizes = sizeof(c_FrameSizes) / sizeof(c_FrameSizes[0]);
+constexpr int c_MaxFreeFrames = 64; // Per size class and thread
+
+struct FreeFrame
+{
+	FreeFrame *Next;
+
+};
+
+struct FramePool
+{
+	FreeFrame *Free[c_NbFrameSizes] = {};
+	int NbFree[c_NbFrameSizes] = {};
+
+	~FramePool()
+	{
+		for (int i = 0; i < c_NbFrameSizes; ++i)
+		{
+			while (FreeFrame *frame = Free[i])
+			{
+				Free[i] = frame->Next;
+				free(frame);
+			}
+		}
+	}
+
+};
+
+thread_local FramePool t_FramePool;
+
+int frameSizeClass(size_t size)
+{
+	for (int i = 0; i < c_NbFrameSizes; ++i)
+		if (size <= c_FrameSizes[i])
+			return i;
+	return -1;
+}
+
+}
+
+void *SEV_Coroutine_allocFrame(size_t size)
+{
+	const int sc = frameSizeClass(size);
+	if (sc < 0)
+		return malloc(size);
+	FramePool &pool = t_FramePool;
+	FreeFrame *frame = pool.Free[sc];
+	if (frame)
+	{
+		pool.Free[sc] = frame->Next;
+		--pool.NbFree[sc];
+		return frame;
+	}
+	return malloc(c_FrameSizes[sc]);
+}
+
+void SEV_Coroutine_freeFrame(void *ptr, size_t size)
+{
+	if (!ptr)
+		return;
+	const int sc = frameSizeClass(size);
+	if (sc < 0)
+	{
+		free(ptr);
+		return;
+	}
+	// Frames may be released on another thread than the one that allocated them, they join that thread's list
+	FramePool &pool = t_FramePool;
+	if (pool.NbFree[sc] >= c_MaxFreeFrames)
+	{
+		free(ptr);
+		return;
+	}
+	FreeFrame *frame = (FreeFrame *)ptr;
+	frame->Next = pool.Free[sc];
+	pool.Free[sc] = frame;
+	++pool.NbFree[sc];
+}
+
+/* end of file */
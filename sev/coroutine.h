@@ -0,0 +1,367 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Coroutine support for the event loops. A coroutine moves onto a loop with
+`co_await sev::schedule(el)`, and `co_await sev::sleepFor(el, d)` resumes it on
+the loop once the delay has passed. Resuming only posts the coroutine handle,
+the coroutine state stays in its frame.
+
+Task<T> is a lazy coroutine, which runs on the thread that awaits it until it
+moves onto a loop itself. The awaiting coroutine is resumed directly when the
+task completes. Use start to run a task without awaiting it, any exception it
+leaks is rethrown on the loop.
+
+Frames are allocated from per-thread free lists by size class.
+
+Requires C++20, SEV_COROUTINE is defined when available.
+
+*/
+
+#pragma once
+#ifndef SEV_COROUTINE_H
+#define SEV_COROUTINE_H
+
+#include "platform.h"
+#include "event_loop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SEV_LIB void *SEV_Coroutine_allocFrame(size_t size); // Returns null on failure
+SEV_LIB void SEV_Coroutine_freeFrame(void *ptr, size_t size); // Size must match the allocation
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#if defined(__cplusplus) && defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define SEV_COROUTINE
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <chrono>
+#include <climits>
+
+namespace sev {
+
+namespace impl::co {
+
+inline errno_t resume(EventLoop &el, std::coroutine_handle<> h, int timeoutMs = -1)
+{
+	auto f = [h](EventLoop &) -> errno_t {
+		h.resume();
+		return 0;
+	};
+	return timeoutMs >= 0 ? timeout(el, std::move(f), timeoutMs) : post(el, std::move(f));
+}
+
+class LoopAwaiter
+{
+public:
+	LoopAwaiter(EventLoop &el, int timeoutMs) noexcept : m_Loop(el), m_TimeoutMs(timeoutMs)
+	{
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	bool await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		// Once posted, the coroutine may resume and release this awaiter on another thread, so don't touch it
+		errno_t eno = resume(m_Loop, h, m_TimeoutMs);
+		if (eno)
+		{
+			m_Eno = eno; // Continue right away, and throw from await_resume
+			return false;
+		}
+		return true;
+	}
+
+	void await_resume() const
+	{
+		ExceptionHandle::rethrow(m_Eno);
+	}
+
+private:
+	EventLoop &m_Loop;
+	int m_TimeoutMs;
+	errno_t m_Eno = 0;
+
+};
+
+class PromiseBase
+{
+public:
+	static void *operator new(size_t size)
+	{
+		void *ptr = SEV_Coroutine_allocFrame(size);
+		if (!ptr) throw std::bad_alloc();
+		return ptr;
+	}
+
+	static void operator delete(void *ptr, size_t size) noexcept
+	{
+		SEV_Coroutine_freeFrame(ptr, size);
+	}
+
+	std::suspend_always initial_suspend() const noexcept
+	{
+		return {};
+	}
+
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		template<typename TPromise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<TPromise> h) noexcept
+		{
+			PromiseBase &promise = h.promise();
+			if (promise.Continuation)
+				return promise.Continuation;
+			if (promise.Detached)
+			{
+				// Nobody is waiting for the result, release the frame and report any exception to the loop
+				EventLoop &el = *promise.Detached;
+				std::exception_ptr ex = std::move(promise.Exception);
+				h.destroy();
+				if (ex)
+				{
+					auto f = [ex](EventLoop &) -> errno_t {
+						std::rethrow_exception(ex);
+						return 0;
+					};
+					if (post(el, std::move(f)))
+						std::terminate();
+				}
+			}
+			return std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept
+		{
+		}
+
+	};
+
+	FinalAwaiter final_suspend() const noexcept
+	{
+		return {};
+	}
+
+	void unhandled_exception() noexcept
+	{
+		Exception = std::current_exception();
+	}
+
+	std::coroutine_handle<> Continuation;
+	std::exception_ptr Exception;
+	EventLoop *Detached = null; // Set by start, the frame releases itself when done
+
+};
+
+}
+
+//! Resume the calling coroutine on the event loop
+inline impl::co::LoopAwaiter schedule(EventLoop &el) noexcept
+{
+	return impl::co::LoopAwaiter(el, -1);
+}
+
+//! Resume the calling coroutine on the event loop after the delay, rounded up to milliseconds
+template<class TRep, class TPeriod>
+impl::co::LoopAwaiter sleepFor(EventLoop &el, const std::chrono::duration<TRep, TPeriod> &delay) noexcept
+{
+	const int64_t ms = std::chrono::ceil<std::chrono::milliseconds>(delay).count();
+	return impl::co::LoopAwaiter(el, ms < 0 ? 0 : (ms > INT_MAX ? INT_MAX : (int)ms));
+}
+
+template<typename T = void>
+class Task;
+
+namespace impl::co {
+
+template<typename T>
+class Promise : public PromiseBase
+{
+public:
+	Task<T> get_return_object() noexcept;
+
+	template<typename TValue>
+	void return_value(TValue &&value)
+	{
+		Value.emplace(std::forward<TValue>(value));
+	}
+
+	T result()
+	{
+		if (Exception)
+			std::rethrow_exception(Exception);
+		return std::move(*Value);
+	}
+
+	std::optional<T> Value;
+
+};
+
+template<>
+class Promise<void> : public PromiseBase
+{
+public:
+	Task<void> get_return_object() noexcept;
+
+	void return_void() noexcept
+	{
+	}
+
+	void result()
+	{
+		if (Exception)
+			std::rethrow_exception(Exception);
+	}
+
+};
+
+}
+
+template<typename T>
+class Task
+{
+public:
+	using promise_type = impl::co::Promise<T>;
+	using handle_type = std::coroutine_handle<promise_type>;
+
+	Task() noexcept
+	{
+	}
+
+	explicit Task(handle_type h) noexcept : m_Handle(h)
+	{
+	}
+
+	Task(Task &&other) noexcept : m_Handle(other.m_Handle)
+	{
+		other.m_Handle = null;
+	}
+
+	Task &operator=(Task &&other) noexcept
+	{
+		if (this != &other)
+		{
+			if (m_Handle) m_Handle.destroy();
+			m_Handle = other.m_Handle;
+			other.m_Handle = null;
+		}
+		return *this;
+	}
+
+	Task(const Task &other) = delete;
+	Task &operator=(const Task &other) = delete;
+
+	~Task() noexcept
+	{
+		if (m_Handle) m_Handle.destroy();
+	}
+
+	//! Run the task on the event loop without awaiting it
+	void start(EventLoop &el)
+	{
+		SEV_ASSERT(m_Handle && !m_Handle.done());
+		m_Handle.promise().Detached = &el;
+		errno_t eno = impl::co::resume(el, m_Handle);
+		if (eno)
+		{
+			m_Handle.promise().Detached = null;
+			ExceptionHandle::rethrow(eno);
+		}
+		m_Handle = null;
+	}
+
+	auto operator co_await() && noexcept
+	{
+		struct Awaiter
+		{
+			bool await_ready() const noexcept
+			{
+				return !Handle || Handle.done();
+			}
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+			{
+				Handle.promise().Continuation = continuation;
+				return Handle; // Symmetric transfer, the task runs right away on this thread
+			}
+
+			T await_resume()
+			{
+				return Handle.promise().result();
+			}
+
+			handle_type Handle;
+
+		};
+		return Awaiter{ m_Handle };
+	}
+
+private:
+	handle_type m_Handle;
+
+};
+
+namespace impl::co {
+
+template<typename T>
+inline Task<T> Promise<T>::get_return_object() noexcept
+{
+	return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept
+{
+	return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}
+
+}
+
+#endif /* #if defined(__cplusplus) && defined(__cpp_impl_coroutine) && __has_include(<coroutine>) */
+
+#endif /* #ifndef SEV_COROUTINE_H */
+
+/* end of file */
@@ -0,0 +1,241 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Debouncer and throttler, coalescing rapid triggers into few runs of a
+functor, with at most one timeout pending per instance.
+
+A debouncer runs the functor once no trigger came for the delay. Its single
+timeout checks the time of the latest trigger when it fires, and waits for
+the remainder instead of running when triggers came meanwhile.
+
+A throttler runs the functor at most once per window. A trigger while idle
+runs it right away, later triggers in the window are coalesced into one
+run at the end of the window.
+
+The functor never runs concurrently with itself. Triggers that come while
+it runs are handled once it returns. Destroying the instance cancels the
+pending run, a run already in progress completes.
+
+*/
+
+#pragma once
+#ifndef SEV_DEBOUNCE_H
+#define SEV_DEBOUNCE_H
+
+#include "platform.h"
+#include "event_loop.h"
+
+#ifdef __cplusplus
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+namespace sev {
+
+namespace impl::db {
+
+inline int64_t nowMs() noexcept
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct DebounceState : std::enable_shared_from_this<DebounceState>
+{
+	DebounceState(EventLoop &el, int delayMs, EventFunctor &&f) : Loop(el), DelayMs(delayMs), F(std::move(f)), Last(0), Seq(0), Armed(false), Cancelled(false)
+	{
+	}
+
+	EventLoop &Loop;
+	const int DelayMs;
+	EventFunctor F;
+	std::atomic_int64_t Last; // Time of the latest trigger
+	std::atomic_uint64_t Seq; // Number of triggers, tells triggers within the same millisecond apart
+	std::atomic_bool Armed; // The timeout is pending, or the functor is running
+	std::atomic_bool Cancelled; // The debouncer was destroyed
+
+	errno_t trigger() noexcept
+	{
+		Last = nowMs();
+		++Seq;
+		if (Armed.exchange(true))
+			return 0; // The pending timeout sees the new time
+		return arm(DelayMs);
+	}
+
+	errno_t arm(int delayMs) noexcept
+	{
+		std::shared_ptr<DebounceState> self = shared_from_this();
+		errno_t eno = sev::timeout(Loop, [self](EventLoop &el) -> errno_t {
+			return self->fire(el);
+		}, std::max(delayMs, 1));
+		if (eno)
+			Armed = false; // The next trigger retries
+		return eno;
+	}
+
+	errno_t fire(EventLoop &el)
+	{
+		if (Cancelled)
+			return 0;
+		const uint64_t seq = Seq;
+		const int64_t elapsed = nowMs() - Last;
+		if (elapsed < DelayMs)
+			return arm((int)(DelayMs - elapsed));
+		auto fin = gsl::finally([this, seq]() -> void {
+			Armed = false;
+			if (Seq != seq && !Cancelled && !Armed.exchange(true))
+				arm((int)(DelayMs - (nowMs() - Last))); // Triggered while running
+		});
+		return F(el);
+	}
+
+};
+
+struct ThrottleState : std::enable_shared_from_this<ThrottleState>
+{
+	ThrottleState(EventLoop &el, int windowMs, EventFunctor &&f) : Loop(el), WindowMs(windowMs), F(std::move(f)), LastRun(INT64_MIN / 2), Pending(false), Armed(false), Cancelled(false)
+	{
+	}
+
+	EventLoop &Loop;
+	const int WindowMs;
+	EventFunctor F;
+	std::atomic_int64_t LastRun;
+	std::atomic_bool Pending; // Triggered since the last run started
+	std::atomic_bool Armed; // A run is scheduled, or the functor is running
+	std::atomic_bool Cancelled; // The throttler was destroyed
+
+	errno_t trigger() noexcept
+	{
+		Pending = true;
+		if (Armed.exchange(true))
+			return 0; // Coalesced into the scheduled run
+		return arm();
+	}
+
+	// Schedule a run at the start of the next window
+	errno_t arm() noexcept
+	{
+		std::shared_ptr<ThrottleState> self = shared_from_this();
+		auto run = [self](EventLoop &el) -> errno_t {
+			return self->fire(el);
+		};
+		const int64_t wait = LastRun + WindowMs - nowMs();
+		errno_t eno = wait > 0 ? sev::timeout(Loop, std::move(run), (int)wait) : sev::post(Loop, std::move(run));
+		if (eno)
+			Armed = false; // The next trigger retries
+		return eno;
+	}
+
+	errno_t fire(EventLoop &el)
+	{
+		if (Cancelled)
+			return 0;
+		Pending = false;
+		LastRun = nowMs();
+		auto fin = gsl::finally([this]() -> void {
+			Armed = false;
+			if (Pending && !Cancelled && !Armed.exchange(true))
+				arm(); // Triggered while running
+		});
+		return F(el);
+	}
+
+};
+
+}
+
+class Debouncer
+{
+public:
+	//! Run functor `errno_t(EventLoop &el)` on the loop once no trigger came for the delay
+	template<typename TFn>
+	Debouncer(EventLoop &el, int delayMs, TFn &&f) : m_State(std::make_shared<impl::db::DebounceState>(el, delayMs, makeEventFunctor(std::forward<TFn>(f))))
+	{
+	}
+
+	//! Cancels the pending run
+	~Debouncer()
+	{
+		m_State->Cancelled = true;
+	}
+
+	Debouncer(const Debouncer &other) = delete;
+	Debouncer &operator=(const Debouncer &other) = delete;
+
+	//! Errors come from scheduling the timeout, which the next trigger retries
+	errno_t trigger() noexcept
+	{
+		return m_State->trigger();
+	}
+
+private:
+	std::shared_ptr<impl::db::DebounceState> m_State;
+
+};
+
+class Throttler
+{
+public:
+	//! Run functor `errno_t(EventLoop &el)` on the loop at most once per window
+	template<typename TFn>
+	Throttler(EventLoop &el, int windowMs, TFn &&f) : m_State(std::make_shared<impl::db::ThrottleState>(el, windowMs, makeEventFunctor(std::forward<TFn>(f))))
+	{
+	}
+
+	//! Cancels the pending run
+	~Throttler()
+	{
+		m_State->Cancelled = true;
+	}
+
+	Throttler(const Throttler &other) = delete;
+	Throttler &operator=(const Throttler &other) = delete;
+
+	//! Errors come from scheduling the run, which the next trigger retries
+	errno_t trigger() noexcept
+	{
+		return m_State->trigger();
+	}
+
+private:
+	std::shared_ptr<impl::db::ThrottleState> m_State;
+
+};
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_DEBOUNCE_H */
+
+/* end of file */
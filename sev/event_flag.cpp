@@ -216,11 +216,17 @@ bool SEV_EventFlag_waitFor(SEV_EventFlag *ef, int timeoutMs)
 		++m->Waiting;
 		if (m->Reset) // Reset cannot keep an already-waiting thread blocking
 			m->Flag = false;
+		const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
 		while (!m->Flag)
 		{
-			res = m->CondVar.wait_for(lock, std::chrono::milliseconds(timeoutMs)) != std::cv_status::timeout; // Mutex is unlocked while waiting, relocked when back
+			if (m->CondVar.wait_until(lock, deadline) == std::cv_status::timeout && !m->Flag) // Mutex is unlocked while waiting, relocked when back
+			{
+				res = false;
+				break;
+			}
 		}
-		m->Flag = m->ResetValue;
+		if (res)
+			m->Flag = m->ResetValue;
 		--m->Waiting;
 		exc = m->Delete;
 		del = !m->Waiting && exc; // Delete on last thread exit
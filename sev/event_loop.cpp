@@ -95,6 +95,140 @@ void SEV_EventLoop_stop(SEV_EventLoop *el)
 	el->Vt->Stop(el);
 }
 
+errno_t SEV_EventLoop_runOnCpus(SEV_EventLoop *el, const SEV_CpuSet *cpus, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return el->Vt->RunOnCpus(el, cpus, onError, ptr, forwardConstructor);
+}
+
+errno_t SEV_EventLoop_runOnNode(SEV_EventLoop *el, int node, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	SEV_CpuSet cpus;
+	errno_t eno = SEV_Numa_nodeCpus(node, &cpus);
+	if (eno) return eno;
+	if (!SEV_CpuSet_count(&cpus)) return EINVAL; // Gap in the node ids
+	return el->Vt->RunOnCpus(el, &cpus, onError, ptr, forwardConstructor);
+}
+
+errno_t SEV_EventLoop_setWaitPolicy(SEV_EventLoop *el, const SEV_EventLoopWaitPolicy *policy)
+{
+	return el->Vt->SetWaitPolicy(el, policy);
+}
+
+errno_t SEV_EventLoop_runElastic(SEV_EventLoop *el, const SEV_EventLoopElasticPolicy *policy, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return el->Vt->RunElastic(el, policy, onError, ptr, forwardConstructor);
+}
+
+errno_t SEV_EventLoop_enableMetrics(SEV_EventLoop *el, bool enabled)
+{
+	sev::impl::el::EventLoopBase *elp = sev::impl::el::builtIn(el);
+	if (!elp) return ENOSYS;
+	elp->MetricsEnabled = enabled;
+	return 0;
+}
+
+errno_t SEV_EventLoop_getMetrics(SEV_EventLoop *el, SEV_EventLoopMetrics *metrics, SEV_EventLoopThreadMetrics *threads, int *nbThreads)
+{
+	sev::impl::el::EventLoopBase *elp = sev::impl::el::builtIn(el);
+	if (!elp) return ENOSYS;
+	memset(metrics, 0, sizeof(SEV_EventLoopMetrics));
+	metrics->QueueDepth = elp->QueueItems;
+	metrics->Threads = elp->Threads;
+	metrics->ThreadsWaiting = elp->ThreadsWaiting;
+	std::unique_lock<sev::AtomicMutex> lock(elp->MetricsMutex);
+	int count = 0;
+	for (sev::impl::el::MetricsSlot *slot = elp->MetricsSlots; slot; slot = slot->Next)
+	{
+		SEV_EventLoopThreadMetrics t;
+		t.Tasks = slot->Tasks.load(std::memory_order_relaxed);
+		t.Wakeups = slot->Wakeups.load(std::memory_order_relaxed);
+		t.BusyNs = slot->BusyNs.load(std::memory_order_relaxed);
+		t.IdleNs = slot->IdleNs.load(std::memory_order_relaxed);
+		for (int i = 0; i < SEV_EVENT_LOOP_METRICS_BUCKETS; ++i)
+		{
+			t.LatencyHistogram[i] = slot->Latency[i].load(std::memory_order_relaxed);
+			t.ExecutionHistogram[i] = slot->Execution[i].load(std::memory_order_relaxed);
+		}
+		SEV_EventLoopThreadMetrics &total = metrics->Total;
+		total.Tasks += t.Tasks;
+		total.Wakeups += t.Wakeups;
+		total.BusyNs += t.BusyNs;
+		total.IdleNs += t.IdleNs;
+		for (int i = 0; i < SEV_EVENT_LOOP_METRICS_BUCKETS; ++i)
+		{
+			total.LatencyHistogram[i] += t.LatencyHistogram[i];
+			total.ExecutionHistogram[i] += t.ExecutionHistogram[i];
+		}
+		if (threads && count < *nbThreads)
+			threads[count] = t;
+		++count;
+	}
+	if (!threads)
+		return 0;
+	const bool fits = count <= *nbThreads;
+	*nbThreads = count;
+	return fits ? 0 : ERANGE;
+}
+
+errno_t SEV_EventLoop_setWatchdog(SEV_EventLoop *el, int thresholdMs, const SEV_FunctorVt *onSlow, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	sev::impl::el::EventLoopBase *elp = sev::impl::el::builtIn(el);
+	if (!elp)
+		return ENOSYS;
+	if (thresholdMs < 0 || (thresholdMs && !onSlow))
+		return EINVAL;
+	sev::impl::el::watchdogRelease(elp);
+	if (!thresholdMs)
+		return 0;
+	std::unique_lock<std::mutex> lock(elp->WatchdogMutex);
+	try
+	{
+		elp->WatchdogOnSlow = sev::Functor<void(const SEV_FunctorVt *, int64_t)>((sev::FunctorVt<void(const SEV_FunctorVt *, int64_t)> *)onSlow, ptr, forwardConstructor == onSlow->MoveConstructor);
+	}
+	catch (...)
+	{
+		return ENOMEM;
+	}
+	elp->WatchdogStopping = false;
+	elp->WatchdogThresholdMs = thresholdMs;
+	try
+	{
+		elp->WatchdogThread = std::thread(sev::impl::el::watchdogThread, elp);
+	}
+	catch (...)
+	{
+		return EOTHER;
+	}
+	return 0;
+}
+
+SEV_EventLoop *SEV_EventLoop_current()
+{
+	return sev::impl::el::t_CurrentLoop;
+}
+
+int SEV_EventLoop_threads(SEV_EventLoop *el)
+{
+	sev::impl::el::EventLoopBase *elp = sev::impl::el::builtIn(el);
+	if (!elp) return 0;
+	return elp->Threads;
+}
+
+errno_t SEV_EventLoop_watchFd(SEV_EventLoop *el, int fd, uint32_t events, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return el->Vt->WatchFd(el, fd, events, vt, ptr, forwardConstructor);
+}
+
+errno_t SEV_EventLoop_modifyFd(SEV_EventLoop *el, int fd, uint32_t events)
+{
+	return el->Vt->ModifyFd(el, fd, events);
+}
+
+errno_t SEV_EventLoop_unwatchFd(SEV_EventLoop *el, int fd)
+{
+	return el->Vt->UnwatchFd(el, fd);
+}
+
 errno_t SEV_IMPL_EventLoopBase_post(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size)
 {
 	// Generic unoptimized wrapper
@@ -127,6 +261,18 @@ errno_t SEV_IMPL_EventLoopBase_post(SEV_EventLoop *el, errno_t(*f)(void *ptr, SE
 	return 0;
 }
 
+errno_t SEV_IMPL_EventLoopBase_timeoutFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs)
+{
+	return sev::impl::el::timerAdd(el, vt, ptr, forwardConstructor, timeoutMs, 0);
+}
+
+errno_t SEV_IMPL_EventLoopBase_intervalFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int intervalMs)
+{
+	if (intervalMs <= 0)
+		return EINVAL;
+	return sev::impl::el::timerAdd(el, vt, ptr, forwardConstructor, intervalMs, intervalMs);
+}
+
 void SEV_IMPL_EventLoopBase_invoke(SEV_EventLoop *el, SEV_ExceptionHandle *eh, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr)
 {
 	((sev::ExceptionHandle *)eh)->capture<void>([=]() -> void {
@@ -222,19 +368,637 @@ SEV_EventLoopVt EventLoopVt = {
 
 	SEV_IMPL_EventLoop_postFunctor,
 	SEV_IMPL_EventLoop_invokeFunctor,
-	null, // TimeoutFunctor
-	null, // IntervalFunctor
+	SEV_IMPL_EventLoopBase_timeoutFunctor,
+	SEV_IMPL_EventLoopBase_intervalFunctor,
 
-	null, // Join
+	SEV_IMPL_EventLoop_join,
 
 	SEV_IMPL_EventLoop_run, // Run
 	SEV_IMPL_EventLoop_loop, // Loop
 	SEV_IMPL_EventLoop_stop, // Stop
 
+	SEV_IMPL_EventLoop_runOnCpus, // RunOnCpus
+	SEV_IMPL_EventLoop_setWaitPolicy, // SetWaitPolicy
+
+	SEV_IMPL_EventLoop_watchFd, // WatchFd
+	SEV_IMPL_EventLoop_modifyFd, // ModifyFd
+	SEV_IMPL_EventLoop_unwatchFd, // UnwatchFd
+
+	SEV_IMPL_EventLoop_runElastic, // RunElastic
+
+};
+
+thread_local EventLoopBase *t_CurrentLoop = null;
+thread_local MetricsSlot *t_Metrics = null;
+
+namespace /* anonymous */ {
+
+thread_local bool t_Managed = false; // Running a managed thread
+thread_local bool t_Retired = false; // Managed thread retired, and must exit
+
+}
+
+namespace /* anonymous */ {
+
+constexpr int64_t c_IdleCapNs = 1000000; // Longer idle periods count as 1ms, so the average recovers quickly when a burst starts
+constexpr int c_SpinMin = 16; // Adaptive spin count when work arrives right away
+constexpr int c_SpinSample = 64; // Spins shorter than this are too short to time
+
+}
+
+bool spinWait(EventLoopBase *elp)
+{
+	int spin = elp->SpinIterations.load(std::memory_order_relaxed);
+	const int yields = elp->YieldIterations.load(std::memory_order_relaxed);
+	const bool adaptive = elp->SpinAdaptive.load(std::memory_order_relaxed);
+	if (adaptive)
+	{
+		const int64_t pausePs = elp->PausePs.load(std::memory_order_relaxed);
+		if (pausePs)
+		{
+			// Spin for about twice the recent idle time, up to the configured count.
+			// Not worth spinning at all when work has recently been arriving much later than a full spin lasts
+			const int64_t budget = elp->IdleAverageNs.load(std::memory_order_relaxed) * 2000 / pausePs + c_SpinMin;
+			if (budget > 4 * (int64_t)spin)
+				return elp->Pending || !elp->Running;
+			if (budget < spin)
+				spin = (int)budget;
+		}
+	}
+	std::chrono::steady_clock::time_point spinStart;
+	if (adaptive && spin >= c_SpinSample)
+		spinStart = std::chrono::steady_clock::now();
+	int i = 0;
+	for (; i < spin; ++i)
+	{
+		if (elp->Pending || !elp->Running)
+			break;
+		SEV_Thread_pause();
+	}
+	if (adaptive && i >= c_SpinSample)
+	{
+		const int64_t ps = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - spinStart).count() * 1000 / i;
+		const int64_t avg = elp->PausePs.load(std::memory_order_relaxed);
+		elp->PausePs.store(avg ? avg + (ps - avg) / 8 : std::max<int64_t>(ps, 1), std::memory_order_relaxed);
+	}
+	if (i < spin)
+		return true;
+	for (int j = 0; j < yields; ++j)
+	{
+		if (elp->Pending || !elp->Running)
+			return true;
+		SEV_Thread_yield();
+	}
+	return elp->Pending || !elp->Running;
+}
+
+void idleEnded(EventLoopBase *elp, std::chrono::steady_clock::time_point idleStart)
+{
+	int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - idleStart).count();
+	if (ns > c_IdleCapNs) ns = c_IdleCapNs;
+	const int64_t avg = elp->IdleAverageNs.load(std::memory_order_relaxed);
+	elp->IdleAverageNs.store(avg + (ns - avg) / 8, std::memory_order_relaxed); // Races between threads only lose a sample
+}
+
+EventLoopBase::~EventLoopBase()
+{
+	elasticRelease(this);
+	timerRelease(this);
+	traceRelease(this);
+	watchdogRelease(this);
+	while (MetricsSlots)
+	{
+		MetricsSlot *next = MetricsSlots->Next;
+		delete MetricsSlots;
+		MetricsSlots = next;
+	}
+#ifdef SEV_EVENT_LOOP_EPOLL
+	pollRelease(this);
+#endif
+}
+
+namespace /* anonymous */ {
+
+// Wake the most recently parked thread, or the polling thread if no other thread is parked. Call with IdleMutex locked
+bool signalOne(EventLoopBase *elp)
+{
+	if (ParkingSlot *slot = elp->IdleSlots)
+	{
+		elp->IdleSlots = slot->Next;
+		--elp->ThreadsWaiting;
+		++elp->Waking;
+		slot->Signaled = true;
+		slot->Flag.set(); // Under the lock, a thread that timed out could otherwise release its slot first
+		return true;
+	}
+#ifdef SEV_EVENT_LOOP_EPOLL
+	if (elp->PollerParked)
+	{
+		elp->PollerParked = false;
+		--elp->ThreadsWaiting;
+		++elp->Waking;
+		pollInterrupt(elp);
+		return true;
+	}
+#endif
+	return false;
+}
+
+}
+
+void park(EventLoopBase *elp, ParkingSlot *slot, int timeoutMs)
+{
+#ifdef SEV_EVENT_LOOP_EPOLL
+	if (elp->EpollFd.load(std::memory_order_acquire) >= 0 && !elp->Polling.exchange(true))
+	{
+		pollWait(elp, timeoutMs);
+		return;
+	}
+#endif
+	{
+		std::unique_lock<AtomicMutex> lock(elp->IdleMutex);
+		++elp->ThreadsWaiting;
+		if (elp->Pending || !elp->Running) // Pairs with the ThreadsWaiting check after posting
+		{
+			--elp->ThreadsWaiting;
+			return;
+		}
+		slot->Next = elp->IdleSlots;
+		elp->IdleSlots = slot;
+	}
+	bool woken = true;
+	if (timeoutMs < 0) slot->Flag.wait();
+	else woken = slot->Flag.wait(timeoutMs);
+	if (woken)
+	{
+		// The waking thread already removed the slot from the stack
+		slot->Signaled = false;
+		--elp->Waking;
+		return;
+	}
+	std::unique_lock<AtomicMutex> lock(elp->IdleMutex);
+	if (slot->Signaled)
+	{
+		// Signaled while timing out
+		slot->Signaled = false;
+		slot->Flag.reset();
+		--elp->Waking;
+		return;
+	}
+	ParkingSlot **it = &elp->IdleSlots;
+	while (*it != slot) it = &(*it)->Next;
+	*it = slot->Next;
+	--elp->ThreadsWaiting;
+}
+
+void wakeOne(EventLoopBase *elp)
+{
+	std::unique_lock<AtomicMutex> lock(elp->IdleMutex);
+	if (elp->Pending <= elp->Waking)
+		return; // Threads already waking up will pick up the queued work
+	signalOne(elp);
+}
+
+void wakeAll(EventLoopBase *elp)
+{
+	std::unique_lock<AtomicMutex> lock(elp->IdleMutex);
+	while (signalOne(elp));
+}
+
+bool parkOrRetire(EventLoopBase *elp, ParkingSlot *slot)
+{
+	const int retireMs = elp->RetireAfterMs.load(std::memory_order_relaxed);
+	if (!retireMs || !t_Managed)
+	{
+		park(elp, slot);
+		return false;
+	}
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	park(elp, slot, retireMs);
+	if (elp->Pending || !elp->Running || std::chrono::steady_clock::now() - start < std::chrono::milliseconds(retireMs))
+		return false;
+	int count = elp->ManagedCount;
+	while (count > elp->ElasticMin)
+	{
+		if (elp->ManagedCount.compare_exchange_weak(count, count - 1))
+		{
+			t_Retired = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+namespace /* anonymous */ {
+
+// Join the retired threads and remove them from ManagedThreads, call with ManagedThreadsMutex locked
+void reapRetired(EventLoopBase *elp)
+{
+	std::vector<std::thread::id> ids;
+	{
+		std::unique_lock<AtomicMutex> lock(elp->RetiredMutex);
+		ids.swap(elp->RetiredIds);
+	}
+	for (std::thread::id id : ids)
+	{
+		for (ptrdiff_t i = 0; i < (ptrdiff_t)elp->ManagedThreads.size(); ++i)
+		{
+			std::thread &t = elp->ManagedThreads[i];
+			if (t.get_id() == id)
+			{
+				t.join(); // Already leaving, does not need the lock
+				elp->ManagedThreads.erase(elp->ManagedThreads.begin() + i);
+				break;
+			}
+		}
+	}
+}
+
+void elasticThread(EventLoopBase *elp)
+{
+	blockSignals();
+	std::unique_lock<std::mutex> lock(elp->ManagedThreadsMutex);
+	const std::chrono::milliseconds window(elp->GrowAfterMs);
+	const std::chrono::milliseconds sample(std::max(elp->GrowAfterMs / 4, 1));
+	bool busy = false;
+	std::chrono::steady_clock::time_point busySince;
+	while (!elp->ElasticStopping)
+	{
+		elp->ElasticCondition.wait_for(lock, sample);
+		reapRetired(elp);
+		if (elp->ElasticStopping)
+			break;
+
+		// Grow when work stays queued while no thread is idle, for the whole window
+		if (!elp->Pending || elp->ThreadsWaiting || elp->Waking)
+		{
+			busy = false;
+			continue;
+		}
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (!busy)
+		{
+			busy = true;
+			busySince = now;
+			continue;
+		}
+		if (now - busySince < window || elp->ManagedCount >= elp->ElasticMax)
+			continue;
+		busy = false; // The next thread needs a full window again
+		const SEV_FunctorVt *vt = elp->ElasticOnError.vt()->get();
+		void *ptr = elp->ElasticOnError.ptr();
+		lock.unlock();
+		elp->Vt->RunOnCpus(elp, null, vt, ptr, vt->CopyConstructor); // On failure, retry after the next window
+		lock.lock();
+	}
+}
+
+}
+
+void elasticRelease(EventLoopBase *elp)
+{
+	std::thread thread;
+	{
+		std::unique_lock<std::mutex> lock(elp->ManagedThreadsMutex);
+		elp->ElasticStopping = true;
+		elp->RetireAfterMs = 0;
+		thread = std::move(elp->ElasticThread);
+		elp->ElasticCondition.notify_one();
+	}
+	if (thread.joinable())
+		thread.join();
+}
+
+namespace /* anonymous */ {
+
+struct WatchdogSample
+{
+	uint64_t Tasks;
+	const SEV_FunctorVt *Vt;
+	std::chrono::steady_clock::time_point Since;
+	bool Reported;
+
 };
 
 }
 
+void watchdogThread(EventLoopBase *elp)
+{
+	blockSignals();
+	std::unique_lock<std::mutex> lock(elp->WatchdogMutex);
+	const int thresholdMs = elp->WatchdogThresholdMs;
+	const std::chrono::milliseconds sample(std::max(thresholdMs / 4, 1));
+	std::map<MetricsSlot *, WatchdogSample> samples; // Slots are only freed with the loop
+	std::vector<std::pair<const SEV_FunctorVt *, int64_t>> slow;
+	while (!elp->WatchdogStopping)
+	{
+		elp->WatchdogCondition.wait_for(lock, sample);
+		if (elp->WatchdogStopping)
+			break;
+
+		// A functor is the same one as long as the slot shows the same vtable and task count, its duration counts from when it was first seen
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		try
+		{
+			std::unique_lock<AtomicMutex> metricsLock(elp->MetricsMutex);
+			for (MetricsSlot *slot = elp->MetricsSlots; slot; slot = slot->Next)
+			{
+				const SEV_FunctorVt *vt = slot->Running.load(std::memory_order_relaxed);
+				const uint64_t tasks = slot->Tasks.load(std::memory_order_relaxed);
+				WatchdogSample &s = samples[slot];
+				if (!slot->InUse || !vt || vt != s.Vt || tasks != s.Tasks)
+				{
+					s = WatchdogSample{ tasks, slot->InUse ? vt : null, now, false };
+					continue;
+				}
+				const int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - s.Since).count();
+				if (!s.Reported && ms >= thresholdMs)
+				{
+					s.Reported = true; // Once per functor
+					slow.push_back({ vt, ms });
+				}
+			}
+		}
+		catch (...)
+		{
+			// Out of memory, sample again next time
+		}
+		if (slow.empty())
+			continue;
+		lock.unlock();
+		for (const std::pair<const SEV_FunctorVt *, int64_t> &p : slow)
+			elp->WatchdogOnSlow(p.first, p.second);
+		slow.clear();
+		lock.lock();
+	}
+}
+
+void joinNotify(EventLoopBase *elp)
+{
+	std::unique_lock<std::mutex> lock(elp->JoinMutex);
+	elp->JoinCondition.notify_all();
+}
+
+void watchdogRelease(EventLoopBase *elp)
+{
+	std::thread thread;
+	{
+		std::unique_lock<std::mutex> lock(elp->WatchdogMutex);
+		elp->WatchdogStopping = true;
+		thread = std::move(elp->WatchdogThread);
+		elp->WatchdogCondition.notify_one();
+	}
+	if (thread.joinable())
+		thread.join();
+}
+
+MetricsSlot *acquireMetrics(EventLoopBase *elp)
+{
+	std::unique_lock<AtomicMutex> lock(elp->MetricsMutex);
+	for (MetricsSlot *slot = elp->MetricsSlots; slot; slot = slot->Next)
+	{
+		if (!slot->InUse)
+		{
+			slot->InUse = true;
+			return slot;
+		}
+	}
+	MetricsSlot *slot = new (nothrow) MetricsSlot();
+	if (!slot)
+		return null;
+	slot->Next = elp->MetricsSlots;
+	elp->MetricsSlots = slot;
+	return slot;
+}
+
+void releaseMetrics(EventLoopBase *elp, MetricsSlot *slot)
+{
+	std::unique_lock<AtomicMutex> lock(elp->MetricsMutex);
+	slot->InUse = false;
+}
+
+errno_t postLate(EventLoopBase *elp, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), errno_t(*post)(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)))
+{
+	uint64_t seq;
+	{
+		std::unique_lock<std::mutex> lock(elp->JoinMutex);
+		seq = elp->NextLateSeq;
+		try
+		{
+			elp->LateRunning.insert(seq);
+		}
+		catch (...)
+		{
+			return ENOMEM;
+		}
+		++elp->NextLateSeq;
+	}
+	auto lateCompleted = [elp, seq]() -> void {
+		++elp->LateCompleted;
+		std::unique_lock<std::mutex> lock(elp->JoinMutex);
+		elp->LateRunning.erase(seq);
+		elp->JoinCondition.notify_all();
+	};
+	errno_t eno;
+	try
+	{
+		sev::EventFunctor f((const sev::EventFunctorVt *)vt, ptr, forwardConstructor == vt->MoveConstructor);
+		auto late = [vt, lateCompleted, f = std::move(f)](sev::EventLoop &el) mutable -> errno_t {
+			auto fin = gsl::finally(lateCompleted);
+			if (MetricsSlot *slot = t_Metrics)
+				slot->Running.store(vt, std::memory_order_relaxed); // The wrapped functor, not the wrapper
+			return f(el);
+		};
+		sev::EventFunctorView fv = std::move(late);
+		const sev::EventFunctorVt *lvt;
+		void *lptr;
+		bool movable;
+		fv.extract(lvt, lptr, movable, true);
+		eno = post(elp, lvt->get(), lptr, lvt->get()->MoveConstructor);
+	}
+	catch (std::bad_alloc)
+	{
+		eno = ENOMEM;
+	}
+	catch (...)
+	{
+		eno = EOTHER;
+	}
+	if (eno)
+	{
+		std::unique_lock<std::mutex> lock(elp->JoinMutex);
+		elp->LateRunning.erase(seq);
+		elp->JoinCondition.notify_all();
+		return eno;
+	}
+	++elp->LatePosted;
+	return 0;
+}
+
+errno_t postInstrumented(EventLoopBase *elp, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), errno_t(*post)(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)))
+{
+	try
+	{
+		const bool timed = elp->MetricsEnabled.load(std::memory_order_relaxed);
+		const uint64_t traceId = elp->Tracing.load(std::memory_order_relaxed) ? tracePost(elp, vt) : 0;
+		sev::EventFunctor f((const sev::EventFunctorVt *)vt, ptr, forwardConstructor == vt->MoveConstructor);
+		auto instrumented = [elp, vt, timed, traceId, posted = std::chrono::steady_clock::now(), f = std::move(f)](sev::EventLoop &el) mutable -> errno_t {
+			if (timed)
+			{
+				if (MetricsSlot *slot = t_Metrics)
+				{
+					const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - posted).count();
+					metricsAdd<uint64_t>(slot->Latency[metricsBucket(ns)], 1);
+				}
+			}
+			if (MetricsSlot *slot = t_Metrics)
+				slot->Running.store(vt, std::memory_order_relaxed); // The wrapped functor, not the wrapper
+			if (!traceId)
+				return f(el);
+			traceRecord(elp, TraceStart, vt, traceId);
+			auto fin = gsl::finally([&]() -> void {
+				traceRecord(elp, TraceEnd, vt, traceId);
+			});
+			return f(el);
+		};
+		sev::EventFunctorView fv = std::move(instrumented);
+		const sev::EventFunctorVt *ivt;
+		void *iptr;
+		bool movable;
+		fv.extract(ivt, iptr, movable, true);
+		return post(elp, ivt->get(), iptr, ivt->get()->MoveConstructor);
+	}
+	catch (std::bad_alloc)
+	{
+		return ENOMEM;
+	}
+	catch (...)
+	{
+		return EOTHER;
+	}
+}
+
+namespace /* anonymous */ {
+
+errno_t timerPost(EventLoopBase *elp, const std::shared_ptr<TimerState> &state, bool interval)
+{
+	if (interval && state->Running.exchange(true))
+		return 0; // Previous tick still running
+	auto tick = [state, interval](sev::EventLoop &el) -> errno_t {
+		auto fin = gsl::finally([&]() -> void {
+			if (interval) state->Running = false;
+		});
+		errno_t eno = state->Functor(el);
+		if (eno == ECANCELED)
+		{
+			state->Cancelled = true;
+			return 0;
+		}
+		return eno;
+	};
+	sev::EventFunctorView fv = std::move(tick);
+	const sev::EventFunctorVt *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	errno_t eno = elp->Vt->PostFunctor(elp, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+	if (eno && interval) state->Running = false;
+	return eno;
+}
+
+void timerThread(EventLoopBase *elp)
+{
+	blockSignals();
+	std::unique_lock<std::mutex> lock(elp->TimerMutex);
+	while (!elp->TimerStopping)
+	{
+		if (elp->Timers.empty())
+		{
+			elp->TimerCondition.wait(lock);
+			continue;
+		}
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (elp->Timers.top().Time > now)
+		{
+			elp->TimerCondition.wait_until(lock, elp->Timers.top().Time);
+			continue;
+		}
+		TimeoutFunctor tf = elp->Timers.top();
+		elp->Timers.pop();
+		if (tf.State->Cancelled)
+			continue;
+		const bool interval = tf.Interval > std::chrono::steady_clock::duration::zero();
+		lock.unlock();
+		errno_t eno = timerPost(elp, tf.State, interval);
+		lock.lock();
+		if (eno || interval)
+		{
+			// Repeat, or retry shortly when the post failed. Missed interval ticks are skipped
+			if (eno) tf.Time = now + std::chrono::milliseconds(1);
+			else do tf.Time += tf.Interval; while (tf.Time <= now);
+			try
+			{
+				elp->Timers.push(std::move(tf));
+			}
+			catch (...)
+			{
+				// Out of memory, the timer is dropped
+			}
+		}
+	}
+}
+
+}
+
+errno_t timerAdd(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int delayMs, int intervalMs)
+{
+	EventLoopBase *elp = (EventLoopBase *)el;
+	if (delayMs < 0 || intervalMs < 0)
+		return EINVAL;
+	try
+	{
+		sev::EventFunctor f((const sev::EventFunctorVt *)vt, ptr, forwardConstructor == vt->MoveConstructor);
+		TimeoutFunctor tf;
+		tf.State = std::make_shared<TimerState>(std::move(f));
+		tf.Time = std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs);
+		tf.Interval = std::chrono::milliseconds(intervalMs);
+		std::unique_lock<std::mutex> lock(elp->TimerMutex);
+		if (elp->TimerStopping)
+			return ECANCELED;
+		if (!elp->TimerThread.joinable())
+			elp->TimerThread = std::thread(timerThread, elp);
+		const bool first = elp->Timers.empty() || tf.Time < elp->Timers.top().Time;
+		elp->Timers.push(std::move(tf));
+		if (first)
+			elp->TimerCondition.notify_one();
+	}
+	catch (std::bad_alloc)
+	{
+		return ENOMEM;
+	}
+	catch (...)
+	{
+		return EOTHER;
+	}
+	return 0;
+}
+
+void timerRelease(EventLoopBase *elp)
+{
+	std::thread thread;
+	{
+		std::unique_lock<std::mutex> lock(elp->TimerMutex);
+		elp->TimerStopping = true;
+		thread = std::move(elp->TimerThread);
+		elp->TimerCondition.notify_one();
+	}
+	if (thread.joinable())
+		thread.join();
+	elp->Timers = std::priority_queue<TimeoutFunctor>();
+}
+
+}
+
 SEV_EventLoop *SEV_EventLoop_create()
 {
 	try
@@ -249,18 +1013,46 @@ SEV_EventLoop *SEV_EventLoop_create()
 
 void SEV_IMPL_EventLoop_destroy(SEV_EventLoop *el)
 {
+	sev::impl::el::timerRelease((sev::impl::el::EventLoopBase *)el);
 	el->Vt->Stop(el);
-	delete el;
+	delete (sev::impl::el::EventLoop *)el;
 }
 
-errno_t SEV_IMPL_EventLoop_postFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+namespace /* anonymous */ {
+
+errno_t postQueued(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
 {
 	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
 	++elp->QueueItems;
+	++elp->Pending;
 	errno_t res = SEV_ConcurrentFunctorQueue_pushFunctor(elp->Queue.get(), vt, ptr, forwardConstructor);
-	if (res) --elp->QueueItems;
-	else elp->Flag.set();
-	return res;
+	if (res)
+	{
+		--elp->Pending;
+		--elp->QueueItems;
+		return res;
+	}
+	++elp->Posted;
+	if (elp->ThreadsWaiting) sev::impl::el::wakeOne(elp);
+	return 0;
+}
+
+errno_t postMeasured(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	if (elp->MetricsEnabled.load(std::memory_order_relaxed) || elp->Tracing.load(std::memory_order_relaxed))
+		return sev::impl::el::postInstrumented(elp, vt, ptr, forwardConstructor, postQueued);
+	return postQueued(el, vt, ptr, forwardConstructor);
+}
+
+}
+
+errno_t SEV_IMPL_EventLoop_postFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	if (elp->Barriers.load(std::memory_order_relaxed))
+		return sev::impl::el::postLate(elp, vt, ptr, forwardConstructor, postMeasured);
+	return postMeasured(el, vt, ptr, forwardConstructor);
 }
 
 void SEV_IMPL_EventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *vt, void *ptr)
@@ -269,8 +1061,16 @@ void SEV_IMPL_EventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh
 	SEV_ASSERT(eh);
 	SEV_ASSERT(!*eh);
 	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	if (sev::impl::el::t_CurrentLoop == elp)
+	{
+		// Called from a thread of this loop, waiting for the queue could deadlock
+		errno_t res = ((sev::EventFunctorVt *)vt)->invoke(ptr, *(sev::ExceptionHandle *)eh, *el);
+		if (!*eh && res) *eh = SEV_Exception_capture(res);
+		return;
+	}
 	sev::EventFlag flag;
 	++elp->QueueItems;
+	++elp->Pending;
 	errno_t eno = elp->Queue.push(nothrow, [=, &flag](sev::EventLoop &elref) -> errno_t {
 		errno_t res = ((sev::EventFunctorVt *)vt)->invoke(ptr, *(sev::ExceptionHandle *)eh, elref);
 		if (!*eh && res) *eh = SEV_Exception_capture(res);
@@ -279,27 +1079,58 @@ void SEV_IMPL_EventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh
 		});
 	if (eno)
 	{
+		--elp->Pending;
 		--elp->QueueItems;
 		*eh = SEV_Exception_capture(eno);
 	}
 	else
 	{
-		elp->Flag.set();
+		++elp->Posted;
+		if (elp->ThreadsWaiting) sev::impl::el::wakeOne(elp);
 		flag.wait();
 	}
 }
 
 errno_t SEV_IMPL_EventLoop_run(SEV_EventLoop *el, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return SEV_IMPL_EventLoop_runOnCpus(el, null, onError, ptr, forwardConstructor);
+}
+
+errno_t SEV_IMPL_EventLoop_runOnCpus(SEV_EventLoop *el, const SEV_CpuSet *cpus, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
 {
 	sev::ExceptionHandle ehr;
 	ehr.capture<void>([=]() -> void {
-		sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+		sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
 		sev::Functor<void(SEV_ExceptionHandle *)> onErrorF((sev::FunctorVt<void(SEV_ExceptionHandle *)> *)onError, ptr, forwardConstructor == onError->MoveConstructor);
+		const bool pinned = cpus;
+		SEV_CpuSet cpuSet;
+		if (pinned) cpuSet = *cpus;
 		std::unique_lock<std::mutex> lock(elp->ManagedThreadsMutex);
 		elp->ManagedThreads.push_back(std::move(std::thread([=, onErrorMv = std::move(onErrorF)]() -> void { // FIXME: MOVE
 			sev::ExceptionHandle eh;
 			sev::Functor<void(SEV_ExceptionHandle *)> onErr(onErrorMv); // FIXME: MOVE
-			while (elp->Running)
+			sev::impl::el::blockSignals();
+			sev::impl::el::t_Managed = true;
+			++elp->ManagedCount;
+			if (pinned)
+			{
+				// Pin before entering the loop, so anything the loop allocates for this thread is placed on the right node
+				errno_t eno = SEV_Thread_setAffinity(&cpuSet);
+				if (eno)
+				{
+					eh.capture(eno);
+					sev::ExceptionHandle ehc;
+					onErr(ehc, (SEV_ExceptionHandle *)&eh);
+					if (ehc.raised())
+					{
+						ehc.discard();
+						SEV_terminate(); // Ok, bye. Don't throw in the exception handler. Unhandled exception.
+					}
+					if (eh.raised())
+						eh.discard(); // Keep running unpinned
+				}
+			}
+			do // Loop sets Running, the managed thread must enter it at least once
 			{
 				el->Vt->Loop(el, (SEV_ExceptionHandle *)(&eh));
 				if (eh.raised())
@@ -312,6 +1143,16 @@ errno_t SEV_IMPL_EventLoop_run(SEV_EventLoop *el, const SEV_FunctorVt *onError,
 						SEV_terminate(); // Ok, bye. Don't throw in the exception handler. Unhandled exception.
 					}
 				}
+			} while (elp->Running && !sev::impl::el::t_Retired);
+			if (sev::impl::el::t_Retired)
+			{
+				// Already uncounted, the elastic thread joins and removes this thread
+				std::unique_lock<sev::AtomicMutex> lock(elp->RetiredMutex);
+				elp->RetiredIds.push_back(std::this_thread::get_id());
+			}
+			else
+			{
+				--elp->ManagedCount;
 			}
 		})));
 		});
@@ -323,110 +1164,136 @@ void SEV_IMPL_EventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh)
 	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
 	if (elp->Stopping)
 		return;
+	std::unique_ptr<sev::impl::el::ParkingSlot> slot;
+	try
+	{
+		slot = std::make_unique<sev::impl::el::ParkingSlot>();
+	}
+	catch (...)
+	{
+		*eh = SEV_Exception_capture(ENOMEM);
+		return;
+	}
 	elp->Running = true;
 	if (elp->Stopping)
 	{
 		elp->Running = false;
 		return;
 	}
+	sev::impl::el::MetricsSlot *const metrics = sev::impl::el::acquireMetrics(elp);
+	if (!metrics)
+	{
+		*eh = SEV_Exception_capture(ENOMEM);
+		return;
+	}
+	sev::impl::el::EventLoopBase *const prevLoop = sev::impl::el::t_CurrentLoop;
+	sev::impl::el::t_CurrentLoop = elp;
+	sev::impl::el::MetricsSlot *const prevMetrics = sev::impl::el::t_Metrics;
+	sev::impl::el::t_Metrics = metrics;
 	++elp->Threads;
+#ifdef SEV_EVENT_LOOP_EPOLL
+	int sincePoll = 0;
+#endif
 	while (elp->Running)
 	{
 		// Check queue
-		if (elp->QueueItems)
+		if (elp->Pending)
 		{
 			bool success;
 			do
 			{
-				errno_t eno = elp->Queue.tryCallAndPop(*(sev::ExceptionHandle *)eh, success, *elp);
-				if (success) --elp->QueueItems;
-				if (!*eh && eno) *eh = SEV_Exception_capture(eno);
-			} while (success && !*eh); // Popped a function and no errors
-			if (*eh) break; // Break out of loop due to error!
-		}
-
-		// Check timer queue. Temporary, recycled code.
-		// TODO: It might be better (more generic) to put the timer queue onto a separate thread, and simply post to the event loop.
-		((sev::ExceptionHandle *)eh)->capture<void>([&]() -> void {
-			for (;;)
-			{
-#ifdef SEV_EVENT_LOOP_MSVC_CONCURRENT
-				sev::impl::el::TimeoutFunctor tf;
-				if (!elp->TimeoutConcurrent.try_pop(tf))
-					break;
-				const sev::impl::el::TimeoutFunctor &tfr = tf;
-#else
-				elp->TimeoutMutex.lock();
-				if (!elp->Timeout.size())
-				{
-					elp->TimeoutMutex.unlock();
-					break;
-				}
-				const sev::impl::el::TimeoutFunctor &tfr = elp->Timeout.top();
-#endif
-				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-				int64_t wt = std::chrono::duration_cast<std::chrono::milliseconds>(tfr.Time - now).count();
-				if (tfr.Time > now) // Wait
+				const bool timed = elp->MetricsEnabled.load(std::memory_order_relaxed);
+				std::chrono::steady_clock::time_point start;
+				if (timed) start = std::chrono::steady_clock::now();
+				errno_t eno = elp->Queue.tryCallAndPop(*(sev::ExceptionHandle *)eh, success, &metrics->Running, &elp->Pending, *elp);
+				if (success)
 				{
-#ifdef SEV_EVENT_LOOP_MSVC_CONCURRENT
-					elp->TimeoutConcurrent.push(tf);
-#else
-					elp->TimeoutMutex.unlock();
-#endif
-					++elp->ThreadsWaiting;
-					elp->Flag.wait(wt & 0xFFFF); // Mask to 65 seconds, it's fine to break out earlier, the loop re-checks
-					--elp->ThreadsWaiting;
-					if (elp->QueueItems > 1 && elp->ThreadsWaiting > 1)
-						elp->Flag.set(); // Wake up more threads if there's more than one item in the queue
-					break;
-				}
-#ifndef SEV_EVENT_LOOP_MSVC_CONCURRENT
-				sev::impl::el::TimeoutFunctor tf = tfr;
-				elp->Timeout.pop();
-				elp->TimeoutMutex.unlock();
-#endif
-				errno_t eno = tf.Functor(*(sev::ExceptionHandle *)eh, *elp);
-				bool cancel = eno == ECANCELED;
-				if (!*eh && eno && eno != ECANCELED) *eh = SEV_Exception_capture(eno);
-				--elp->QueueItems;
-				if (!cancel && (tf.Interval > std::chrono::nanoseconds::zero())) // repeat
-				{
-					tf.Time += tf.Interval;
-					;
+					--elp->QueueItems;
+					sev::impl::el::taskCompleted(elp);
+					sev::impl::el::metricsAdd<uint64_t>(metrics->Tasks, 1);
+					if (timed) sev::impl::el::metricsTask(metrics, start);
+#ifdef SEV_EVENT_LOOP_EPOLL
+					if (++sincePoll >= sev::impl::el::c_PollInterval)
 					{
-#ifdef SEV_EVENT_LOOP_MSVC_CONCURRENT
-						elp->TimeoutConcurrent.push(std::move(tf));
-						++elp->QueueItems;
-#else
-						std::unique_lock<std::mutex> lock(elp->TimeoutMutex);
-						elp->Timeout.push(std::move(tf));
-#endif
+						// No thread parks while the loop is saturated, so poll the watched fds here
+						sincePoll = 0;
+						sev::impl::el::pollNow(elp);
 					}
+#endif
 				}
-				if (*eh) break; // Break out of loop due to error!
-			}
-		});
-		if (*eh) break; // Break out of loop due to error!
+				if (!*eh && eno) *eh = SEV_Exception_capture(eno);
+			} while (success && !*eh); // Popped a function and no errors
+			if (*eh) break; // Break out of loop due to error!
+		}
 
 		// Wait
-		++elp->ThreadsWaiting;
-		elp->Flag.wait();
-		--elp->ThreadsWaiting;
-		if (elp->QueueItems > 1 && elp->ThreadsWaiting > 1)
-			elp->Flag.set(); // Wake up more threads if there's more than one item in the queue
+		metrics->Running.store(null, std::memory_order_relaxed);
+		const bool idle = elp->SpinAdaptive && !elp->Pending;
+		const bool timed = elp->MetricsEnabled.load(std::memory_order_relaxed);
+		std::chrono::steady_clock::time_point idleStart;
+		if (idle || timed) idleStart = std::chrono::steady_clock::now();
+		if (!sev::impl::el::spinWait(elp))
+		{
+			if (sev::impl::el::parkOrRetire(elp, slot.get()))
+				break; // Elastic thread retired
+			sev::impl::el::metricsAdd<uint64_t>(metrics->Wakeups, 1);
+		}
+		if (idle) sev::impl::el::idleEnded(elp, idleStart);
+		if (timed) sev::impl::el::metricsAdd<int64_t>(metrics->IdleNs, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - idleStart).count());
 	}
 	--elp->Threads;
+	metrics->Running.store(null, std::memory_order_relaxed);
+	sev::impl::el::t_CurrentLoop = prevLoop;
+	sev::impl::el::t_Metrics = prevMetrics;
+	sev::impl::el::releaseMetrics(elp, metrics);
 	elp->LoopEndedFlag.set();
 }
 
+errno_t SEV_IMPL_EventLoop_join(SEV_EventLoop *el, bool empty)
+{
+	sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
+	if (sev::impl::el::t_CurrentLoop == elp)
+		return EDEADLK; // Would wait for its own functor
+	std::unique_lock<std::mutex> lock(elp->JoinMutex);
+	++elp->Joiners;
+	if (!empty) ++elp->Barriers; // Posts from here on are late
+	const uint64_t lateTarget = elp->NextLateSeq;
+	elp->JoinCondition.wait(lock, [&]() -> bool {
+		if (empty)
+			return !elp->QueueItems;
+		if (!elp->LateRunning.empty() && *elp->LateRunning.begin() < lateTarget)
+			return false; // A late functor of an earlier join still runs
+		// Every other functor completed, including the ones which raced with the increment of Joiners
+		const uint64_t completed = elp->Completed;
+		const uint64_t lateCompleted = elp->LateCompleted;
+		const uint64_t latePosted = elp->LatePosted;
+		const uint64_t posted = elp->Posted;
+		return completed - lateCompleted >= posted - latePosted;
+	});
+	if (!empty) --elp->Barriers;
+	--elp->Joiners;
+	return 0;
+}
+
 void SEV_IMPL_EventLoop_stop(SEV_EventLoop *el)
 {
-	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
+	if (sev::impl::el::t_CurrentLoop == elp)
+	{
+		// From a functor, the calling thread cannot wait for itself to leave. The threads leave on their own, and are joined by the next stop from outside the loop
+		elp->Stopping = true; // Until then, threads entering the loop leave at once, instead of setting Running again
+		sev::impl::el::elasticRelease(elp);
+		elp->Running = false;
+		sev::impl::el::wakeAll(elp);
+		return;
+	}
 	elp->Stopping = true;
+	sev::impl::el::elasticRelease(elp); // No more threads are added
 	{
 		std::unique_lock<std::mutex> lock(elp->ManagedThreadsMutex);
 		elp->Stopping = true; // Yes.
 		elp->Running = false;
+		sev::impl::el::wakeAll(elp);
 		// Wait for managed threads
 		for (std::thread &t : elp->ManagedThreads)
 		{
@@ -443,6 +1310,10 @@ void SEV_IMPL_EventLoop_stop(SEV_EventLoop *el)
 			}
 		}
 		elp->ManagedThreads.clear();
+		{
+			std::unique_lock<sev::AtomicMutex> retiredLock(elp->RetiredMutex);
+			elp->RetiredIds.clear();
+		}
 		while (elp->Threads)
 		{
 			// Wait for other threads
@@ -453,4 +1324,63 @@ void SEV_IMPL_EventLoop_stop(SEV_EventLoop *el)
 	}
 }
 
+errno_t SEV_IMPL_EventLoop_setWaitPolicy(SEV_EventLoop *el, const SEV_EventLoopWaitPolicy *policy)
+{
+	sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
+	if (policy->SpinIterations < 0 || policy->YieldIterations < 0)
+		return EINVAL;
+	elp->SpinIterations = policy->SpinIterations;
+	elp->YieldIterations = policy->YieldIterations;
+	elp->IdleAverageNs = 0;
+	elp->PausePs = 0;
+	elp->SpinAdaptive = policy->Adaptive;
+	return 0;
+}
+
+errno_t SEV_IMPL_EventLoop_runElastic(SEV_EventLoop *el, const SEV_EventLoopElasticPolicy *policy, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
+	if (policy->MinThreads < 1 || policy->MaxThreads < policy->MinThreads || policy->GrowAfterMs <= 0 || policy->RetireAfterMs < 0)
+		return EINVAL;
+	const SEV_FunctorVt *vt;
+	void *onErrorPtr;
+	{
+		std::unique_lock<std::mutex> lock(elp->ManagedThreadsMutex);
+		if (elp->ElasticThread.joinable())
+			return EALREADY;
+		try
+		{
+			elp->ElasticOnError = sev::Functor<void(SEV_ExceptionHandle *)>((sev::FunctorVt<void(SEV_ExceptionHandle *)> *)onError, ptr, forwardConstructor == onError->MoveConstructor);
+		}
+		catch (...)
+		{
+			return ENOMEM;
+		}
+		elp->ElasticStopping = false;
+		elp->ElasticMax = policy->MaxThreads;
+		elp->GrowAfterMs = policy->GrowAfterMs;
+		elp->ElasticMin = policy->MinThreads;
+		elp->RetireAfterMs = policy->RetireAfterMs;
+		vt = elp->ElasticOnError.vt()->get();
+		onErrorPtr = elp->ElasticOnError.ptr();
+	}
+	for (int i = 0; i < policy->MinThreads; ++i)
+	{
+		errno_t eno = el->Vt->RunOnCpus(el, null, vt, onErrorPtr, vt->CopyConstructor);
+		if (eno) return eno;
+	}
+	std::unique_lock<std::mutex> lock(elp->ManagedThreadsMutex);
+	if (elp->ElasticStopping)
+		return ECANCELED; // Stopped meanwhile
+	try
+	{
+		elp->ElasticThread = std::thread(sev::impl::el::elasticThread, elp);
+	}
+	catch (...)
+	{
+		return EOTHER;
+	}
+	return 0;
+}
+
 /* end of file */
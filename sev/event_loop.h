@@ -35,11 +35,57 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "event_flag.h"
 #include "functor_view.h"
+#include "numa.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct SEV_EventLoopWaitPolicy
+{
+	int SpinIterations; // Number of pause iterations before yielding, 0 to not spin
+	int YieldIterations; // Number of yields before parking the thread
+	bool Adaptive; // Spin for about twice the recent idle time, up to SpinIterations, and skip spinning while work took much longer to arrive than a full spin
+
+};
+
+struct SEV_EventLoopElasticPolicy
+{
+	int MinThreads; // Started right away, and never retired
+	int MaxThreads;
+	int GrowAfterMs; // Add a thread when work has stayed queued without any idle thread for this long
+	int RetireAfterMs; // Threads above the minimum exit after being idle this long, 0 to keep them
+
+};
+
+#define SEV_EVENT_LOOP_METRICS_BUCKETS 48 // Bucket 0 counts 0ns, bucket i counts [2^(i-1), 2^i) ns, the last bucket counts everything longer
+
+struct SEV_EventLoopThreadMetrics
+{
+	uint64_t Tasks;
+	uint64_t Wakeups; // Times the thread was woken after parking
+	int64_t BusyNs; // Running functors
+	int64_t IdleNs; // Spinning or parked
+	uint64_t LatencyHistogram[SEV_EVENT_LOOP_METRICS_BUCKETS]; // Time from posting to starting a functor
+	uint64_t ExecutionHistogram[SEV_EVENT_LOOP_METRICS_BUCKETS];
+
+};
+
+struct SEV_EventLoopMetrics
+{
+	int QueueDepth;
+	int Threads;
+	int ThreadsWaiting;
+	SEV_EventLoopThreadMetrics Total; // All threads that have run the loop, merged
+
+};
+
+// Fd readiness events, same values as POLLIN, POLLOUT, POLLERR and POLLHUP
+#define SEV_FD_READ 0x001
+#define SEV_FD_WRITE 0x004
+#define SEV_FD_ERROR 0x008 // Always reported
+#define SEV_FD_HANGUP 0x010 // Always reported
+
 struct SEV_EventLoopVt;
 struct SEV_EventLoop
 {
@@ -67,7 +113,16 @@ struct SEV_EventLoopVt
 	void(*Loop)(SEV_EventLoop *el, SEV_ExceptionHandle *eh);
 	void(*Stop)(SEV_EventLoop *el);
 
-	ptrdiff_t Reserved[32 - 13];
+	errno_t(*RunOnCpus)(SEV_EventLoop *el, const SEV_CpuSet *cpus, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Run with the managed thread pinned to a set of CPUs
+	errno_t(*SetWaitPolicy)(SEV_EventLoop *el, const SEV_EventLoopWaitPolicy *policy);
+
+	errno_t(*WatchFd)(SEV_EventLoop *el, int fd, uint32_t events, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // errno_t(EventLoop &el, int fd, uint32_t events)
+	errno_t(*ModifyFd)(SEV_EventLoop *el, int fd, uint32_t events);
+	errno_t(*UnwatchFd)(SEV_EventLoop *el, int fd);
+
+	errno_t(*RunElastic)(SEV_EventLoop *el, const SEV_EventLoopElasticPolicy *policy, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+
+	ptrdiff_t Reserved[32 - 19];
 
 };
 
@@ -84,33 +139,81 @@ SEV_LIB errno_t SEV_EventLoop_timeout(SEV_EventLoop *el, errno_t(*f)(void *ptr,
 SEV_LIB errno_t SEV_EventLoop_interval(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size, int intervalMs);
 
 SEV_LIB errno_t SEV_EventLoop_postFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
-SEV_LIB void SEV_EventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *vt, void *ptr); // TODO: Cast down eh
+SEV_LIB void SEV_EventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *vt, void *ptr); // TODO: Cast down eh. Runs inline when called from a thread of the same loop
 SEV_LIB errno_t SEV_EventLoop_timeoutFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs);
 SEV_LIB errno_t SEV_EventLoop_intervalFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int intervalMs);
 
-SEV_LIB errno_t SEV_EventLoop_join(SEV_EventLoop *el, bool empty);
+SEV_LIB errno_t SEV_EventLoop_join(SEV_EventLoop *el, bool empty); // Wait until every functor posted before the call completed, or with empty until the queue is empty. EDEADLK from a thread of the loop
 
 SEV_LIB errno_t SEV_EventLoop_run(SEV_EventLoop *el, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
 SEV_LIB void SEV_EventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh); // TODO: Cast down eh
-SEV_LIB void SEV_EventLoop_stop(SEV_EventLoop *el);
+SEV_LIB void SEV_EventLoop_stop(SEV_EventLoop *el); // From a functor of the loop, returns without waiting for the threads to leave, and threads entering the loop leave at once until the next stop from outside
+
+SEV_LIB errno_t SEV_EventLoop_runOnCpus(SEV_EventLoop *el, const SEV_CpuSet *cpus, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_EventLoop_runOnNode(SEV_EventLoop *el, int node, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Pins the managed thread to the CPUs of a NUMA node, EINVAL if the node does not exist or has no CPUs
+
+SEV_LIB errno_t SEV_EventLoop_setWaitPolicy(SEV_EventLoop *el, const SEV_EventLoopWaitPolicy *policy); // How idle threads wait for work. Spinning trades CPU time for wakeup latency
+SEV_LIB errno_t SEV_EventLoop_runElastic(SEV_EventLoop *el, const SEV_EventLoopElasticPolicy *policy, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Managed threads between a minimum and maximum, following the queue depth. EALREADY if already elastic
+
+// Metrics. Counts are always kept, timings only while enabled, since they read the clock around every functor
+SEV_LIB errno_t SEV_EventLoop_enableMetrics(SEV_EventLoop *el, bool enabled); // ENOSYS for a loop with its own vtable
+SEV_LIB errno_t SEV_EventLoop_getMetrics(SEV_EventLoop *el, SEV_EventLoopMetrics *metrics, SEV_EventLoopThreadMetrics *threads, int *nbThreads); // Threads may be null, otherwise nbThreads is its capacity on input, and the number of threads on output. ERANGE if too small, ENOSYS for a loop with its own vtable
+
+// Tracing. Functors posted while enabled record their post, start and end in a ring per thread, which can be written out as Chrome trace event JSON
+SEV_LIB errno_t SEV_EventLoop_enableTracing(SEV_EventLoop *el, int eventsPerThread); // 0 to disable, rounded up to a power of two. Rings keep the size of the first enable. ENOSYS for a loop with its own vtable
+SEV_LIB errno_t SEV_EventLoop_writeTrace(SEV_EventLoop *el, const char *path); // Can be called while tracing, events overwritten while writing are left out. ENOSYS for a loop with its own vtable
+
+// Watchdog. A thread samples the functor each loop thread runs, and calls onSlow void(const SEV_FunctorVt *vt, int64_t durationMs) once for each functor still running after the threshold.
+// Durations count from when the watchdog first saw the functor, which may be up to a quarter of the threshold late. Functors posted while metrics or tracing are enabled report their own vtable, not the wrapper's
+SEV_LIB errno_t SEV_EventLoop_setWatchdog(SEV_EventLoop *el, int thresholdMs, const SEV_FunctorVt *onSlow, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // 0 to stop. Replaces the previous watchdog, do not call from onSlow. ENOSYS for a loop with its own vtable
+
+// Run the loop on the calling thread until stopped, then stop it fully. On Linux, SIGINT and SIGTERM are blocked on the calling thread and read through a signalfd,
+// calling onSignal errno_t(EventLoop &el, int signo) on the loop, or stopping the loop when onSignal is null. Threads created by the library block them too, threads created by the application must block them,
+// or call this before starting them so they inherit the mask, otherwise the kernel may deliver a signal to them instead. ENOSYS for a loop with its own vtable
+SEV_LIB void SEV_EventLoop_runMain(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *onSignal, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+
+SEV_LIB SEV_EventLoop *SEV_EventLoop_current(); // The loop the calling thread is running, null if none
+SEV_LIB int SEV_EventLoop_threads(SEV_EventLoop *el); // Number of threads currently running the loop, 0 for a loop with its own vtable
+
+// Fd readiness, Linux only (ENOSYS otherwise). The functor is posted to the loop when the fd becomes ready, and is not called again for the same fd until it returns
+SEV_LIB errno_t SEV_EventLoop_watchFd(SEV_EventLoop *el, int fd, uint32_t events, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // EEXIST if the fd is already watched
+SEV_LIB errno_t SEV_EventLoop_modifyFd(SEV_EventLoop *el, int fd, uint32_t events); // Change the events of a watched fd, ENOENT if not watched
+SEV_LIB errno_t SEV_EventLoop_unwatchFd(SEV_EventLoop *el, int fd); // A functor that is already running may still complete after this returns, ENOENT if not watched
 
 // Generic implementations, work with all event loops
 SEV_LIB errno_t SEV_IMPL_EventLoopBase_post(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size);
 SEV_LIB void SEV_IMPL_EventLoopBase_invoke(SEV_EventLoop *el, SEV_ExceptionHandle *eh, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr);
 SEV_LIB errno_t SEV_IMPL_EventLoopBase_timeout(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size, int timeoutMs);
 SEV_LIB errno_t SEV_IMPL_EventLoopBase_interval(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size, int intervalMs);
+SEV_LIB errno_t SEV_IMPL_EventLoopBase_timeoutFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs); // Timer thread, posts the functor when due
+SEV_LIB errno_t SEV_IMPL_EventLoopBase_intervalFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int intervalMs); // Ticks are skipped while the previous tick still runs
 
 SEV_LIB SEV_EventLoop *SEV_EventLoop_create();
 SEV_LIB void SEV_IMPL_EventLoop_destroy(SEV_EventLoop *el);
 
 SEV_LIB errno_t SEV_IMPL_EventLoop_postFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
 SEV_LIB void SEV_IMPL_EventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *vt, void *ptr);
-// SEV_LIB errno_t SEV_EventLoop_timeoutFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs);
-// SEV_LIB errno_t SEV_EventLoop_intervalFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int intervalMs);
 
 SEV_LIB errno_t SEV_IMPL_EventLoop_run(SEV_EventLoop *el, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_IMPL_EventLoop_runOnCpus(SEV_EventLoop *el, const SEV_CpuSet *cpus, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
 SEV_LIB void SEV_IMPL_EventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh);
 SEV_LIB void SEV_IMPL_EventLoop_stop(SEV_EventLoop *el);
+SEV_LIB errno_t SEV_IMPL_EventLoop_setWaitPolicy(SEV_EventLoop *el, const SEV_EventLoopWaitPolicy *policy);
+SEV_LIB errno_t SEV_IMPL_EventLoop_watchFd(SEV_EventLoop *el, int fd, uint32_t events, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // epoll, shared by all event loops
+SEV_LIB errno_t SEV_IMPL_EventLoop_modifyFd(SEV_EventLoop *el, int fd, uint32_t events);
+SEV_LIB errno_t SEV_IMPL_EventLoop_unwatchFd(SEV_EventLoop *el, int fd);
+SEV_LIB errno_t SEV_IMPL_EventLoop_join(SEV_EventLoop *el, bool empty); // Parks until the functors posted before the call completed, shared by all event loops
+SEV_LIB errno_t SEV_IMPL_EventLoop_runElastic(SEV_EventLoop *el, const SEV_EventLoopElasticPolicy *policy, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Monitor thread, shared by all event loops
+
+// Work-stealing event loop, per-worker local deques with a shared injection queue
+SEV_LIB SEV_EventLoop *SEV_WorkStealingEventLoop_create();
+SEV_LIB void SEV_IMPL_WorkStealingEventLoop_destroy(SEV_EventLoop *el);
+
+SEV_LIB errno_t SEV_IMPL_WorkStealingEventLoop_postFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Posts from a worker thread of this loop go into the worker's local deque
+SEV_LIB void SEV_IMPL_WorkStealingEventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *vt, void *ptr);
+
+SEV_LIB void SEV_IMPL_WorkStealingEventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh);
+SEV_LIB void SEV_IMPL_WorkStealingEventLoop_stop(SEV_EventLoop *el);
 
 #ifdef __cplusplus
 }
@@ -119,9 +222,99 @@ SEV_LIB void SEV_IMPL_EventLoop_stop(SEV_EventLoop *el);
 #ifdef __cplusplus
 namespace sev {
 typedef SEV_EventLoop EventLoop;
+typedef SEV_EventLoopWaitPolicy EventLoopWaitPolicy;
+typedef SEV_EventLoopElasticPolicy EventLoopElasticPolicy;
+typedef SEV_EventLoopMetrics EventLoopMetrics;
+typedef SEV_EventLoopThreadMetrics EventLoopThreadMetrics;
 typedef FunctorVt<errno_t(EventLoop &el)> EventFunctorVt;
 typedef Functor<errno_t(EventLoop &el)> EventFunctor;
 typedef FunctorView<errno_t(EventLoop &el) > EventFunctorView;
+typedef FunctorVt<errno_t(EventLoop &el, int fd, uint32_t events)> FdFunctorVt;
+typedef Functor<errno_t(EventLoop &el, int fd, uint32_t events)> FdFunctor;
+typedef FunctorView<errno_t(EventLoop &el, int fd, uint32_t events)> FdFunctorView;
+
+//! Post a callable `errno_t(EventLoop &el)` to the loop. Rvalues are moved into the queue, lvalues are copied
+template<typename TFn>
+errno_t post(EventLoop &el, TFn &&f) noexcept
+{
+	EventFunctorView fv = std::forward<TFn>(f);
+	const EventFunctorVt *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return el.Vt->PostFunctor(&el, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+}
+
+//! Post a callable `errno_t(EventLoop &el)` to the loop once the timeout has passed
+template<typename TFn>
+errno_t timeout(EventLoop &el, TFn &&f, int timeoutMs) noexcept
+{
+	EventFunctorView fv = std::forward<TFn>(f);
+	const EventFunctorVt *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return el.Vt->TimeoutFunctor(&el, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor, timeoutMs);
+}
+
+//! Store a callable `errno_t(EventLoop &el)` in an EventFunctor. Rvalues are moved, lvalues are copied
+template<typename TFn>
+EventFunctor makeEventFunctor(TFn &&f)
+{
+	return EventFunctor(std::decay_t<TFn>(std::forward<TFn>(f))); // Functor takes a value, not a reference
+}
+
+namespace impl {
+
+// Keeps at most one drain functor of a queue scheduled on the loop. Producers request a drain after publishing their work, the drain finishes by scheduling the next one while work remains
+class DrainSchedule
+{
+public:
+	DrainSchedule() noexcept : m_Scheduled(false)
+	{
+	}
+
+	// Call after publishing work, schedule posts the drain and returns its error
+	template<typename TSchedule>
+	errno_t request(TSchedule &&schedule) noexcept
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst); // Pairs with the fence in finish
+		if (m_Scheduled.load(std::memory_order_relaxed) || m_Scheduled.exchange(true))
+			return 0; // The scheduled drain picks it up
+		return post(schedule);
+	}
+
+	// Call when the drain returns, pending checks for work without touching state of the drain, which may already run again on another thread once this returns
+	template<typename TPending, typename TSchedule>
+	void finish(TPending &&pending, TSchedule &&schedule) noexcept
+	{
+		if (pending())
+		{
+			post(schedule);
+			return;
+		}
+		m_Scheduled.store(false, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst); // Pairs with the fence in request
+		if (pending() && !m_Scheduled.exchange(true))
+			post(schedule); // Raced with a request that saw the drain still scheduled
+	}
+
+private:
+	template<typename TSchedule>
+	errno_t post(TSchedule &schedule) noexcept
+	{
+		errno_t eno = schedule();
+		if (eno)
+			m_Scheduled = false; // The next request retries, the work stays queued
+		return eno;
+	}
+
+	std::atomic_bool m_Scheduled;
+
+};
+
+}
+
 }
 #endif
 
@@ -243,127 +436,6 @@ public:
 		});
 		t.detach();
 	}
-
-	//! Post a kernel with signature `void(ptrdiff_t)`, return immediately. Calls callback when done. Involves one memory allocation. Option trickle posts each iteration, and the callback, separately to avoid blocking the event loop
-	template<typename TFunc, typename TCb>
-	void post(const TFunc &f, ptrdiff_t from, ptrdiff_t to, TCb &&cb = []() -> void {}, bool trickle = false)
-	{
-		struct TData
-		{
-			Functor<void(ptrdiff_t)> f;
-			EventFunctorView cb;
-			EventFunctorView ef;
-			std::atomic_ptrdiff_t counter;
-			ptrdiff_t to;
-			int tc;
-		};
-		std::shared_ptr<TData> d = std::make_shared<TData>();
-		int tc = (int)min((ptrdiff_t)threads(), to - from);
-		d->f = f;
-		d->cb = cb;
-		d->counter = from;
-		d->to = to;
-		d->tc = tc;
-		if (!trickle)
-		{
-			for (int t = 0; t < tc; ++tc)
-			{
-				post([d]() -> void {
-					Functor<void(ptrdiff_t)> &const f = d->f;
-					EventFunctorView &const cb = d->cb;
-					std::atomic_ptrdiff_t &const counter = d->counter;
-					const ptrdiff_t &const to = d->to;
-					const int &const tc = d->tc;
-
-					ptrdiff_t k = counter.fetch_add(1);
-					while (k < to)
-					{
-						f(k);
-						k = counter.fetch_add(1);
-					}
-
-					if (k - to == tc - 1) // Last round exiting
-						cb();
-				});
-			}
-		}
-		else
-		{
-			d->ef = [d]() -> void {
-				Functor<void(ptrdiff_t)> &const f = d->f;
-				EventFunctorView &const cb = d->cb;
-				EventFunctorView &const ef = d->ef;
-				std::atomic_ptrdiff_t &const counter = d->counter;
-				const ptrdiff_t &const to = d->to;
-				const int &const tc = d->tc;
-
-				ptrdiff_t k = counter.fetch_add(1);
-				if (k < to)
-				{
-					f(k);
-					post(ef); // Next round
-				}
-				else if (k - to == tc - 1)
-				{
-					post(cb); // Last round exiting
-				}
-			};
-
-			for (int t = 0; t < tc; ++tc)
-				d->ef();
-		}
-	}
-
-
-	//! Post a kernel with signature `void(ptrdiff_t)`, block until done. This is ideal when the calling thread is running in the same eventloop
-	template<typename TFunc, typename TCb>
-	void invoke(const TFunc &f, ptrdiff_t from, ptrdiff_t to)
-	{
-		std::atomic_ptrdiff_t counter = from;
-		int tc = (int)min((ptrdiff_t)threads(), to - from);
-		if (l_EventLoop == this)
-		{
-			std::vector<EventFlag> flags(tc - 1);
-			for (int t = 1; t < tc; ++tc)
-			{
-				post([&f, &counter, &flag = flags[t - 1]]() -> void {
-					ptrdiff_t k = counter.fetch_add(1);
-					while (k < to)
-					{
-						f(k);
-						k = counter.fetch_add(1);
-					}
-					flag.set();
-				});
-			}
-			ptrdiff_t k = counter.fetch_add(1);
-			while (k < counter)
-			{
-				f(k);
-				k = counter.fetch_add(1);
-			}
-			for (ptrdiff_t i = 0; i < (ptrdiff_t)flags.size(); ++i)
-				flags[i].wait();
-		}
-		else
-		{
-			std::vector<EventFlag> flags(tc);
-			for (int t = 1; t < tc; ++tc)
-			{
-				post([&f, &counter, &flag = flags[t]]() -> void {
-					ptrdiff_t k = counter.fetch_add(1);
-					while (k < to)
-					{
-						f(k);
-						k = counter.fetch_add(1);
-					}
-					flag.set();
-				});
-			}
-			for (ptrdiff_t i = 0; i < (ptrdiff_t)flags.size(); ++i)
-				flags[i].wait();
-		}
-	}
 };
 
 #endif
@@ -0,0 +1,337 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Fd readiness through epoll, shared by all event loops.
+
+The epoll fd is created by the first watch. From then on, one parked thread at a
+time waits in epoll_wait instead of on its own parking slot, with an eventfd in
+the same set to interrupt it when work is posted. Ready fds are posted to the
+loop directly from the polling thread, which then continues running the loop.
+
+Watches are oneshot, the fd is re-armed after its functor returns, so a functor
+never runs concurrently with itself, even on multi-threaded loops.
+
+*/
+
+#include "event_loop.h"
+#include "event_loop_impl.h"
+
+#ifdef SEV_EVENT_LOOP_EPOLL
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static_assert(SEV_FD_READ == EPOLLIN);
+static_assert(SEV_FD_WRITE == EPOLLOUT);
+static_assert(SEV_FD_ERROR == EPOLLERR);
+static_assert(SEV_FD_HANGUP == EPOLLHUP);
+
+namespace sev::impl::el {
+
+namespace /* anonymous */ {
+
+constexpr int c_MaxEvents = 64;
+constexpr uint64_t c_WakeKey = ~0ULL;
+
+SEV_FORCE_INLINE uint64_t watchKey(const FdWatch &watch)
+{
+	return (watch.Id << 32) | (uint32_t)watch.Fd;
+}
+
+errno_t pollCreate(EventLoopBase *elp)
+{
+	int epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd < 0)
+		return errno;
+	int wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakeFd < 0)
+	{
+		errno_t eno = errno;
+		close(epollFd);
+		return eno;
+	}
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.u64 = c_WakeKey;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev))
+	{
+		errno_t eno = errno;
+		close(wakeFd);
+		close(epollFd);
+		return eno;
+	}
+	elp->WakeFd = wakeFd;
+	elp->EpollFd.store(epollFd, std::memory_order_release);
+	return 0;
+}
+
+// Call with ArmMutex locked
+void arm(EventLoopBase *elp, FdWatch *watch)
+{
+	epoll_event ev = {};
+	ev.events = watch->Events | EPOLLONESHOT;
+	ev.data.u64 = watchKey(*watch);
+	epoll_ctl(elp->EpollFd, EPOLL_CTL_MOD, watch->Fd, &ev); // Fails only if the fd was closed without unwatching
+}
+
+void disarmed(EventLoopBase *elp, FdWatch *watch)
+{
+	std::unique_lock<std::mutex> lock(watch->ArmMutex);
+	watch->InFlight = false;
+	if (!watch->Removed)
+		arm(elp, watch);
+}
+
+void dispatch(EventLoopBase *elp, uint64_t key, uint32_t events)
+{
+	std::shared_ptr<FdWatch> watch;
+	{
+		std::unique_lock<std::mutex> lock(elp->WatchMutex);
+		auto it = elp->Watches.find((int)(uint32_t)key);
+		if (it == elp->Watches.end() || watchKey(*it->second) != key)
+			return; // Stale event of a removed watch
+		watch = it->second;
+	}
+	{
+		std::unique_lock<std::mutex> lock(watch->ArmMutex);
+		if (watch->Removed || watch->InFlight)
+			return; // Re-armed by modifyFd while the event was being delivered, the running functor re-arms when it returns
+		watch->InFlight = true;
+	}
+	errno_t eno;
+	try
+	{
+		auto dispatch = [elp, watch, events](sev::EventLoop &el) -> errno_t {
+			auto fin = gsl::finally([&]() -> void {
+				disarmed(elp, watch.get());
+			});
+			{
+				std::unique_lock<std::mutex> lock(watch->ArmMutex);
+				if (watch->Removed)
+					return 0;
+			}
+			return watch->F(el, watch->Fd, events);
+		};
+		sev::EventFunctorView fv = std::move(dispatch);
+		const sev::EventFunctorVt *vt;
+		void *ptr;
+		bool movable;
+		fv.extract(vt, ptr, movable, true);
+		eno = elp->Vt->PostFunctor(elp, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+	}
+	catch (...)
+	{
+		eno = ENOMEM;
+	}
+	if (eno)
+		disarmed(elp, watch.get()); // Try again on the next poll
+}
+
+// Drain the wake fd and post the functors of the ready fds
+void dispatchAll(EventLoopBase *elp, const epoll_event *events, int nb)
+{
+	for (int i = 0; i < nb; ++i)
+	{
+		if (events[i].data.u64 == c_WakeKey)
+		{
+			uint64_t v;
+			(void)read(elp->WakeFd, &v, sizeof(v));
+			continue;
+		}
+		dispatch(elp, events[i].data.u64, events[i].events);
+	}
+}
+
+}
+
+void pollWait(EventLoopBase *elp, int timeoutMs)
+{
+	{
+		std::unique_lock<AtomicMutex> lock(elp->IdleMutex);
+		++elp->ThreadsWaiting;
+		if (elp->Pending || !elp->Running) // Pairs with the ThreadsWaiting check after posting
+		{
+			--elp->ThreadsWaiting;
+			elp->Polling = false;
+			return;
+		}
+		elp->PollerParked = true;
+	}
+	epoll_event events[c_MaxEvents];
+	int nb = epoll_wait(elp->EpollFd, events, c_MaxEvents, timeoutMs);
+	{
+		std::unique_lock<AtomicMutex> lock(elp->IdleMutex);
+		if (elp->PollerParked)
+		{
+			elp->PollerParked = false;
+			--elp->ThreadsWaiting;
+		}
+		else
+		{
+			--elp->Waking; // Interrupted
+		}
+	}
+	elp->Polling = false;
+	dispatchAll(elp, events, nb);
+}
+
+void pollNow(EventLoopBase *elp)
+{
+	if (elp->EpollFd.load(std::memory_order_acquire) < 0 || elp->Polling.exchange(true))
+		return; // Not watching, or another thread polls
+	epoll_event events[c_MaxEvents];
+	int nb = epoll_wait(elp->EpollFd, events, c_MaxEvents, 0);
+	elp->Polling = false;
+	dispatchAll(elp, events, nb);
+}
+
+void pollInterrupt(EventLoopBase *elp)
+{
+	uint64_t v = 1;
+	(void)write(elp->WakeFd, &v, sizeof(v));
+}
+
+void pollRelease(EventLoopBase *elp)
+{
+	int epollFd = elp->EpollFd.exchange(-1);
+	if (epollFd >= 0)
+	{
+		close(elp->WakeFd);
+		close(epollFd);
+	}
+	elp->Watches.clear();
+}
+
+}
+
+errno_t SEV_IMPL_EventLoop_watchFd(SEV_EventLoop *el, int fd, uint32_t events, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::el;
+	EventLoopBase *elp = (EventLoopBase *)el;
+	if (fd < 0)
+		return EINVAL;
+	bool created = false;
+	try
+	{
+		std::unique_lock<std::mutex> lock(elp->WatchMutex);
+		if (elp->EpollFd < 0)
+		{
+			errno_t eno = pollCreate(elp);
+			if (eno) return eno;
+			created = true;
+		}
+		if (elp->Watches.count(fd))
+			return EEXIST;
+		sev::FdFunctor f((const sev::FdFunctorVt *)vt, ptr, forwardConstructor == vt->MoveConstructor);
+		std::shared_ptr<FdWatch> watch = std::make_shared<FdWatch>(fd, events, ++elp->NextWatchId, std::move(f));
+		elp->Watches[fd] = watch;
+		epoll_event ev = {};
+		ev.events = events | EPOLLONESHOT;
+		ev.data.u64 = watchKey(*watch);
+		if (epoll_ctl(elp->EpollFd, EPOLL_CTL_ADD, fd, &ev))
+		{
+			errno_t eno = errno;
+			elp->Watches.erase(fd);
+			return eno;
+		}
+	}
+	catch (std::bad_alloc)
+	{
+		return ENOMEM;
+	}
+	catch (...)
+	{
+		return EOTHER;
+	}
+	if (created)
+		wakeAll(elp); // Parked threads park again, one of them becomes the polling thread
+	return 0;
+}
+
+errno_t SEV_IMPL_EventLoop_modifyFd(SEV_EventLoop *el, int fd, uint32_t events)
+{
+	using namespace sev::impl::el;
+	EventLoopBase *elp = (EventLoopBase *)el;
+	std::shared_ptr<FdWatch> watch;
+	{
+		std::unique_lock<std::mutex> lock(elp->WatchMutex);
+		auto it = elp->Watches.find(fd);
+		if (it == elp->Watches.end())
+			return ENOENT;
+		watch = it->second;
+	}
+	std::unique_lock<std::mutex> lock(watch->ArmMutex);
+	watch->Events = events;
+	if (!watch->InFlight && !watch->Removed)
+		arm(elp, watch.get());
+	return 0;
+}
+
+errno_t SEV_IMPL_EventLoop_unwatchFd(SEV_EventLoop *el, int fd)
+{
+	using namespace sev::impl::el;
+	EventLoopBase *elp = (EventLoopBase *)el;
+	std::shared_ptr<FdWatch> watch;
+	{
+		std::unique_lock<std::mutex> lock(elp->WatchMutex);
+		auto it = elp->Watches.find(fd);
+		if (it == elp->Watches.end())
+			return ENOENT;
+		watch = std::move(it->second);
+		elp->Watches.erase(it);
+	}
+	std::unique_lock<std::mutex> lock(watch->ArmMutex);
+	watch->Removed = true;
+	epoll_ctl(elp->EpollFd, EPOLL_CTL_DEL, fd, null); // Fails if the fd was already closed, which removed it already
+	return 0;
+}
+
+#else
+
+errno_t SEV_IMPL_EventLoop_watchFd(SEV_EventLoop *el, int fd, uint32_t events, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return ENOSYS;
+}
+
+errno_t SEV_IMPL_EventLoop_modifyFd(SEV_EventLoop *el, int fd, uint32_t events)
+{
+	return ENOSYS;
+}
+
+errno_t SEV_IMPL_EventLoop_unwatchFd(SEV_EventLoop *el, int fd)
+{
+	return ENOSYS;
+}
+
+#endif
+
+/* end of file */
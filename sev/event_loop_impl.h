@@ -33,33 +33,50 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "platform.h"
 
-#ifdef _MSC_VER
-#define SEV_EVENT_LOOP_MSVC_CONCURRENT
+#if defined(__linux__) && !defined(SEV_EVENT_LOOP_NO_EPOLL)
+#define SEV_EVENT_LOOP_EPOLL
 #endif
 
 #include "event_loop.h"
 #include "concurrent_functor_queue.h"
+#include "work_stealing_deque.h"
+#include "atomic_mutex.h"
 
 #include <mutex>
 #include <thread>
 #include <vector>
 #include <map>
-
-#ifdef SEV_EVENT_LOOP_MSVC_CONCURRENT
-#include <concurrent_priority_queue.h>
-#else
+#include <set>
+#include <memory>
 #include <queue>
+#include <condition_variable>
+
+#ifdef SEV_EVENT_LOOP_EPOLL
+#include <signal.h>
 #endif
 
 namespace sev::impl::el {
 
 extern SEV_EventLoopVt EventLoopVt;
+extern SEV_EventLoopVt WorkStealingEventLoopVt;
 
-struct TimeoutFunctor
+struct TimerState
 {
+	TimerState(EventFunctor &&f) : Functor(std::move(f))
+	{
+	}
+
 	EventFunctor Functor; // Return ECANCELED to stop an interval
+	std::atomic_bool Running{ false }; // Interval ticks are skipped while the previous tick still runs
+	std::atomic_bool Cancelled{ false };
+
+};
+
+struct TimeoutFunctor
+{
+	std::shared_ptr<TimerState> State;
 	std::chrono::steady_clock::time_point Time;
-	std::chrono::steady_clock::duration Interval;
+	std::chrono::steady_clock::duration Interval; // Zero for a timeout
 
 	bool operator <(const TimeoutFunctor &o) const
 	{
@@ -77,30 +94,329 @@ struct TimeoutFunctorWin32
 };
 #endif
 
+// Each waiting thread parks on its own flag, so a post can wake exactly one thread
+struct alignas(64) ParkingSlot
+{
+	sev::EventFlag Flag;
+	ParkingSlot *Next = null; // Idle stack
+	bool Signaled = false; // Set by the waking thread before setting the flag
+
+};
+
+#ifdef SEV_EVENT_LOOP_EPOLL
+struct FdWatch
+{
+	FdWatch(int fd, uint32_t events, uint64_t id, sev::FdFunctor &&f) : Fd(fd), Events(events), Id(id), F(std::move(f))
+	{
+	}
+
+	const int Fd;
+	std::atomic_uint32_t Events;
+	const uint64_t Id; // Distinguishes a new watch on a reused fd from a stale epoll event
+
+	sev::FdFunctor F;
+
+	std::mutex ArmMutex;
+	bool InFlight = false; // Functor posted and not yet returned, guarded by ArmMutex
+	bool Removed = false; // Guarded by ArmMutex
+
+};
+#endif
+
+// Metrics of one thread running the loop, only written by that thread
+struct alignas(64) MetricsSlot
+{
+	std::atomic_uint64_t Tasks{ 0 };
+	std::atomic_uint64_t Wakeups{ 0 };
+	std::atomic_int64_t BusyNs{ 0 };
+	std::atomic_int64_t IdleNs{ 0 };
+	std::atomic_uint64_t Latency[SEV_EVENT_LOOP_METRICS_BUCKETS] = {};
+	std::atomic_uint64_t Execution[SEV_EVENT_LOOP_METRICS_BUCKETS] = {};
+	std::atomic<const SEV_FunctorVt *> Running{ null }; // Functor being run, null while idle. Stays set in between functors, the watchdog tells them apart by Tasks
+	MetricsSlot *Next = null; // All slots of the loop
+	bool InUse = true; // Guarded by MetricsMutex
+
+};
+
+// Single writer increment, cheaper than an atomic add
+template<typename T>
+SEV_FORCE_INLINE void metricsAdd(std::atomic<T> &counter, T value) noexcept
+{
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+SEV_FORCE_INLINE int metricsBucket(int64_t ns) noexcept
+{
+	int bucket = 0;
+	for (uint64_t v = (uint64_t)(ns > 0 ? ns : 0); v; v >>= 1)
+		++bucket;
+	return bucket < SEV_EVENT_LOOP_METRICS_BUCKETS ? bucket : SEV_EVENT_LOOP_METRICS_BUCKETS - 1;
+}
+
+enum TraceEventType
+{
+	TracePost,
+	TraceStart,
+	TraceEnd,
+};
+
+struct TraceEvent
+{
+	std::atomic_uint64_t Seq; // Odd while the event is written, otherwise twice its index plus two
+	std::atomic<int64_t> TimeNs; // Since the loop was created. The fields are relaxed atomics, the writer may overwrite them while they are read
+	std::atomic<const void *> Vt; // Identifies the functor type
+	std::atomic_uint64_t Id; // Links a post to the start of the same functor
+	std::atomic_int Type;
+
+};
+
+// Trace events of one thread, only written by that thread. Old events are overwritten
+struct TraceRing
+{
+	TraceRing(uint64_t capacity, int tid) : Events(new TraceEvent[capacity]()), Mask(capacity - 1), Head(0), Thread(std::this_thread::get_id()), Tid(tid), Next(null)
+	{
+	}
+
+	std::unique_ptr<TraceEvent[]> Events;
+	const uint64_t Mask;
+	std::atomic_uint64_t Head; // Number of events written
+	const std::thread::id Thread;
+	const int Tid;
+	TraceRing *Next; // All rings of the loop
+
+};
+
+// Unique serial number for a new loop
+uint64_t nextSerial();
+
 class EventLoopBase : public SEV_EventLoop
 {
 public:
-	EventLoopBase(SEV_EventLoopVt *vt) : SEV_EventLoop{ vt }, QueueItems(0), Running(false), Threads(0), ThreadsWaiting(0), Stopping(false)
+	EventLoopBase(SEV_EventLoopVt *vt) : SEV_EventLoop{ vt }, QueueItems(0), Pending(0), Running(false), Posted(0), Completed(0), Joiners(0), Barriers(0), NextLateSeq(0), LatePosted(0), LateCompleted(0), Threads(0), ThreadsWaiting(0), ManagedCount(0), Stopping(false),
+		SpinIterations(0), YieldIterations(0), SpinAdaptive(false), IdleAverageNs(0), PausePs(0), IdleSlots(null), Waking(0),
+		ElasticStopping(false), ElasticMax(0), GrowAfterMs(0), ElasticMin(0), RetireAfterMs(0), MetricsEnabled(false), MetricsSlots(null),
+		Tracing(false), TraceCapacity(0), TraceRings(null), NbTraceRings(0), NextTraceId(0), Serial(nextSerial()), Epoch(std::chrono::steady_clock::now()),
+		WatchdogStopping(false), WatchdogThresholdMs(0), TimerStopping(false)
+#ifdef SEV_EVENT_LOOP_EPOLL
+		, EpollFd(-1), WakeFd(-1), Polling(false), PollerParked(false), NextWatchId(0)
+#endif
 	{
 
 	}
 
+	~EventLoopBase();
+
 	ConcurrentFunctorQueue<errno_t(EventLoop &)> Queue;
-	std::atomic_int QueueItems;
+	std::atomic_int QueueItems; // Queued or running
+	std::atomic_int Pending; // Queued and not yet started, decremented when popped. Idle threads look at this, running functors are not work for them
 	std::atomic_bool Running;
+
+	// Join, joining threads park until every functor posted before they joined completed. Functors posted meanwhile are late, they are tracked by sequence number instead, so they can't stand in for an earlier functor which still runs
+	std::atomic_uint64_t Posted; // Counted once the functor is queued
+	std::atomic_uint64_t Completed;
+	std::atomic_int Joiners;
+	std::atomic_int Barriers; // Joiners without empty, posts are late while non-zero
+	std::mutex JoinMutex;
+	std::condition_variable JoinCondition;
+	std::set<uint64_t> LateRunning; // Sequence numbers of the late functors not yet completed, guarded by JoinMutex
+	uint64_t NextLateSeq; // Guarded by JoinMutex
+	std::atomic_uint64_t LatePosted; // Counted after Posted, so the count of the other functors is never short
+	std::atomic_uint64_t LateCompleted; // Counted before Completed
+
 	std::atomic_int Threads;
-	std::atomic_int ThreadsWaiting;
+	std::atomic_int ThreadsWaiting; // Number of parked threads in IdleSlots
 
 	std::mutex ManagedThreadsMutex;
 	std::vector<std::thread> ManagedThreads;
+	std::atomic_int ManagedCount; // Managed threads in the loop, not counting retired ones
 	std::atomic_bool Stopping;
-	EventFlag LoopEndedFlag;
+	sev::EventFlag LoopEndedFlag;
+
+	// Wait policy
+	std::atomic_int SpinIterations;
+	std::atomic_int YieldIterations;
+	std::atomic_bool SpinAdaptive;
+	std::atomic_int64_t IdleAverageNs; // Moving average of how long threads were idle before work arrived
+	std::atomic_int64_t PausePs; // Moving average of how long one spin iteration takes in picoseconds, 0 until measured
+
+	// Parked threads
+	sev::AtomicMutex IdleMutex;
+	ParkingSlot *IdleSlots; // Stack, the most recently parked thread is woken first while its cache is still warm
+	std::atomic_int Waking; // Threads signaled but not yet resumed
+
+	// Elastic threads, a monitor thread adds managed threads while work stays queued, and idle managed threads above the minimum retire
+	std::thread ElasticThread;
+	std::condition_variable ElasticCondition; // With ManagedThreadsMutex
+	bool ElasticStopping; // Guarded by ManagedThreadsMutex
+	int ElasticMax; // Guarded by ManagedThreadsMutex
+	int GrowAfterMs; // Guarded by ManagedThreadsMutex
+	std::atomic_int ElasticMin;
+	std::atomic_int RetireAfterMs; // 0 when threads do not retire
+	sev::Functor<void(SEV_ExceptionHandle *)> ElasticOnError; // Copied for each added thread
+	sev::AtomicMutex RetiredMutex;
+	std::vector<std::thread::id> RetiredIds; // Retired threads which are still in ManagedThreads, guarded by RetiredMutex
+
+	// Metrics, one slot per thread running the loop, reused by later threads
+	std::atomic_bool MetricsEnabled;
+	sev::AtomicMutex MetricsMutex;
+	MetricsSlot *MetricsSlots;
+
+	// Tracing, one ring per thread that posted or ran a traced functor
+	std::atomic_bool Tracing;
+	std::atomic_uint64_t TraceCapacity; // Events per ring, power of two, applies to rings created afterwards
+	std::mutex TraceMutex;
+	TraceRing *TraceRings; // Guarded by TraceMutex when adding
+	int NbTraceRings; // Guarded by TraceMutex
+	std::atomic_uint64_t NextTraceId;
+	const uint64_t Serial; // Unique for each loop, so thread caches never match a later loop at the same address
+	const std::chrono::steady_clock::time_point Epoch;
+
+	// Watchdog, a thread samples the running functor of each metrics slot, and reports functors still running past the threshold
+	std::thread WatchdogThread;
+	std::mutex WatchdogMutex;
+	std::condition_variable WatchdogCondition;
+	bool WatchdogStopping; // Guarded by WatchdogMutex
+	int WatchdogThresholdMs; // Only changed while the watchdog thread is not running
+	sev::Functor<void(const SEV_FunctorVt *vt, int64_t durationMs)> WatchdogOnSlow;
+
+	// Timers, kept by a thread started on first use, which posts them to the loop when due
+	std::mutex TimerMutex;
+	std::condition_variable TimerCondition;
+	std::priority_queue<TimeoutFunctor> Timers;
+	std::thread TimerThread;
+	bool TimerStopping; // Guarded by TimerMutex
+
+#ifdef SEV_EVENT_LOOP_EPOLL
+	// Fd readiness. The epoll fd is created by the first watch, from then on one parked thread at a time waits in epoll_wait instead of on its slot
+	std::atomic_int EpollFd;
+	int WakeFd; // eventfd in the epoll set, interrupts the polling thread
+	std::atomic_bool Polling;
+	bool PollerParked; // Polling thread is waiting and counted in ThreadsWaiting, guarded by IdleMutex
+	std::mutex WatchMutex;
+	std::map<int, std::shared_ptr<FdWatch>> Watches;
+	uint64_t NextWatchId; // Guarded by WatchMutex
+#endif
 
 	EventLoopBase(const EventLoop &) = delete;
 	EventLoopBase(EventLoop &&) = delete;
 
 };
 
+// Wake the joining threads, call after completing a functor while Joiners is non-zero
+void joinNotify(EventLoopBase *elp);
+
+// Count a completed functor, call after decrementing QueueItems
+SEV_FORCE_INLINE void taskCompleted(EventLoopBase *elp)
+{
+	++elp->Completed;
+	if (elp->Joiners) // Pairs with the increment before checking in join
+		joinNotify(elp);
+}
+
+// The loop if it is one of the implementations here, null for a loop with its own vtable, which the functions reaching into EventLoopBase don't support
+SEV_FORCE_INLINE EventLoopBase *builtIn(SEV_EventLoop *el)
+{
+	return el->Vt == &EventLoopVt || el->Vt == &WorkStealingEventLoopVt ? (EventLoopBase *)el : null;
+}
+
+// Signals runMain reads through a signalfd. A process-directed signal goes to any thread which doesn't block it, so every thread created here blocks them
+SEV_FORCE_INLINE void blockSignals()
+{
+#ifdef SEV_EVENT_LOOP_EPOLL
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, null);
+#endif
+}
+
+// Loop the calling thread is running, set by the loop functions for their duration
+extern thread_local EventLoopBase *t_CurrentLoop;
+
+// Spin and yield according to the wait policy, with an adaptive policy the spin count follows the idle time average. Returns true if work arrived, or the loop is stopping, false if the thread should park
+bool spinWait(EventLoopBase *elp);
+
+// Update the idle time average of the adaptive wait policy, call after each wait when spinning is adaptive
+void idleEnded(EventLoopBase *elp, std::chrono::steady_clock::time_point idleStart);
+
+// Park the calling thread until woken by a post or stop, or until the timeout expires. Returns immediately if work is queued
+void park(EventLoopBase *elp, ParkingSlot *slot, int timeoutMs = -1);
+
+// Park like park, and retire the calling thread instead when it is an elastic managed thread that has been idle long enough.
+// Returns true when the thread must leave the loop
+bool parkOrRetire(EventLoopBase *elp, ParkingSlot *slot);
+
+// Metrics slot of the calling thread, set by the loop functions for their duration
+extern thread_local MetricsSlot *t_Metrics;
+
+// Get a metrics slot for a thread entering the loop, null when out of memory
+MetricsSlot *acquireMetrics(EventLoopBase *elp);
+
+// Return the slot when leaving the loop, its counts are kept
+void releaseMetrics(EventLoopBase *elp, MetricsSlot *slot);
+
+// Record a functor that ran from start until now
+SEV_FORCE_INLINE void metricsTask(MetricsSlot *slot, std::chrono::steady_clock::time_point start) noexcept
+{
+	const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	metricsAdd<int64_t>(slot->BusyNs, ns);
+	metricsAdd<uint64_t>(slot->Execution[metricsBucket(ns)], 1);
+}
+
+// Wrap the functor posted while a join without empty waits to track it by sequence number, and post it with the next post function of the loop
+errno_t postLate(EventLoopBase *elp, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), errno_t(*post)(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)));
+
+// Wrap the functor to record its latency and trace events, and post it with the plain post function of the loop
+errno_t postInstrumented(EventLoopBase *elp, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), errno_t(*post)(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)));
+
+// Record the post of a traced functor in the calling thread's ring, returns the id to pass to the functor's start and end
+uint64_t tracePost(EventLoopBase *elp, const void *vt);
+
+// Record an event in the calling thread's ring
+void traceRecord(EventLoopBase *elp, TraceEventType type, const void *vt, uint64_t id);
+
+// Release the rings, call when destroying the loop
+void traceRelease(EventLoopBase *elp);
+
+// Watchdog thread function, started by SEV_EventLoop_setWatchdog
+void watchdogThread(EventLoopBase *elp);
+
+// Stop the watchdog thread, call before releasing the metrics slots
+void watchdogRelease(EventLoopBase *elp);
+
+// Stop the elastic monitor thread, call before stopping the loop
+void elasticRelease(EventLoopBase *elp);
+
+// Wake one parked thread, unless enough threads are already waking up for the queued work. Call after posting when ThreadsWaiting is non-zero
+void wakeOne(EventLoopBase *elp);
+
+// Wake all parked threads, used when stopping
+void wakeAll(EventLoopBase *elp);
+
+// Queue a timer on the timer thread, which posts the functor to the loop when due. Zero interval for a single timeout
+errno_t timerAdd(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int delayMs, int intervalMs);
+
+// Stop the timer thread and release pending timers, call before destroying the loop
+void timerRelease(EventLoopBase *elp);
+
+#ifdef SEV_EVENT_LOOP_EPOLL
+// Wait in epoll_wait as the polling thread, then post the functors of the ready fds. Called by park after winning Polling
+void pollWait(EventLoopBase *elp, int timeoutMs);
+
+// Poll without waiting and post the functors of the ready fds, so watched fds are not starved while no thread parks. Skipped while another thread polls
+void pollNow(EventLoopBase *elp);
+
+// Functors run by a thread between two calls to pollNow
+constexpr int c_PollInterval = 64;
+
+// Interrupt the polling thread, call with IdleMutex locked
+void pollInterrupt(EventLoopBase *elp);
+
+// Close the epoll fd and release all watches
+void pollRelease(EventLoopBase *elp);
+#endif
+
 class EventLoop : public EventLoopBase
 {
 public:
@@ -108,14 +424,53 @@ public:
 	{
 	}
 
-	EventFlag Flag;
+};
 
-#ifdef SEV_EVENT_LOOP_MSVC_CONCURRENT
-	concurrency::concurrent_priority_queue<TimeoutFunctor> TimeoutConcurrent;
-#else
-	std::mutex TimeoutMutex;
-	std::priority_queue<TimeoutFunctor> Timeout;
-#endif
+struct alignas(SEV_FUNCTOR_ALIGN) WorkStealingTask
+{
+	const SEV_FunctorVt *Vt;
+	WorkStealingTask *Next; // Recycling list
+	ptrdiff_t Capacity;
+
+	SEV_FORCE_INLINE void *data() noexcept { return reinterpret_cast<uint8_t *>(this) + sizeof(WorkStealingTask); }
+
+};
+
+typedef ConcurrentFunctorQueue<errno_t(sev::EventLoop &)> EventFunctorQueue;
+
+struct alignas(64) WorkStealingWorker
+{
+	WorkStealingDeque<WorkStealingTask *> Deque;
+	std::atomic_bool Active;
+	uint32_t Seed; // Victim selection
+	int Node; // NUMA node the worker thread entered the loop on
+	ParkingSlot Parking;
+
+};
+
+class WorkStealingEventLoop : public EventLoopBase
+{
+public:
+	WorkStealingEventLoop() : EventLoopBase(&WorkStealingEventLoopVt), NbWorkers(0), NbNodes(SEV_Numa_nodeCount())
+	{
+		for (std::atomic<WorkStealingWorker *> &worker : Workers)
+			worker.store(null, std::memory_order_relaxed);
+		for (std::atomic<EventFunctorQueue *> &queue : NodeQueues)
+			queue.store(null, std::memory_order_relaxed);
+	}
+
+	~WorkStealingEventLoop();
+
+	static constexpr int c_MaxWorkers = 256;
+
+	std::atomic<WorkStealingWorker *> Workers[c_MaxWorkers]; // Slots are never released while the loop exists, stealing threads may be reading them
+	std::atomic_int NbWorkers; // Number of slots in use
+	std::mutex WorkersMutex;
+
+	// Per-node injection queues, only used on NUMA systems. Each is created by the first worker on its node,
+	// so the initial and spare blocks are first touched, and thus placed, on that node
+	const int NbNodes;
+	std::atomic<EventFunctorQueue *> NodeQueues[SEV_NUMA_NODE_MAX];
 
 };
 
@@ -0,0 +1,168 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Running a loop on the calling thread until it is stopped, with SIGINT and
+SIGTERM delivered as functors.
+
+The signals are blocked on the calling thread and read from a signalfd,
+which is watched like any other fd, so signal handling runs as a normal
+functor on the loop instead of in an async signal handler. The threads the
+library creates block them as well, threads created elsewhere must block
+them too, or a signal may be delivered to them instead.
+
+*/
+
+#include "event_loop.h"
+#include "event_loop_impl.h"
+
+#ifdef SEV_EVENT_LOOP_EPOLL
+
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+namespace sev::impl::el {
+
+namespace /* anonymous */ {
+
+// Shared by the copies of the watch functor, closes the signalfd once no copy can still read it
+struct SignalState
+{
+	SignalState(int fd) : Fd(fd)
+	{
+	}
+
+	~SignalState()
+	{
+		close(Fd);
+	}
+
+	const int Fd;
+	bool Stop = true; // Stop the loop when there is no handler
+	sev::Functor<errno_t(sev::EventLoop &el, int signo)> OnSignal;
+
+};
+
+}
+
+}
+
+#endif
+
+void SEV_EventLoop_runMain(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *onSignal, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	if (!sev::impl::el::builtIn(el))
+	{
+		*eh = SEV_Exception_capture(ENOSYS);
+		return;
+	}
+#ifdef SEV_EVENT_LOOP_EPOLL
+	sigset_t signals;
+	sigset_t prevSignals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	errno_t eno = pthread_sigmask(SIG_BLOCK, &signals, &prevSignals);
+	if (eno)
+	{
+		*eh = SEV_Exception_capture(eno);
+		return;
+	}
+	auto restoreSignals = gsl::finally([&]() -> void {
+		pthread_sigmask(SIG_SETMASK, &prevSignals, null);
+	});
+	const int fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0)
+	{
+		*eh = SEV_Exception_capture(errno);
+		return;
+	}
+	std::shared_ptr<sev::impl::el::SignalState> state;
+	try
+	{
+		state = std::make_shared<sev::impl::el::SignalState>(fd);
+	}
+	catch (...)
+	{
+		close(fd);
+		*eh = SEV_Exception_capture(ENOMEM);
+		return;
+	}
+	try
+	{
+		if (onSignal)
+		{
+			state->Stop = false;
+			state->OnSignal = sev::Functor<errno_t(sev::EventLoop &el, int signo)>((sev::FunctorVt<errno_t(sev::EventLoop &el, int signo)> *)onSignal, ptr, forwardConstructor == onSignal->MoveConstructor);
+		}
+	}
+	catch (...)
+	{
+		*eh = SEV_Exception_capture(ENOMEM);
+		return;
+	}
+	auto onReadable = [state](sev::EventLoop &el, int watchedFd, uint32_t events) -> errno_t {
+		signalfd_siginfo info;
+		while (read(watchedFd, &info, sizeof(info)) == sizeof(info))
+		{
+			if (state->Stop)
+			{
+				SEV_EventLoop_stop(&el);
+				continue;
+			}
+			errno_t eno = state->OnSignal(el, (int)info.ssi_signo);
+			if (eno) return eno;
+		}
+		return 0;
+	};
+	sev::FdFunctorView fv = std::move(onReadable);
+	const sev::FdFunctorVt *vt;
+	void *fptr;
+	bool movable;
+	fv.extract(vt, fptr, movable, true);
+	eno = SEV_EventLoop_watchFd(el, fd, SEV_FD_READ, vt->get(), fptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+	if (eno)
+	{
+		*eh = SEV_Exception_capture(eno);
+		return;
+	}
+	el->Vt->Loop(el, eh);
+	if (!*eh)
+		el->Vt->Stop(el); // Stopped from a functor, wait for the other threads to leave
+	SEV_EventLoop_unwatchFd(el, fd);
+#else
+	el->Vt->Loop(el, eh);
+	if (!*eh)
+		el->Vt->Stop(el);
+#endif
+}
+
+/* end of file */
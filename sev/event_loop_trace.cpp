@@ -0,0 +1,224 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Functor tracing, shared by all event loops.
+
+Posts made while tracing is enabled are wrapped like for the latency
+metrics. The post is recorded in the ring of the posting thread, and the
+start and end of the functor in the ring of the thread running it. Rings
+are only written by their own thread, the writer copies them out as Chrome
+trace event JSON and skips the events which are overwritten meanwhile.
+The output opens in chrome://tracing and Perfetto. Functors are named by
+their vtable address, which the symbols of the binary map to the functor
+type.
+
+*/
+
+#include "event_loop.h"
+#include "event_loop_impl.h"
+
+#include <stdio.h>
+
+namespace sev::impl::el {
+
+namespace /* anonymous */ {
+
+std::atomic_uint64_t s_NextSerial(1);
+
+constexpr int c_RingCacheSize = 8; // Rings of the loops the thread traced recently, by loop serial
+
+struct RingCacheEntry
+{
+	uint64_t Serial = 0;
+	TraceRing *Ring = null;
+
+};
+
+thread_local RingCacheEntry t_RingCache[c_RingCacheSize];
+
+TraceRing *traceRing(EventLoopBase *elp)
+{
+	RingCacheEntry &cached = t_RingCache[elp->Serial % c_RingCacheSize];
+	if (cached.Serial == elp->Serial)
+		return cached.Ring;
+	std::unique_lock<std::mutex> lock(elp->TraceMutex);
+	const std::thread::id thread = std::this_thread::get_id();
+	TraceRing *ring = elp->TraceRings;
+	while (ring && ring->Thread != thread)
+		ring = ring->Next;
+	if (!ring)
+	{
+		try
+		{
+			ring = new TraceRing(elp->TraceCapacity, elp->NbTraceRings + 1);
+		}
+		catch (...)
+		{
+			return null; // Not traced
+		}
+		++elp->NbTraceRings;
+		ring->Next = elp->TraceRings;
+		elp->TraceRings = ring;
+	}
+	cached.Serial = elp->Serial;
+	cached.Ring = ring;
+	return ring;
+}
+
+void traceWrite(TraceRing *ring, TraceEventType type, const void *vt, uint64_t id, int64_t timeNs)
+{
+	const uint64_t head = ring->Head.load(std::memory_order_relaxed);
+	TraceEvent &ev = ring->Events[head & ring->Mask];
+	ev.Seq.store(head * 2 + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release); // Seq is odd before any field changes
+	ev.TimeNs.store(timeNs, std::memory_order_relaxed);
+	ev.Vt.store(vt, std::memory_order_relaxed);
+	ev.Id.store(id, std::memory_order_relaxed);
+	ev.Type.store(type, std::memory_order_relaxed);
+	ev.Seq.store(head * 2 + 2, std::memory_order_release);
+	ring->Head.store(head + 1, std::memory_order_release);
+}
+
+}
+
+uint64_t nextSerial()
+{
+	return s_NextSerial++;
+}
+
+uint64_t tracePost(EventLoopBase *elp, const void *vt)
+{
+	const uint64_t id = ++elp->NextTraceId;
+	traceRecord(elp, TracePost, vt, id);
+	return id;
+}
+
+void traceRecord(EventLoopBase *elp, TraceEventType type, const void *vt, uint64_t id)
+{
+	TraceRing *ring = traceRing(elp);
+	if (!ring)
+		return;
+	const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - elp->Epoch).count();
+	traceWrite(ring, type, vt, id, ns);
+}
+
+void traceRelease(EventLoopBase *elp)
+{
+	std::unique_lock<std::mutex> lock(elp->TraceMutex);
+	while (elp->TraceRings)
+	{
+		TraceRing *next = elp->TraceRings->Next;
+		delete elp->TraceRings;
+		elp->TraceRings = next;
+	}
+}
+
+}
+
+errno_t SEV_EventLoop_enableTracing(SEV_EventLoop *el, int eventsPerThread)
+{
+	sev::impl::el::EventLoopBase *elp = sev::impl::el::builtIn(el);
+	if (!elp)
+		return ENOSYS;
+	if (eventsPerThread < 0)
+		return EINVAL;
+	if (!eventsPerThread)
+	{
+		elp->Tracing = false;
+		return 0;
+	}
+	uint64_t capacity = 1;
+	while (capacity < (uint64_t)eventsPerThread)
+		capacity <<= 1;
+	uint64_t expected = 0;
+	elp->TraceCapacity.compare_exchange_strong(expected, capacity); // First enable only
+	elp->Tracing = true;
+	return 0;
+}
+
+errno_t SEV_EventLoop_writeTrace(SEV_EventLoop *el, const char *path)
+{
+	sev::impl::el::EventLoopBase *elp = sev::impl::el::builtIn(el);
+	if (!elp)
+		return ENOSYS;
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return errno;
+	auto fin = gsl::finally([&]() -> void {
+		fclose(f);
+	});
+	std::unique_lock<std::mutex> lock(elp->TraceMutex);
+	bool first = true;
+	auto sep = [&]() -> const char * {
+		const char *res = first ? "\n" : ",\n";
+		first = false;
+		return res;
+	};
+	fprintf(f, "{\"traceEvents\":[");
+	for (sev::impl::el::TraceRing *ring = elp->TraceRings; ring; ring = ring->Next)
+	{
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"Thread %i\"}}", sep(), ring->Tid, ring->Tid);
+		const uint64_t head = ring->Head.load(std::memory_order_acquire);
+		const uint64_t capacity = ring->Mask + 1;
+		for (uint64_t i = head > capacity ? head - capacity : 0; i < head; ++i)
+		{
+			// Copy the event, and skip it if the thread overwrote it meanwhile
+			sev::impl::el::TraceEvent &slot = ring->Events[i & ring->Mask];
+			const uint64_t seq = slot.Seq.load(std::memory_order_acquire);
+			const int64_t timeNs = slot.TimeNs.load(std::memory_order_relaxed);
+			const void *const vt = slot.Vt.load(std::memory_order_relaxed);
+			const uint64_t id = slot.Id.load(std::memory_order_relaxed);
+			const int type = slot.Type.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seq != i * 2 + 2 || slot.Seq.load(std::memory_order_relaxed) != seq)
+				continue;
+			const long long us = (long long)(timeNs / 1000);
+			const int frac = (int)(timeNs % 1000);
+			switch (type)
+			{
+			case sev::impl::el::TracePost:
+				fprintf(f, "%s{\"name\":\"post\",\"cat\":\"sev\",\"ph\":\"s\",\"id\":%llu,\"ts\":%lli.%03i,\"pid\":1,\"tid\":%i}", sep(), (unsigned long long)id, us, frac, ring->Tid);
+				break;
+			case sev::impl::el::TraceStart:
+				fprintf(f, "%s{\"name\":\"%p\",\"cat\":\"sev\",\"ph\":\"B\",\"ts\":%lli.%03i,\"pid\":1,\"tid\":%i}", sep(), vt, us, frac, ring->Tid);
+				fprintf(f, "%s{\"name\":\"post\",\"cat\":\"sev\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%llu,\"ts\":%lli.%03i,\"pid\":1,\"tid\":%i}", sep(), (unsigned long long)id, us, frac, ring->Tid);
+				break;
+			case sev::impl::el::TraceEnd:
+				fprintf(f, "%s{\"ph\":\"E\",\"ts\":%lli.%03i,\"pid\":1,\"tid\":%i}", sep(), us, frac, ring->Tid);
+				break;
+			}
+		}
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	return ferror(f) ? EIO : 0;
+}
+
+/* end of file */
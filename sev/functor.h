@@ -195,7 +195,9 @@ private:
 		if (size > c_Capacity)
 		{
 			void *ptr = alignedMAlloc(size, SEV_FUNCTOR_ALIGN);
-			return m_Storage.Ptr;
+			if (!ptr) throw std::bad_alloc();
+			m_Storage.Ptr = ptr;
+			return ptr;
 		}
 		else
 		{
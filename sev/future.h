@@ -0,0 +1,448 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Promise and future with continuations. A continuation attached with
+then(el, f) is posted to the loop as soon as the value is set, so no
+thread waits for the result. The shared state is a single allocation.
+
+whenAll completes when all futures have a value, or with the first
+exception. whenAny completes with the first future that completes.
+
+Continuations consume the future. Future::get blocks until the value is
+available, do not call it on a loop thread for a future that is not ready.
+
+*/
+
+#pragma once
+#ifndef SEV_FUTURE_H
+#define SEV_FUTURE_H
+
+#include "platform.h"
+#include "atomic_mutex.h"
+#include "event_flag.h"
+#include "event_loop.h"
+
+#ifdef __cplusplus
+
+#include <memory>
+#include <optional>
+#include <vector>
+#include <future>
+#include <type_traits>
+
+namespace sev {
+
+template<typename T>
+class Future;
+
+template<typename T>
+class Promise;
+
+namespace impl::fut {
+
+struct Unit
+{
+};
+
+template<typename T>
+using Stored = std::conditional_t<std::is_void_v<T>, Unit, T>;
+
+template<typename T>
+struct State
+{
+	AtomicMutex Mutex;
+	bool Ready = false;
+	std::optional<Stored<T>> Value;
+	std::exception_ptr Exception;
+	Functor<void()> Continuation; // Called once on the completing thread, after the value is set, and released right after
+	bool Continued = false;
+	sev::EventFlag *Waiter = null;
+
+};
+
+template<typename T>
+void notify(State<T> &state, std::unique_lock<AtomicMutex> &lock)
+{
+	state.Ready = true;
+	if (state.Waiter)
+		state.Waiter->set(); // Under the lock, the waiter relocks before releasing the flag
+	if (!state.Continued)
+		return;
+	// The continuation usually holds the state, release it once called to break the cycle
+	Functor<void()> continuation = std::move(state.Continuation);
+	lock.unlock();
+	continuation();
+}
+
+// Exception for the errno, as thrown by ExceptionHandle::rethrow
+inline std::exception_ptr errnoException(errno_t eno) noexcept
+{
+	try
+	{
+		ExceptionHandle::rethrow(eno);
+	}
+	catch (...)
+	{
+		return std::current_exception();
+	}
+	return null;
+}
+
+template<typename T, typename... TArgs>
+void setValue(State<T> &state, TArgs &&... value)
+{
+	std::unique_lock<AtomicMutex> lock(state.Mutex);
+	if (state.Ready)
+		throw std::future_error(std::future_errc::promise_already_satisfied);
+	state.Value.emplace(std::forward<TArgs>(value)...);
+	notify(state, lock);
+}
+
+template<typename T>
+void setException(State<T> &state, std::exception_ptr ex)
+{
+	std::unique_lock<AtomicMutex> lock(state.Mutex);
+	if (state.Ready)
+		return; // First completion wins
+	state.Exception = std::move(ex);
+	notify(state, lock);
+}
+
+template<typename T>
+void setContinuation(State<T> &state, Functor<void()> &&f)
+{
+	std::unique_lock<AtomicMutex> lock(state.Mutex);
+	SEV_ASSERT(!state.Continued);
+	if (state.Ready)
+	{
+		lock.unlock();
+		f();
+		return;
+	}
+	state.Continuation = std::move(f);
+	state.Continued = true;
+}
+
+// Pass the result of one state on to the next, calling f with the value
+template<typename T, typename R, typename TFn>
+void chain(State<T> &state, State<R> &next, TFn &f)
+{
+	try
+	{
+		if (state.Exception)
+		{
+			setException(next, state.Exception);
+		}
+		else if constexpr (std::is_void_v<T>)
+		{
+			if constexpr (std::is_void_v<R>) { f(); setValue(next); }
+			else setValue(next, f());
+		}
+		else
+		{
+			if constexpr (std::is_void_v<R>) { f(std::move(*state.Value)); setValue(next); }
+			else setValue(next, f(std::move(*state.Value)));
+		}
+	}
+	catch (...)
+	{
+		setException(next, std::current_exception());
+	}
+}
+
+template<typename T, typename TFn>
+struct Then
+{
+	using Type = std::invoke_result_t<TFn, T &&>;
+};
+
+template<typename TFn>
+struct Then<void, TFn>
+{
+	using Type = std::invoke_result_t<TFn>;
+};
+
+}
+
+template<typename T>
+class Future
+{
+public:
+	Future() noexcept
+	{
+	}
+
+	explicit Future(std::shared_ptr<impl::fut::State<T>> state) noexcept : m_State(std::move(state))
+	{
+	}
+
+	Future(Future &&other) noexcept = default;
+	Future &operator=(Future &&other) noexcept = default;
+	Future(const Future &other) = delete;
+	Future &operator=(const Future &other) = delete;
+
+	bool valid() const noexcept
+	{
+		return (bool)m_State;
+	}
+
+	bool ready() const noexcept
+	{
+		SEV_ASSERT(m_State);
+		std::unique_lock<AtomicMutex> lock(m_State->Mutex);
+		return m_State->Ready;
+	}
+
+	//! Block until the value is available
+	void wait() const
+	{
+		SEV_ASSERT(m_State);
+		std::unique_lock<AtomicMutex> lock(m_State->Mutex);
+		if (m_State->Ready)
+			return;
+		SEV_ASSERT(!m_State->Waiter);
+		EventFlag flag;
+		m_State->Waiter = &flag;
+		lock.unlock();
+		flag.wait();
+		lock.lock(); // Completing thread is done with the flag once it releases the lock
+	}
+
+	//! Wait for and take the value, rethrows the exception if one was set. Consumes the future
+	T get()
+	{
+		wait();
+		std::shared_ptr<impl::fut::State<T>> state = std::move(m_State);
+		if (state->Exception)
+			std::rethrow_exception(state->Exception);
+		if constexpr (!std::is_void_v<T>)
+			return std::move(*state->Value);
+	}
+
+	//! Post f to the event loop with the value once it is set. Exceptions skip f and pass on to the returned future. Consumes the future
+	template<typename TFn>
+	Future<typename impl::fut::Then<T, TFn>::Type> then(EventLoop &el, TFn &&f)
+	{
+		using R = typename impl::fut::Then<T, TFn>::Type;
+		SEV_ASSERT(m_State);
+		std::shared_ptr<impl::fut::State<T>> state = std::move(m_State);
+		std::shared_ptr<impl::fut::State<R>> next = std::make_shared<impl::fut::State<R>>();
+		EventLoop *elp = &el;
+		impl::fut::setContinuation(*state, [elp, state, next, f = std::forward<TFn>(f)]() mutable -> void {
+			errno_t eno = post(*elp, [state, next, f = std::move(f)](EventLoop &) mutable -> errno_t {
+				impl::fut::chain(*state, *next, f);
+				return 0;
+			});
+			if (eno)
+				impl::fut::setException(*next, impl::fut::errnoException(eno));
+		});
+		return Future<R>(std::move(next));
+	}
+
+	std::shared_ptr<impl::fut::State<T>> &state() noexcept
+	{
+		return m_State;
+	}
+
+private:
+	std::shared_ptr<impl::fut::State<T>> m_State;
+
+};
+
+template<typename T>
+class Promise
+{
+public:
+	Promise() : m_State(std::make_shared<impl::fut::State<T>>())
+	{
+	}
+
+	Promise(Promise &&other) noexcept = default;
+	Promise &operator=(Promise &&other) noexcept
+	{
+		if (this != &other)
+		{
+			abandon();
+			m_State = std::move(other.m_State);
+		}
+		return *this;
+	}
+
+	Promise(const Promise &other) = delete;
+	Promise &operator=(const Promise &other) = delete;
+
+	~Promise()
+	{
+		abandon();
+	}
+
+	//! Only once
+	Future<T> future() const
+	{
+		return Future<T>(m_State);
+	}
+
+	template<typename... TArgs>
+	void setValue(TArgs &&... value)
+	{
+		impl::fut::setValue(*m_State, std::forward<TArgs>(value)...);
+	}
+
+	void setException(std::exception_ptr ex)
+	{
+		impl::fut::setException(*m_State, std::move(ex));
+	}
+
+private:
+	void abandon() noexcept
+	{
+		if (m_State && m_State.use_count() > 1)
+			impl::fut::setException(*m_State, std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+	}
+
+	std::shared_ptr<impl::fut::State<T>> m_State;
+
+};
+
+//! Future that is already set
+template<typename T, typename... TArgs>
+Future<T> makeReadyFuture(TArgs &&... value)
+{
+	std::shared_ptr<impl::fut::State<T>> state = std::make_shared<impl::fut::State<T>>();
+	impl::fut::setValue(*state, std::forward<TArgs>(value)...);
+	return Future<T>(std::move(state));
+}
+
+//! Completes with all values in order, or with the first exception. Consumes the futures
+template<typename T>
+Future<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> whenAll(std::vector<Future<T>> &&futures)
+{
+	using R = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+	struct Gather
+	{
+		std::atomic_ptrdiff_t Remaining;
+		std::atomic_bool Failed;
+		std::vector<std::optional<impl::fut::Stored<T>>> Values;
+		std::shared_ptr<impl::fut::State<R>> Result;
+	};
+	std::shared_ptr<Gather> gather = std::make_shared<Gather>();
+	gather->Remaining = (ptrdiff_t)futures.size();
+	gather->Failed = false;
+	if constexpr (!std::is_void_v<T>)
+		gather->Values.resize(futures.size());
+	gather->Result = std::make_shared<impl::fut::State<R>>();
+	Future<R> res(gather->Result);
+	if (futures.empty())
+	{
+		impl::fut::setValue(*gather->Result);
+		return res;
+	}
+	for (size_t i = 0; i < futures.size(); ++i)
+	{
+		std::shared_ptr<impl::fut::State<T>> state = std::move(futures[i].state());
+		SEV_ASSERT(state);
+		impl::fut::State<T> *sp = state.get();
+		impl::fut::setContinuation(*sp, [gather, state, i]() -> void {
+			if (state->Exception)
+			{
+				if (!gather->Failed.exchange(true))
+					impl::fut::setException(*gather->Result, state->Exception);
+			}
+			else if constexpr (!std::is_void_v<T>)
+			{
+				gather->Values[i].emplace(std::move(*state->Value)); // Each slot has a single writer
+			}
+			if (gather->Remaining.fetch_sub(1) == 1 && !gather->Failed)
+			{
+				if constexpr (std::is_void_v<T>)
+				{
+					impl::fut::setValue(*gather->Result);
+				}
+				else
+				{
+					try
+					{
+						std::vector<T> values;
+						values.reserve(gather->Values.size());
+						for (std::optional<T> &value : gather->Values)
+							values.push_back(std::move(*value));
+						impl::fut::setValue(*gather->Result, std::move(values));
+					}
+					catch (...)
+					{
+						impl::fut::setException(*gather->Result, std::current_exception());
+					}
+				}
+			}
+		});
+	}
+	return res;
+}
+
+//! Completes with the index, and the value, of the first future to complete. Consumes the futures
+template<typename T>
+Future<std::conditional_t<std::is_void_v<T>, size_t, std::pair<size_t, T>>> whenAny(std::vector<Future<T>> &&futures)
+{
+	using R = std::conditional_t<std::is_void_v<T>, size_t, std::pair<size_t, T>>;
+	std::shared_ptr<impl::fut::State<R>> result = std::make_shared<impl::fut::State<R>>();
+	Future<R> res(result);
+	if (futures.empty())
+	{
+		impl::fut::setException(*result, std::make_exception_ptr(std::invalid_argument("No futures")));
+		return res;
+	}
+	std::shared_ptr<std::atomic_bool> done = std::make_shared<std::atomic_bool>(false);
+	for (size_t i = 0; i < futures.size(); ++i)
+	{
+		std::shared_ptr<impl::fut::State<T>> state = std::move(futures[i].state());
+		SEV_ASSERT(state);
+		impl::fut::State<T> *sp = state.get();
+		impl::fut::setContinuation(*sp, [result, done, state, i]() -> void {
+			if (done->exchange(true))
+				return;
+			if (state->Exception)
+				impl::fut::setException(*result, state->Exception);
+			else if constexpr (std::is_void_v<T>)
+				impl::fut::setValue(*result, i);
+			else
+				impl::fut::setValue(*result, i, std::move(*state->Value));
+		});
+	}
+	return res;
+}
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_FUTURE_H */
+
+/* end of file */
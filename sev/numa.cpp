@@ -0,0 +1,213 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "numa.h"
+
+#include <mutex>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <stdio.h>
+#endif
+
+namespace sev::impl {
+
+namespace /* anonymous */ {
+
+struct NumaLayout
+{
+	int NodeCount;
+	SEV_CpuSet NodeCpus[SEV_NUMA_NODE_MAX];
+	int8_t CpuNode[SEV_CPU_SET_MAX];
+
+};
+
+#if defined(__linux__)
+
+bool readCpuList(const char *path, SEV_CpuSet *cpus)
+{
+	// Format is "0-3,8-11"
+	FILE *f = fopen(path, "r");
+	if (!f) return false;
+	SEV_CpuSet_clear(cpus);
+	int first, last;
+	char sep;
+	while (fscanf(f, "%d", &first) == 1)
+	{
+		last = first;
+		sep = (char)fgetc(f);
+		if (sep == '-')
+		{
+			if (fscanf(f, "%d", &last) != 1) break;
+			sep = (char)fgetc(f);
+		}
+		for (int cpu = first; cpu <= last; ++cpu)
+			SEV_CpuSet_add(cpus, cpu);
+		if (sep != ',') break;
+	}
+	fclose(f);
+	return true;
+}
+
+#endif
+
+void initLayout(NumaLayout &layout)
+{
+	layout.NodeCount = 0;
+	memset(layout.CpuNode, 0, sizeof(layout.CpuNode));
+#if defined(_WIN32)
+	ULONG highest = 0;
+	if (GetNumaHighestNodeNumber(&highest))
+	{
+		for (ULONG node = 0; node <= highest && node < SEV_NUMA_NODE_MAX; ++node)
+		{
+			ULONGLONG mask = 0;
+			SEV_CpuSet_clear(&layout.NodeCpus[node]);
+			if (GetNumaNodeProcessorMask((UCHAR)node, &mask))
+			{
+				for (int cpu = 0; cpu < 64; ++cpu)
+				{
+					if ((mask >> cpu) & 1)
+					{
+						SEV_CpuSet_add(&layout.NodeCpus[node], cpu);
+						layout.CpuNode[cpu] = (int8_t)node;
+					}
+				}
+			}
+			layout.NodeCount = (int)node + 1;
+		}
+	}
+#elif defined(__linux__)
+	// Node ids may have gaps, the missing nodes are kept with no CPUs so ids can be used as indices
+	SEV_CpuSet online;
+	if (!readCpuList("/sys/devices/system/node/online", &online))
+	{
+		// Probe every id instead
+		SEV_CpuSet_clear(&online);
+		for (int node = 0; node < SEV_NUMA_NODE_MAX; ++node)
+			SEV_CpuSet_add(&online, node);
+	}
+	char path[64];
+	for (int node = 0; node < SEV_NUMA_NODE_MAX; ++node)
+	{
+		SEV_CpuSet_clear(&layout.NodeCpus[node]);
+		if (!SEV_CpuSet_contains(&online, node))
+			continue;
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%i/cpulist", node);
+		if (!readCpuList(path, &layout.NodeCpus[node]))
+			continue;
+		for (int cpu = 0; cpu < SEV_CPU_SET_MAX; ++cpu)
+			if (SEV_CpuSet_contains(&layout.NodeCpus[node], cpu))
+				layout.CpuNode[cpu] = (int8_t)node;
+		layout.NodeCount = node + 1;
+	}
+#endif
+	if (!layout.NodeCount)
+	{
+		// No NUMA information, everything is on a single node
+		SEV_CpuSet_clear(&layout.NodeCpus[0]);
+		int nbCpus = (int)std::thread::hardware_concurrency();
+		for (int cpu = 0; cpu < nbCpus; ++cpu)
+			SEV_CpuSet_add(&layout.NodeCpus[0], cpu);
+		layout.NodeCount = 1;
+	}
+}
+
+const NumaLayout &layout()
+{
+	static NumaLayout s_Layout;
+	static std::once_flag s_Once;
+	std::call_once(s_Once, []() -> void { initLayout(s_Layout); });
+	return s_Layout;
+}
+
+} /* anonymous namespace */
+
+}
+
+int SEV_Numa_nodeCount()
+{
+	return sev::impl::layout().NodeCount;
+}
+
+errno_t SEV_Numa_nodeCpus(int node, SEV_CpuSet *cpus)
+{
+	const sev::impl::NumaLayout &layout = sev::impl::layout();
+	if (node < 0 || node >= layout.NodeCount)
+		return EINVAL;
+	*cpus = layout.NodeCpus[node];
+	return 0;
+}
+
+int SEV_Numa_cpuNode(int cpu)
+{
+	if (cpu < 0 || cpu >= SEV_CPU_SET_MAX)
+		return 0;
+	return sev::impl::layout().CpuNode[cpu];
+}
+
+int SEV_Numa_currentNode()
+{
+#if defined(_WIN32)
+	return SEV_Numa_cpuNode((int)GetCurrentProcessorNumber());
+#elif defined(__linux__)
+	return SEV_Numa_cpuNode(sched_getcpu());
+#else
+	return 0;
+#endif
+}
+
+errno_t SEV_Thread_setAffinity(const SEV_CpuSet *cpus)
+{
+#if defined(_WIN32)
+	DWORD_PTR mask = 0;
+	for (int cpu = 0; cpu < (int)(sizeof(DWORD_PTR) * 8); ++cpu)
+		if (SEV_CpuSet_contains(cpus, cpu))
+			mask |= (DWORD_PTR)1 << cpu;
+	if (!mask) return EINVAL;
+	if (!SetThreadAffinityMask(GetCurrentThread(), mask))
+		return EINVAL;
+	return 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu = 0; cpu < SEV_CPU_SET_MAX && cpu < CPU_SETSIZE; ++cpu)
+		if (SEV_CpuSet_contains(cpus, cpu))
+			CPU_SET(cpu, &set);
+	if (!CPU_COUNT(&set)) return EINVAL;
+	if (sched_setaffinity(0, sizeof(set), &set))
+		return errno;
+	return 0;
+#else
+	return ENOSYS;
+#endif
+}
+
+/* end of file */
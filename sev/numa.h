@@ -0,0 +1,110 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+CPU sets, thread affinity, and NUMA node layout.
+
+On Linux the layout is read once from /sys/devices/system/node. Memory placement
+relies on the default first-touch policy, memory is placed on the node of the
+thread which first writes to it.
+
+*/
+
+#pragma once
+#ifndef SEV_NUMA_H
+#define SEV_NUMA_H
+
+#include "platform.h"
+
+#define SEV_CPU_SET_MAX 1024
+#define SEV_NUMA_NODE_MAX 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct SEV_CpuSet
+{
+	uint64_t Bits[SEV_CPU_SET_MAX / 64];
+
+};
+
+static inline void SEV_CpuSet_clear(SEV_CpuSet *cs)
+{
+	for (int i = 0; i < SEV_CPU_SET_MAX / 64; ++i)
+		cs->Bits[i] = 0;
+}
+
+static inline void SEV_CpuSet_add(SEV_CpuSet *cs, int cpu)
+{
+	if (cpu >= 0 && cpu < SEV_CPU_SET_MAX)
+		cs->Bits[cpu >> 6] |= (uint64_t)1 << (cpu & 63);
+}
+
+static inline bool SEV_CpuSet_contains(const SEV_CpuSet *cs, int cpu)
+{
+	if (cpu < 0 || cpu >= SEV_CPU_SET_MAX)
+		return false;
+	return (cs->Bits[cpu >> 6] >> (cpu & 63)) & 1;
+}
+
+static inline int SEV_CpuSet_count(const SEV_CpuSet *cs)
+{
+	int count = 0;
+	for (int i = 0; i < SEV_CPU_SET_MAX / 64; ++i)
+		for (uint64_t b = cs->Bits[i]; b; b &= b - 1)
+			++count;
+	return count;
+}
+
+SEV_LIB int SEV_Numa_nodeCount(); // At least 1, the highest node id plus one. Ids missing from the system are nodes without CPUs
+SEV_LIB errno_t SEV_Numa_nodeCpus(int node, SEV_CpuSet *cpus); // EINVAL if the node does not exist
+SEV_LIB int SEV_Numa_cpuNode(int cpu); // Returns 0 if unknown
+SEV_LIB int SEV_Numa_currentNode(); // Node of the CPU the calling thread is running on, 0 if unknown
+
+SEV_LIB errno_t SEV_Thread_setAffinity(const SEV_CpuSet *cpus); // Pins the calling thread to a set of CPUs
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#ifdef __cplusplus
+
+namespace sev {
+
+typedef SEV_CpuSet CpuSet;
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_NUMA_H */
+
+/* end of file */
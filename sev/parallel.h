@@ -0,0 +1,379 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Data-parallel kernels on the event loops. The index range is split into
+chunks of grain indices, which the participating threads claim from a
+shared counter, so there is one atomic operation per chunk rather than per
+index. A grain of 0 picks one that gives each thread a few chunks.
+
+parallelFor blocks until all indices are done. When called from a thread
+running the same loop, the calling thread claims chunks as well, so it does
+not deadlock a loop with a single thread. parallelForAsync returns
+immediately with a future, chain a callback onto it with then.
+
+The first exception thrown by the kernel stops the remaining chunks from
+running, and is rethrown by parallelFor or set on the future.
+
+parallelReduce and parallelInclusiveScan keep one cache line padded partial
+per chunk, which are combined in chunk order, so the operation only needs to
+be associative. The scan makes two passes over the chunks, first reducing
+each chunk, then scanning each chunk again starting from the combined
+partials of the chunks before it.
+
+*/
+
+#pragma once
+#ifndef SEV_PARALLEL_H
+#define SEV_PARALLEL_H
+
+#include "platform.h"
+#include "event_loop.h"
+#include "future.h"
+
+#ifdef __cplusplus
+
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include <optional>
+#include <iterator>
+
+namespace sev {
+
+namespace impl::par {
+
+constexpr ptrdiff_t c_ChunksPerThread = 4;
+
+struct alignas(64) Range
+{
+	Range(ptrdiff_t from, ptrdiff_t to, ptrdiff_t grain) : From(from), To(to), Grain(grain), Next(from), Remaining(to - from), Failed(false)
+	{
+	}
+
+	const ptrdiff_t From;
+	const ptrdiff_t To;
+	const ptrdiff_t Grain;
+
+	alignas(64) std::atomic_ptrdiff_t Next;
+	alignas(64) std::atomic_ptrdiff_t Remaining; // Indices not yet done
+
+	std::atomic_bool Failed;
+	AtomicMutex ExceptionMutex;
+	std::exception_ptr Exception;
+	Promise<void> Done;
+
+	void fail(std::exception_ptr ex) noexcept
+	{
+		std::unique_lock<AtomicMutex> lock(ExceptionMutex);
+		if (!Exception) Exception = std::move(ex);
+		Failed.store(true, std::memory_order_relaxed);
+	}
+
+	// Claim and run chunks until none are left, f is called with [begin, end) and the chunk's index
+	template<typename TFn>
+	void run(TFn &f) noexcept
+	{
+		for (;;)
+		{
+			const ptrdiff_t begin = Next.fetch_add(Grain, std::memory_order_relaxed);
+			if (begin >= To)
+				return;
+			const ptrdiff_t end = std::min(begin + Grain, To);
+			if (!Failed.load(std::memory_order_relaxed))
+			{
+				try
+				{
+					f(begin, end, (begin - From) / Grain);
+				}
+				catch (...)
+				{
+					fail(std::current_exception());
+				}
+			}
+			if (Remaining.fetch_sub(end - begin, std::memory_order_acq_rel) == end - begin)
+				finish();
+		}
+	}
+
+	// Prepare the range for another pass over the same chunks
+	void reset()
+	{
+		Next = From;
+		Remaining = To - From;
+		Done = Promise<void>();
+	}
+
+	ptrdiff_t chunks() const noexcept
+	{
+		return To > From ? (To - From + Grain - 1) / Grain : 0;
+	}
+
+	void finish() noexcept
+	{
+		try
+		{
+			if (Exception) Done.setException(Exception);
+			else Done.setValue();
+		}
+		catch (...)
+		{
+			// Already satisfied
+		}
+	}
+
+};
+
+inline ptrdiff_t grainFor(EventLoop &el, ptrdiff_t count, ptrdiff_t grain) noexcept
+{
+	if (grain > 0)
+		return grain;
+	const ptrdiff_t threads = std::max(SEV_EventLoop_threads(&el), 1);
+	const ptrdiff_t chunks = threads * c_ChunksPerThread;
+	return std::max<ptrdiff_t>((count + chunks - 1) / chunks, 1);
+}
+
+// Post helpers to the loop which run the chunks of the range, and let the calling thread join in when it is running the loop.
+// TState derives from Range, and is callable as `void(ptrdiff_t begin, ptrdiff_t end, ptrdiff_t chunk)`
+template<typename TState>
+Future<void> start(EventLoop &el, const std::shared_ptr<TState> &state, bool participate)
+{
+	Future<void> done = state->Done.future();
+	const ptrdiff_t chunks = state->chunks();
+	if (!chunks)
+	{
+		state->finish();
+		return done;
+	}
+	const bool caller = participate && SEV_EventLoop_current() == &el;
+	const ptrdiff_t threads = std::max(SEV_EventLoop_threads(&el), 1);
+	const ptrdiff_t helpers = std::min(threads, chunks) - (caller ? 1 : 0);
+	ptrdiff_t posted = 0;
+	for (ptrdiff_t i = 0; i < helpers; ++i)
+	{
+		errno_t eno = post(el, [state](EventLoop &) -> errno_t {
+			state->run(*state);
+			return 0;
+		});
+		if (eno)
+		{
+			if (!posted && !caller)
+				ExceptionHandle::rethrow(eno);
+			break; // Fewer helpers, the others claim their chunks
+		}
+		++posted;
+	}
+	if (caller)
+		state->run(*state);
+	return done;
+}
+
+template<typename TFn>
+struct ForState : Range
+{
+	ForState(ptrdiff_t from, ptrdiff_t to, ptrdiff_t grain, TFn &&f) : Range(from, to, grain), F(std::forward<TFn>(f))
+	{
+	}
+
+	void operator()(ptrdiff_t begin, ptrdiff_t end, ptrdiff_t)
+	{
+		for (ptrdiff_t i = begin; i < end; ++i)
+			F(i);
+	}
+
+	std::decay_t<TFn> F;
+
+};
+
+template<typename T>
+struct alignas(64) Partial
+{
+	T Value;
+
+};
+
+template<typename TIt, typename T, typename TOp>
+struct ReduceState : Range
+{
+	ReduceState(TIt first, ptrdiff_t count, ptrdiff_t grain, T &&identity, TOp &&op) : Range(0, count, grain), First(first), Identity(std::move(identity)), Op(std::forward<TOp>(op))
+	{
+		Partials.resize(chunks(), Partial<T>{ Identity });
+	}
+
+	void operator()(ptrdiff_t begin, ptrdiff_t end, ptrdiff_t chunk)
+	{
+		T acc = Identity;
+		for (ptrdiff_t i = begin; i < end; ++i)
+			acc = Op(std::move(acc), First[i]);
+		Partials[chunk].Value = std::move(acc);
+	}
+
+	T combine()
+	{
+		if (Exception)
+			std::rethrow_exception(Exception);
+		T acc = Identity;
+		for (Partial<T> &partial : Partials)
+			acc = Op(std::move(acc), std::move(partial.Value));
+		return acc;
+	}
+
+	const TIt First;
+	const T Identity;
+	std::decay_t<TOp> Op;
+	std::vector<Partial<T>> Partials;
+
+};
+
+template<typename TIn, typename TOut, typename TOp>
+struct ScanState : Range
+{
+	using T = typename std::iterator_traits<TIn>::value_type;
+
+	ScanState(TIn first, TOut out, ptrdiff_t count, ptrdiff_t grain, TOp &&op) : Range(0, count, grain), First(first), Out(out), Op(std::forward<TOp>(op)), Scanning(false)
+	{
+		Partials.resize(chunks());
+	}
+
+	void operator()(ptrdiff_t begin, ptrdiff_t end, ptrdiff_t chunk)
+	{
+		if (!Scanning)
+		{
+			// First pass, reduce the chunk
+			T acc = First[begin];
+			for (ptrdiff_t i = begin + 1; i < end; ++i)
+				acc = Op(std::move(acc), First[i]);
+			Partials[chunk].Value.emplace(std::move(acc));
+		}
+		else
+		{
+			// Second pass, scan the chunk starting from the combined chunks before it
+			std::optional<T> &carry = Partials[chunk].Value;
+			T acc = carry ? Op(*carry, First[begin]) : T(First[begin]);
+			Out[begin] = acc;
+			for (ptrdiff_t i = begin + 1; i < end; ++i)
+			{
+				acc = Op(std::move(acc), First[i]);
+				Out[i] = acc;
+			}
+		}
+	}
+
+	// Replace each chunk's sum with the combined sums of the chunks before it
+	void carry()
+	{
+		std::optional<T> acc;
+		for (Partial<std::optional<T>> &partial : Partials)
+		{
+			std::optional<T> sum = std::move(partial.Value);
+			partial.Value = acc;
+			acc.emplace(acc ? Op(std::move(*acc), std::move(*sum)) : std::move(*sum));
+		}
+		Scanning = true;
+	}
+
+	const TIn First;
+	const TOut Out;
+	std::decay_t<TOp> Op;
+	std::vector<Partial<std::optional<T>>> Partials;
+	bool Scanning; // Set between the passes, while no chunks are running
+
+};
+
+}
+
+//! Run the kernel `void(ptrdiff_t i)` for each index in [from, to) on the loop, and return a future that is set when all are done
+template<typename TFn>
+Future<void> parallelForAsync(EventLoop &el, ptrdiff_t from, ptrdiff_t to, TFn &&f, ptrdiff_t grain = 0)
+{
+	using TState = impl::par::ForState<TFn>;
+	std::shared_ptr<TState> state = std::make_shared<TState>(from, to, impl::par::grainFor(el, to - from, grain), std::forward<TFn>(f));
+	return impl::par::start(el, state, false);
+}
+
+//! Run the kernel `void(ptrdiff_t i)` for each index in [from, to) on the loop, and block until all are done.
+//! The calling thread takes part when it is running the loop
+template<typename TFn>
+void parallelFor(EventLoop &el, ptrdiff_t from, ptrdiff_t to, TFn &&f, ptrdiff_t grain = 0)
+{
+	using TState = impl::par::ForState<TFn>;
+	std::shared_ptr<TState> state = std::make_shared<TState>(from, to, impl::par::grainFor(el, to - from, grain), std::forward<TFn>(f));
+	impl::par::start(el, state, true).get(); // Only waits for chunks claimed by other threads
+}
+
+//! Reduce [first, last) with `T op(T acc, T value)`, which must be associative. Identity is the starting value of each chunk.
+//! The calling thread takes part when it is running the loop
+template<typename TIt, typename T, typename TOp>
+T parallelReduce(EventLoop &el, TIt first, TIt last, T identity, TOp &&op, ptrdiff_t grain = 0)
+{
+	using TState = impl::par::ReduceState<TIt, T, TOp>;
+	const ptrdiff_t count = last - first;
+	std::shared_ptr<TState> state = std::make_shared<TState>(first, count, impl::par::grainFor(el, count, grain), std::move(identity), std::forward<TOp>(op));
+	impl::par::start(el, state, true).get();
+	return state->combine();
+}
+
+//! Reduce [first, last) with `T op(T acc, T value)` on the loop, and return a future for the result. The range must remain valid until it is set
+template<typename TIt, typename T, typename TOp>
+Future<T> parallelReduceAsync(EventLoop &el, TIt first, TIt last, T identity, TOp &&op, ptrdiff_t grain = 0)
+{
+	using TState = impl::par::ReduceState<TIt, T, TOp>;
+	const ptrdiff_t count = last - first;
+	std::shared_ptr<TState> state = std::make_shared<TState>(first, count, impl::par::grainFor(el, count, grain), std::move(identity), std::forward<TOp>(op));
+	return impl::par::start(el, state, false).then(el, [state]() -> T {
+		return state->combine();
+	});
+}
+
+//! Write the inclusive scan of [first, last) with the associative `T op(T acc, T value)` to out, which may be first. Returns the end of the output.
+//! The calling thread takes part when it is running the loop
+template<typename TIn, typename TOut, typename TOp>
+TOut parallelInclusiveScan(EventLoop &el, TIn first, TIn last, TOut out, TOp &&op, ptrdiff_t grain = 0)
+{
+	using TState = impl::par::ScanState<TIn, TOut, TOp>;
+	const ptrdiff_t count = last - first;
+	std::shared_ptr<TState> state = std::make_shared<TState>(first, out, count, impl::par::grainFor(el, count, grain), std::forward<TOp>(op));
+	impl::par::start(el, state, true).get();
+	if (state->chunks())
+	{
+		state->carry();
+		state->reset();
+		impl::par::start(el, state, true).get();
+	}
+	return out + count;
+}
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_PARALLEL_H */
+
+/* end of file */
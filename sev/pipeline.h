@@ -0,0 +1,527 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Pipeline, a chain of stages bound to loops or strands, connected by bounded
+queues with backpressure.
+
+Each stage has a fixed ring of inputs. A stage reserves a slot in the next
+stage before taking an input, and when the next stage is full it stops,
+and is resumed by the next stage once that one frees a slot. Slowness
+downstream thus stops the stages upstream one after another, up to the
+source, instead of buffering without bound. A pulled source stops pulling,
+and pushing into a full pipeline fails with EAGAIN.
+
+A stage on a loop runs up to its concurrency of workers at once, which
+reorders items when above one. A stage on a strand is also serialized with
+everything else on that strand. Workers process a batch of items before
+yielding the loop thread.
+
+Items still queued when the pipeline is destroyed are still processed.
+
+*/
+
+#pragma once
+#ifndef SEV_PIPELINE_H
+#define SEV_PIPELINE_H
+
+#include "platform.h"
+#include "atomic_mutex.h"
+#include "event_loop.h"
+#include "strand.h"
+
+#ifdef __cplusplus
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace sev {
+
+struct PipelineStageStats
+{
+	uint64_t Processed;
+	uint64_t Stalls; // Times the stage stopped because the next stage was full
+	ptrdiff_t Queued;
+
+};
+
+namespace impl::pl {
+
+constexpr int c_Batch = 64;
+
+template<typename TFn>
+errno_t postTo(EventLoop &el, TFn &&f) noexcept
+{
+	return sev::post(el, std::forward<TFn>(f));
+}
+
+template<typename TFn>
+errno_t postTo(Strand &strand, TFn &&f) noexcept
+{
+	return strand.post(std::forward<TFn>(f));
+}
+
+struct Graph;
+
+struct StageBase
+{
+	StageBase(Graph *graph, int concurrency) : Owner(graph), Concurrency(concurrency)
+	{
+	}
+
+	virtual ~StageBase() = default;
+
+	// The next stage has space again
+	virtual void resume() noexcept = 0;
+
+	// Start pulling, sources only
+	virtual void start() noexcept
+	{
+	}
+
+	virtual ptrdiff_t queued() noexcept = 0;
+
+	Graph *const Owner;
+	StageBase *Upstream = null;
+	const int Concurrency;
+
+	AtomicMutex Mutex;
+	int Workers = 0; // Guarded by Mutex
+	bool Blocked = false; // Waiting for space in the next stage, guarded by Mutex
+	bool UpstreamBlocked = false; // The previous stage waits for space here, guarded by Mutex
+
+	std::atomic_uint64_t Processed{ 0 };
+	std::atomic_uint64_t Stalls{ 0 };
+
+};
+
+struct Graph : std::enable_shared_from_this<Graph>
+{
+	std::vector<std::unique_ptr<StageBase>> Stages; // In pipeline order, workers keep the graph alive
+
+};
+
+template<typename T>
+struct Input
+{
+	// Reserve a slot, false when full, in which case the calling stage is resumed once a slot frees. Call with the calling stage's Mutex locked
+	virtual bool reserve() noexcept = 0;
+
+	// Give back a reserved slot
+	virtual void cancel() noexcept = 0;
+
+	// Fill a reserved slot
+	virtual void push(T &&v) noexcept = 0;
+
+};
+
+template<typename TIn, typename TOut, typename TFn, typename TExec>
+struct Stage : StageBase, Input<TIn>
+{
+	static_assert(std::is_nothrow_move_constructible_v<TIn>, "Items are moved into reserved slots, which cannot fail");
+
+	Stage(Graph *graph, TExec &exec, TFn &&fn, ptrdiff_t capacity, int concurrency) : StageBase(graph, concurrency), Exec(exec), Fn(std::move(fn)), Items(capacity), Capacity(capacity)
+	{
+	}
+
+	TExec &Exec;
+	TFn Fn;
+	std::conditional_t<std::is_void_v<TOut>, void, Input<std::conditional_t<std::is_void_v<TOut>, int, TOut>>> *Next = null;
+
+	std::vector<std::optional<TIn>> Items; // Ring, guarded by Mutex
+	const ptrdiff_t Capacity;
+	ptrdiff_t Head = 0;
+	ptrdiff_t Size = 0;
+	ptrdiff_t Reserved = 0;
+
+	bool reserve() noexcept override
+	{
+		std::unique_lock<AtomicMutex> lock(Mutex);
+		if (Size + Reserved >= Capacity)
+		{
+			UpstreamBlocked = true;
+			return false;
+		}
+		++Reserved;
+		return true;
+	}
+
+	void cancel() noexcept override
+	{
+		bool freed;
+		{
+			std::unique_lock<AtomicMutex> lock(Mutex);
+			--Reserved;
+			freed = UpstreamBlocked;
+			UpstreamBlocked = false;
+		}
+		if (freed && Upstream)
+			Upstream->resume();
+	}
+
+	void push(TIn &&v) noexcept override
+	{
+		bool start = false;
+		{
+			std::unique_lock<AtomicMutex> lock(Mutex);
+			--Reserved;
+			Items[(Head + Size) % Capacity].emplace(std::move(v));
+			++Size;
+			if (!Blocked && Workers < Concurrency)
+			{
+				++Workers;
+				start = true;
+			}
+		}
+		if (start)
+			schedule();
+	}
+
+	void resume() noexcept override
+	{
+		ptrdiff_t start;
+		{
+			std::unique_lock<AtomicMutex> lock(Mutex);
+			if (!Blocked)
+				return;
+			Blocked = false;
+			start = std::min((ptrdiff_t)(Concurrency - Workers), Size);
+			Workers += (int)start;
+		}
+		while (start--)
+			schedule();
+	}
+
+	ptrdiff_t queued() noexcept override
+	{
+		std::unique_lock<AtomicMutex> lock(Mutex);
+		return Size;
+	}
+
+	// Start a worker, which is already counted in Workers
+	void schedule() noexcept
+	{
+		std::shared_ptr<Graph> graph = Owner->shared_from_this();
+		errno_t eno = postTo(Exec, [this, graph](EventLoop &el) -> errno_t {
+			drain();
+			return 0;
+		});
+		if (eno)
+		{
+			// The next push or resume retries, the items stay queued
+			std::unique_lock<AtomicMutex> lock(Mutex);
+			--Workers;
+		}
+	}
+
+	void drain()
+	{
+		for (int i = 0; i < c_Batch; ++i)
+		{
+			std::optional<TIn> item;
+			bool freed;
+			{
+				std::unique_lock<AtomicMutex> lock(Mutex);
+				if (!Size)
+				{
+					--Workers;
+					return;
+				}
+				if constexpr (!std::is_void_v<TOut>)
+				{
+					if (!Next->reserve())
+					{
+						Blocked = true;
+						--Workers;
+						++Stalls;
+						return;
+					}
+				}
+				item.emplace(std::move(*Items[Head]));
+				Items[Head].reset();
+				Head = (Head + 1) % Capacity;
+				--Size;
+				freed = UpstreamBlocked;
+				UpstreamBlocked = false;
+			}
+			if (freed && Upstream)
+				Upstream->resume();
+			try
+			{
+				if constexpr (std::is_void_v<TOut>)
+				{
+					Fn(std::move(*item));
+				}
+				else
+				{
+					bool pushed = false;
+					auto fin = gsl::finally([&]() -> void {
+						if (!pushed) Next->cancel();
+					});
+					TOut out = Fn(std::move(*item));
+					pushed = true;
+					Next->push(std::move(out));
+				}
+			}
+			catch (...)
+			{
+				schedule(); // Continue with the next items, the error goes to the loop
+				throw;
+			}
+			++Processed;
+		}
+		schedule(); // Yield the loop thread, keeping the worker
+	}
+
+};
+
+template<typename TOut, typename TFn, typename TExec>
+struct Source : StageBase
+{
+	Source(Graph *graph, TExec &exec, TFn &&fn) : StageBase(graph, 1), Exec(exec), Fn(std::move(fn))
+	{
+	}
+
+	TExec &Exec;
+	TFn Fn; // std::optional<TOut>(), empty when done
+	Input<TOut> *Next = null;
+	bool Finished = true; // Not pulling until started, guarded by Mutex
+
+	void start() noexcept override
+	{
+		{
+			std::unique_lock<AtomicMutex> lock(Mutex);
+			if (Workers)
+				return;
+			Finished = false;
+			Blocked = false;
+			++Workers;
+		}
+		schedule();
+	}
+
+	void resume() noexcept override
+	{
+		{
+			std::unique_lock<AtomicMutex> lock(Mutex);
+			if (!Blocked || Finished)
+				return;
+			Blocked = false;
+			++Workers;
+		}
+		schedule();
+	}
+
+	ptrdiff_t queued() noexcept override
+	{
+		return 0;
+	}
+
+	void schedule() noexcept
+	{
+		std::shared_ptr<Graph> graph = Owner->shared_from_this();
+		errno_t eno = postTo(Exec, [this, graph](EventLoop &el) -> errno_t {
+			drain();
+			return 0;
+		});
+		if (eno)
+		{
+			// Start retries
+			std::unique_lock<AtomicMutex> lock(Mutex);
+			--Workers;
+		}
+	}
+
+	void drain()
+	{
+		for (int i = 0; i < c_Batch; ++i)
+		{
+			{
+				std::unique_lock<AtomicMutex> lock(Mutex);
+				if (!Next->reserve())
+				{
+					Blocked = true;
+					--Workers;
+					++Stalls;
+					return;
+				}
+			}
+			std::optional<TOut> v;
+			try
+			{
+				v = Fn();
+			}
+			catch (...)
+			{
+				Next->cancel();
+				schedule();
+				throw;
+			}
+			if (!v)
+			{
+				Next->cancel();
+				std::unique_lock<AtomicMutex> lock(Mutex);
+				Finished = true;
+				--Workers;
+				return;
+			}
+			Next->push(std::move(*v));
+			++Processed;
+		}
+		schedule();
+	}
+
+};
+
+}
+
+template<typename TIn>
+class Pipeline
+{
+public:
+	Pipeline(std::shared_ptr<impl::pl::Graph> &&graph, void *first) : m_Graph(std::move(graph)), m_First(first)
+	{
+	}
+
+	//! Push an item into the first stage, EAGAIN when it is full
+	template<typename T = TIn, typename = std::enable_if_t<!std::is_void_v<T>>>
+	errno_t push(T value) noexcept
+	{
+		impl::pl::Input<T> *first = (impl::pl::Input<T> *)m_First;
+		if (!first->reserve())
+			return EAGAIN;
+		first->push(std::move(value));
+		return 0;
+	}
+
+	//! Start pulling from the source, and again after it returned empty
+	template<typename T = TIn, typename = std::enable_if_t<std::is_void_v<T>>>
+	void start() noexcept
+	{
+		((impl::pl::StageBase *)m_First)->start();
+	}
+
+	int stages() const noexcept
+	{
+		return (int)m_Graph->Stages.size();
+	}
+
+	//! Counters of a stage, the source is stage 0 when pulling
+	PipelineStageStats stats(int stage) const noexcept
+	{
+		impl::pl::StageBase *s = m_Graph->Stages[stage].get();
+		return PipelineStageStats{ s->Processed, s->Stalls, s->queued() };
+	}
+
+private:
+	std::shared_ptr<impl::pl::Graph> m_Graph;
+	void *m_First; // Input<TIn> when pushing, the source stage when pulling
+
+};
+
+template<typename TIn, typename TLast>
+class PipelineBuilder
+{
+public:
+	PipelineBuilder(std::shared_ptr<impl::pl::Graph> &&graph, void *first, impl::pl::StageBase *last, impl::pl::Input<TLast> **tail)
+		: m_Graph(std::move(graph)), m_First(first), m_Last(last), m_Tail(tail)
+	{
+	}
+
+	//! Add a stage `TOut(TLast &&item)` on a loop or strand, with room for capacity items, and up to concurrency items at once
+	template<typename TExec, typename TFn>
+	auto stage(TExec &exec, TFn &&fn, ptrdiff_t capacity = 64, int concurrency = 1) &&
+	{
+		typedef std::decay_t<std::invoke_result_t<std::decay_t<TFn> &, TLast &&>> TOut;
+		auto *s = add<impl::pl::Stage<TLast, TOut, std::decay_t<TFn>, TExec>>(exec, std::forward<TFn>(fn), capacity, concurrency);
+		return PipelineBuilder<TIn, TOut>(std::move(m_Graph), m_First, s, &s->Next);
+	}
+
+	//! Add the last stage `void(TLast &&item)`, and finish the pipeline
+	template<typename TExec, typename TFn>
+	Pipeline<TIn> sink(TExec &exec, TFn &&fn, ptrdiff_t capacity = 64, int concurrency = 1) &&
+	{
+		add<impl::pl::Stage<TLast, void, std::decay_t<TFn>, TExec>>(exec, std::forward<TFn>(fn), capacity, concurrency);
+		return Pipeline<TIn>(std::move(m_Graph), m_First);
+	}
+
+private:
+	std::shared_ptr<impl::pl::Graph> m_Graph;
+	void *m_First;
+	impl::pl::StageBase *m_Last;
+	impl::pl::Input<TLast> **m_Tail;
+
+	template<typename TStage, typename TExec, typename TFn>
+	TStage *add(TExec &exec, TFn &&fn, ptrdiff_t capacity, int concurrency)
+	{
+		std::unique_ptr<TStage> s = std::make_unique<TStage>(m_Graph.get(), exec, std::decay_t<TFn>(std::forward<TFn>(fn)), std::max(capacity, (ptrdiff_t)1), std::max(concurrency, 1));
+		TStage *res = s.get();
+		m_Graph->Stages.push_back(std::move(s));
+		res->Upstream = m_Last;
+		if (m_Tail)
+			*m_Tail = res;
+		else
+			m_First = static_cast<impl::pl::Input<TLast> *>(res);
+		return res;
+	}
+
+};
+
+//! Start a pipeline which items are pushed into
+template<typename T>
+PipelineBuilder<T, T> makePipeline()
+{
+	return PipelineBuilder<T, T>(std::make_shared<impl::pl::Graph>(), null, null, null);
+}
+
+//! Start a pipeline pulling from a source `std::optional<T>()` on a loop or strand, which returns empty when done
+template<typename TExec, typename TFn>
+auto makePipeline(TExec &exec, TFn &&pull)
+{
+	typedef typename std::decay_t<std::invoke_result_t<std::decay_t<TFn> &>>::value_type TOut;
+	typedef impl::pl::Source<TOut, std::decay_t<TFn>, TExec> TSource;
+	std::shared_ptr<impl::pl::Graph> graph = std::make_shared<impl::pl::Graph>();
+	std::unique_ptr<TSource> source = std::make_unique<TSource>(graph.get(), exec, std::decay_t<TFn>(std::forward<TFn>(pull)));
+	TSource *s = source.get();
+	graph->Stages.push_back(std::move(source));
+	return PipelineBuilder<void, TOut>(std::move(graph), static_cast<impl::pl::StageBase *>(s), s, &s->Next);
+}
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_PIPELINE_H */
+
+/* end of file */
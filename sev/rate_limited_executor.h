@@ -0,0 +1,255 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Rate limited executor, admits functors to a loop according to a token
+bucket, to protect downstream services without sleeping in handlers.
+
+Tokens refill continuously at the rate, up to the burst size. A functor
+posted while a token is available and nothing is waiting goes to the loop
+right away. Otherwise it waits in a bounded list, and a single timeout on
+the loop's timer thread admits waiting functors as tokens refill, so no
+thread polls or blocks for tokens. When the list is full, a post either
+fails with EAGAIN, or drops the oldest waiting functor without running it.
+
+Functors still waiting when the executor is destroyed will still run.
+
+*/
+
+#pragma once
+#ifndef SEV_RATE_LIMITED_EXECUTOR_H
+#define SEV_RATE_LIMITED_EXECUTOR_H
+
+#include "platform.h"
+#include "atomic_mutex.h"
+#include "event_loop.h"
+
+#ifdef __cplusplus
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace sev {
+
+enum class RateLimitOverflow
+{
+	Reject, // Fail the post with EAGAIN
+	DropOldest, // Drop the functor that has waited longest
+
+};
+
+namespace impl::rl {
+
+constexpr double c_MinRate = 0.001; // Keeps the delay until the next token within the range of the timer
+
+struct State : std::enable_shared_from_this<State>
+{
+	State(EventLoop &el, double rate, int burst, ptrdiff_t maxPending, RateLimitOverflow overflow) : Loop(el), Rate(rate >= c_MinRate ? rate : c_MinRate), Burst(std::max(burst, 1)), MaxPending(std::max(maxPending, (ptrdiff_t)0)), Overflow(overflow),
+		Tokens(Burst), Refilled(std::chrono::steady_clock::now()), TimerArmed(false), Dropped(0)
+	{
+
+	}
+
+	EventLoop &Loop;
+	const double Rate; // Tokens per second
+	const double Burst;
+	const ptrdiff_t MaxPending;
+	const RateLimitOverflow Overflow;
+
+	AtomicMutex Mutex;
+	double Tokens; // Guarded by Mutex
+	std::chrono::steady_clock::time_point Refilled; // Guarded by Mutex
+	std::deque<EventFunctor> Pending; // Guarded by Mutex
+	bool TimerArmed; // Guarded by Mutex
+	std::atomic_uint64_t Dropped;
+
+	// Call with Mutex locked
+	void refill() noexcept
+	{
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		Tokens = std::min(Burst, Tokens + std::chrono::duration<double>(now - Refilled).count() * Rate);
+		Refilled = now;
+	}
+
+	// Time until the next token, call with Mutex locked
+	int delayMs() const noexcept
+	{
+		return std::max(1, (int)std::ceil((1.0 - Tokens) * 1000.0 / Rate));
+	}
+
+	errno_t post(EventFunctor &&f)
+	{
+		std::optional<EventFunctor> dropped; // Destroyed outside the lock
+		bool admit = false;
+		int delay = 0;
+		{
+			std::unique_lock<AtomicMutex> lock(Mutex);
+			refill();
+			if (Pending.empty() && Tokens >= 1.0)
+			{
+				Tokens -= 1.0;
+				admit = true;
+			}
+			else
+			{
+				if ((ptrdiff_t)Pending.size() >= MaxPending)
+				{
+					if (Overflow == RateLimitOverflow::Reject)
+						return EAGAIN;
+					if (Pending.empty())
+					{
+						++Dropped; // No waiting allowed, the new functor is the oldest
+						return 0;
+					}
+					dropped.emplace(std::move(Pending.front()));
+					Pending.pop_front();
+					++Dropped;
+				}
+				Pending.push_back(std::move(f));
+				if (!TimerArmed)
+				{
+					TimerArmed = true;
+					delay = delayMs();
+				}
+			}
+		}
+		if (admit)
+			return sev::post(Loop, std::move(f));
+		return delay ? arm(delay) : 0;
+	}
+
+	errno_t arm(int delay) noexcept
+	{
+		std::shared_ptr<State> self = shared_from_this();
+		errno_t eno = sev::timeout(Loop, [self](EventLoop &el) -> errno_t {
+			return self->drain();
+		}, delay);
+		if (eno)
+		{
+			// The next post retries, the functors stay waiting
+			std::unique_lock<AtomicMutex> lock(Mutex);
+			TimerArmed = false;
+		}
+		return eno;
+	}
+
+	errno_t drain() noexcept
+	{
+		errno_t eno = 0;
+		for (;;)
+		{
+			std::optional<EventFunctor> f;
+			int delay = 0;
+			{
+				std::unique_lock<AtomicMutex> lock(Mutex);
+				refill();
+				if (Pending.empty())
+				{
+					TimerArmed = false;
+					return eno;
+				}
+				if (Tokens < 1.0)
+					delay = delayMs();
+				else
+				{
+					Tokens -= 1.0;
+					f.emplace(std::move(Pending.front()));
+					Pending.pop_front();
+				}
+			}
+			if (delay)
+			{
+				errno_t res = arm(delay);
+				return eno ? eno : res;
+			}
+			errno_t res = sev::post(Loop, std::move(*f));
+			if (!eno) eno = res;
+		}
+	}
+
+};
+
+}
+
+class RateLimitedExecutor
+{
+public:
+	//! Rate is in functors per second, and burst is the number of functors admitted at once after being idle. At most maxPending functors wait for tokens, with 0 a post only succeeds while a token is available.
+	//! Out of range arguments are clamped, rate to c_MinRate, burst to 1, and maxPending to 0
+	RateLimitedExecutor(EventLoop &el, double rate, int burst, ptrdiff_t maxPending = 1024, RateLimitOverflow overflow = RateLimitOverflow::Reject)
+		: m_State(std::make_shared<impl::rl::State>(el, rate, burst, maxPending, overflow))
+	{
+	}
+
+	RateLimitedExecutor(const RateLimitedExecutor &other) = delete;
+	RateLimitedExecutor &operator=(const RateLimitedExecutor &other) = delete;
+
+	EventLoop &loop() const noexcept
+	{
+		return m_State->Loop;
+	}
+
+	//! Post a functor `errno_t(EventLoop &el)` to the loop once a token is available. EAGAIN when too many functors are waiting and overflow is Reject
+	template<typename TFn>
+	errno_t post(TFn &&f) noexcept
+	{
+		try
+		{
+			return m_State->post(makeEventFunctor(std::forward<TFn>(f)));
+		}
+		catch (std::bad_alloc)
+		{
+			return ENOMEM;
+		}
+	}
+
+	//! Number of functors dropped by DropOldest
+	uint64_t dropped() const noexcept
+	{
+		return m_State->Dropped;
+	}
+
+private:
+	std::shared_ptr<impl::rl::State> m_State;
+
+};
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_RATE_LIMITED_EXECUTOR_H */
+
+/* end of file */
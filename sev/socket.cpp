@@ -0,0 +1,790 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "socket.h"
+
+#if defined(__linux__)
+
+#include <mutex>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+static_assert(sizeof(SEV_SocketAddress::Data) >= sizeof(sockaddr_storage));
+
+namespace sev::impl::sock {
+
+constexpr int c_AcceptBatch = 64; // Connections accepted per readiness event
+constexpr int c_ReadBatch = 16; // Reads per readiness event, so one busy stream doesn't hold a thread forever
+constexpr ptrdiff_t c_ReadBufferSize = 64 * 1024;
+constexpr int c_MaxIov = 64;
+constexpr int c_UdpBatch = 32;
+constexpr int c_UdpRounds = 4;
+constexpr int c_AcceptBackoffMs = 100; // Accepting pauses this long when out of fds
+
+}
+
+struct SEV_TcpAcceptor : std::enable_shared_from_this<SEV_TcpAcceptor>
+{
+	SEV_TcpAcceptor(SEV_EventLoop *el, int fd, sev::AcceptFunctor &&f) : Loop(el), Fd(fd), F(std::move(f))
+	{
+	}
+
+	~SEV_TcpAcceptor()
+	{
+		close(Fd);
+	}
+
+	errno_t ready(sev::EventLoop &el, uint32_t events);
+	void pause();
+
+	SEV_EventLoop *const Loop;
+	const int Fd;
+	sev::AcceptFunctor F;
+	std::atomic_bool Closed{ false };
+	std::shared_ptr<SEV_TcpAcceptor> Self; // Released by destroy, the fd watch holds another reference
+
+};
+
+struct SEV_TcpStream
+{
+	SEV_TcpStream(SEV_EventLoop *el, int fd, sev::TcpStreamFunctor &&f) : Loop(el), Fd(fd), F(std::move(f))
+	{
+	}
+
+	~SEV_TcpStream()
+	{
+		close(Fd);
+	}
+
+	errno_t ready(sev::EventLoop &el, uint32_t events);
+	errno_t flush(bool &drained);
+	errno_t closeWith(sev::EventLoop &el, errno_t eno);
+	errno_t writev(const SEV_SocketBuffer *buffers, int count);
+
+	bool closed()
+	{
+		std::unique_lock<std::mutex> lock(WriteMutex);
+		return Closed;
+	}
+
+	SEV_EventLoop *const Loop;
+	const int Fd;
+	sev::TcpStreamFunctor F;
+	std::shared_ptr<SEV_TcpStream> Self; // Released by destroy, the fd watch holds another reference
+	std::unique_ptr<uint8_t[]> ReadBuffer;
+
+	std::mutex WriteMutex;
+	std::deque<std::vector<uint8_t>> WriteQueue;
+	size_t WriteOffset = 0; // Into the first chunk
+	size_t Pending = 0;
+	bool Connecting = false;
+	bool WantWrite = false; // Watching for writability
+	bool Closed = false;
+
+};
+
+struct SEV_UdpEndpoint
+{
+	SEV_UdpEndpoint(SEV_EventLoop *el, int fd, int maxDatagramSize, sev::UdpFunctor &&f) : Loop(el), Fd(fd), MaxDatagramSize(maxDatagramSize), F(std::move(f))
+	{
+	}
+
+	~SEV_UdpEndpoint()
+	{
+		close(Fd);
+	}
+
+	errno_t ready(sev::EventLoop &el, uint32_t events);
+
+	SEV_EventLoop *const Loop;
+	const int Fd;
+	const int MaxDatagramSize;
+	sev::UdpFunctor F;
+	std::atomic_bool Closed{ false };
+	std::shared_ptr<SEV_UdpEndpoint> Self; // Released by destroy, the fd watch holds another reference
+
+	// Receive batch, only used by the readiness functor
+	std::unique_ptr<uint8_t[]> Buffers;
+	SEV_Datagram Datagrams[sev::impl::sock::c_UdpBatch];
+	mmsghdr Msgs[sev::impl::sock::c_UdpBatch];
+	iovec Iov[sev::impl::sock::c_UdpBatch];
+
+};
+
+namespace sev::impl::sock {
+
+namespace /* anonymous */ {
+
+template<class T>
+errno_t watch(const std::shared_ptr<T> &socket, uint32_t events)
+{
+	auto ready = [socket](sev::EventLoop &el, int fd, uint32_t events) -> errno_t {
+		return socket->ready(el, events);
+	};
+	sev::FdFunctorView fv = std::move(ready);
+	const sev::FdFunctorVt *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return SEV_EventLoop_watchFd(socket->Loop, socket->Fd, events, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+}
+
+void setNoDelay(int fd)
+{
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+errno_t localAddress(int fd, SEV_SocketAddress *address)
+{
+	socklen_t len = sizeof(address->Data);
+	if (getsockname(fd, (sockaddr *)address->Data, &len))
+		return errno;
+	address->Length = (int32_t)len;
+	return 0;
+}
+
+errno_t openSocket(int &fd, const SEV_SocketAddress *address, int type)
+{
+	fd = socket(((const sockaddr *)address->Data)->sa_family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return errno;
+	return 0;
+}
+
+errno_t bindSocket(int fd, const SEV_SocketAddress *address)
+{
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (const sockaddr *)address->Data, (socklen_t)address->Length))
+		return errno;
+	return 0;
+}
+
+}
+
+}
+
+errno_t SEV_TcpAcceptor::ready(sev::EventLoop &el, uint32_t events)
+{
+	using namespace sev::impl::sock;
+	for (int i = 0; i < c_AcceptBatch && !Closed; ++i)
+	{
+		SEV_SocketAddress peer;
+		socklen_t len = sizeof(peer.Data);
+		int fd = accept4(Fd, (sockaddr *)peer.Data, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+				pause();
+			break; // EAGAIN
+		}
+		peer.Length = (int32_t)len;
+		setNoDelay(fd);
+		errno_t eno = F(el, fd, &peer);
+		if (eno) return eno;
+	}
+	return 0;
+}
+
+void SEV_TcpAcceptor::pause()
+{
+	// The pending connection keeps the fd readable, so stop watching until some fds are released
+	using namespace sev::impl::sock;
+	std::shared_ptr<SEV_TcpAcceptor> self = shared_from_this();
+	if (SEV_EventLoop_modifyFd(Loop, Fd, 0))
+		return;
+	errno_t eno = sev::timeout(*Loop, [self](sev::EventLoop &el) -> errno_t {
+		if (!self->Closed)
+			SEV_EventLoop_modifyFd(self->Loop, self->Fd, SEV_FD_READ);
+		return 0;
+		}, c_AcceptBackoffMs);
+	if (eno) SEV_EventLoop_modifyFd(Loop, Fd, SEV_FD_READ); // Retry on the next readiness event instead
+}
+
+errno_t SEV_TcpStream::flush(bool &drained)
+{
+	using namespace sev::impl::sock;
+	drained = false;
+	std::unique_lock<std::mutex> lock(WriteMutex);
+	if (Closed || Connecting || WriteQueue.empty())
+		return 0;
+	while (!WriteQueue.empty())
+	{
+		iovec iov[c_MaxIov];
+		int count = 0;
+		size_t offset = WriteOffset;
+		for (auto it = WriteQueue.begin(); it != WriteQueue.end() && count < c_MaxIov; ++it, offset = 0)
+		{
+			iov[count].iov_base = it->data() + offset;
+			iov[count].iov_len = it->size() - offset;
+			++count;
+		}
+		msghdr msg = {};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		ssize_t n = sendmsg(Fd, &msg, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			return errno;
+		}
+		Pending -= n;
+		while (n)
+		{
+			const size_t remaining = WriteQueue.front().size() - WriteOffset;
+			if ((size_t)n < remaining)
+			{
+				WriteOffset += n;
+				break;
+			}
+			n -= remaining;
+			WriteOffset = 0;
+			WriteQueue.pop_front();
+		}
+	}
+	WantWrite = false;
+	SEV_EventLoop_modifyFd(Loop, Fd, SEV_FD_READ);
+	drained = true;
+	return 0;
+}
+
+errno_t SEV_TcpStream::closeWith(sev::EventLoop &el, errno_t eno)
+{
+	{
+		std::unique_lock<std::mutex> lock(WriteMutex);
+		if (Closed)
+			return 0;
+		Closed = true;
+		WriteQueue.clear();
+		Pending = 0;
+	}
+	SEV_EventLoop_unwatchFd(Loop, Fd);
+	return F(el, this, SEV_TCP_STREAM_CLOSED, null, eno);
+}
+
+errno_t SEV_TcpStream::ready(sev::EventLoop &el, uint32_t events)
+{
+	using namespace sev::impl::sock;
+	bool connecting;
+	{
+		std::unique_lock<std::mutex> lock(WriteMutex);
+		if (Closed)
+			return 0;
+		connecting = Connecting;
+	}
+	if (connecting)
+	{
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(Fd, SOL_SOCKET, SO_ERROR, &err, &len))
+			err = errno;
+		if (err)
+			return closeWith(el, err);
+		{
+			// Anything written while connecting is flushed on the next writable event
+			std::unique_lock<std::mutex> lock(WriteMutex);
+			if (Closed)
+				return 0;
+			Connecting = false;
+			WantWrite = !WriteQueue.empty();
+			SEV_EventLoop_modifyFd(Loop, Fd, SEV_FD_READ | (WantWrite ? SEV_FD_WRITE : 0));
+		}
+		return F(el, this, SEV_TCP_STREAM_CONNECTED, null, 0);
+	}
+	if (events & SEV_FD_WRITE)
+	{
+		bool drained;
+		errno_t eno = flush(drained);
+		if (eno) return closeWith(el, eno);
+		if (drained && !closed())
+		{
+			eno = F(el, this, SEV_TCP_STREAM_DRAINED, null, 0);
+			if (eno) return eno;
+		}
+	}
+	if (events & (SEV_FD_READ | SEV_FD_ERROR | SEV_FD_HANGUP))
+	{
+		// Check for destroy before each callback, it may be called from the previous one
+		for (int i = 0; i < c_ReadBatch && !closed(); ++i)
+		{
+			ssize_t n = recv(Fd, ReadBuffer.get(), c_ReadBufferSize, 0);
+			if (n > 0)
+			{
+				errno_t eno = F(el, this, SEV_TCP_STREAM_DATA, ReadBuffer.get(), n);
+				if (eno) return eno;
+				if (n < c_ReadBufferSize) break; // Drained the socket
+				continue;
+			}
+			if (n == 0) return closeWith(el, 0);
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return closeWith(el, errno);
+		}
+	}
+	return 0;
+}
+
+errno_t SEV_TcpStream::writev(const SEV_SocketBuffer *buffers, int count)
+{
+	using namespace sev::impl::sock;
+	size_t total = 0;
+	for (int i = 0; i < count; ++i)
+		total += buffers[i].Size;
+	std::unique_lock<std::mutex> lock(WriteMutex);
+	if (Closed)
+		return EPIPE;
+	size_t sent = 0;
+	if (WriteQueue.empty() && !Connecting)
+	{
+		// Nothing queued, gather directly from the caller buffers
+		iovec iov[c_MaxIov];
+		const int nb = count < c_MaxIov ? count : c_MaxIov;
+		for (int i = 0; i < nb; ++i)
+		{
+			iov[i].iov_base = const_cast<void *>(buffers[i].Data);
+			iov[i].iov_len = buffers[i].Size;
+		}
+		msghdr msg = {};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = nb;
+		ssize_t n;
+		do n = sendmsg(Fd, &msg, MSG_NOSIGNAL);
+		while (n < 0 && errno == EINTR);
+		if (n < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return errno;
+			n = 0;
+		}
+		sent = n;
+	}
+	if (sent == total)
+		return 0;
+	try
+	{
+		std::vector<uint8_t> chunk(total - sent);
+		uint8_t *dst = chunk.data();
+		size_t skip = sent;
+		for (int i = 0; i < count; ++i)
+		{
+			if (skip >= buffers[i].Size)
+			{
+				skip -= buffers[i].Size;
+				continue;
+			}
+			memcpy(dst, (const uint8_t *)buffers[i].Data + skip, buffers[i].Size - skip);
+			dst += buffers[i].Size - skip;
+			skip = 0;
+		}
+		WriteQueue.push_back(std::move(chunk));
+	}
+	catch (...)
+	{
+		return ENOMEM;
+	}
+	Pending += total - sent;
+	if (!WantWrite && !Connecting)
+	{
+		WantWrite = true;
+		SEV_EventLoop_modifyFd(Loop, Fd, SEV_FD_READ | SEV_FD_WRITE);
+	}
+	return 0;
+}
+
+errno_t SEV_UdpEndpoint::ready(sev::EventLoop &el, uint32_t events)
+{
+	using namespace sev::impl::sock;
+	for (int round = 0; round < c_UdpRounds && !Closed; ++round)
+	{
+		for (int i = 0; i < c_UdpBatch; ++i)
+		{
+			Iov[i].iov_base = Buffers.get() + (ptrdiff_t)i * MaxDatagramSize;
+			Iov[i].iov_len = MaxDatagramSize;
+			memset(&Msgs[i].msg_hdr, 0, sizeof(Msgs[i].msg_hdr));
+			Msgs[i].msg_hdr.msg_name = Datagrams[i].Address.Data;
+			Msgs[i].msg_hdr.msg_namelen = sizeof(Datagrams[i].Address.Data);
+			Msgs[i].msg_hdr.msg_iov = &Iov[i];
+			Msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int n = recvmmsg(Fd, Msgs, c_UdpBatch, MSG_DONTWAIT, null);
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			break; // EAGAIN, or an asynchronous error such as ECONNREFUSED, which doesn't stop the endpoint
+		}
+		for (int i = 0; i < n; ++i)
+		{
+			Datagrams[i].Data = Iov[i].iov_base;
+			Datagrams[i].Size = Msgs[i].msg_len;
+			Datagrams[i].Address.Length = (int32_t)Msgs[i].msg_hdr.msg_namelen;
+		}
+		errno_t eno = F(el, this, Datagrams, n);
+		if (eno) return eno;
+		if (n < c_UdpBatch) break;
+	}
+	return 0;
+}
+
+errno_t SEV_SocketAddress_parse(SEV_SocketAddress *address, const char *ip, int port)
+{
+	if (port < 0 || port > 65535)
+		return EINVAL;
+	memset(address, 0, sizeof(*address));
+	sockaddr_in *v4 = (sockaddr_in *)address->Data;
+	if (inet_pton(AF_INET, ip, &v4->sin_addr) == 1)
+	{
+		v4->sin_family = AF_INET;
+		v4->sin_port = htons((uint16_t)port);
+		address->Length = sizeof(sockaddr_in);
+		return 0;
+	}
+	sockaddr_in6 *v6 = (sockaddr_in6 *)address->Data;
+	if (inet_pton(AF_INET6, ip, &v6->sin6_addr) == 1)
+	{
+		v6->sin6_family = AF_INET6;
+		v6->sin6_port = htons((uint16_t)port);
+		address->Length = sizeof(sockaddr_in6);
+		return 0;
+	}
+	return EINVAL;
+}
+
+int SEV_SocketAddress_port(const SEV_SocketAddress *address)
+{
+	const sockaddr *sa = (const sockaddr *)address->Data;
+	if (sa->sa_family == AF_INET) return ntohs(((const sockaddr_in *)sa)->sin_port);
+	if (sa->sa_family == AF_INET6) return ntohs(((const sockaddr_in6 *)sa)->sin6_port);
+	return 0;
+}
+
+errno_t SEV_TcpAcceptor_create(SEV_TcpAcceptor **acceptor, SEV_EventLoop *el, const SEV_SocketAddress *address, int backlog, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::sock;
+	int fd;
+	errno_t eno = openSocket(fd, address, SOCK_STREAM);
+	if (eno) return eno;
+	eno = bindSocket(fd, address);
+	if (!eno && listen(fd, backlog))
+		eno = errno;
+	if (eno)
+	{
+		close(fd);
+		return eno;
+	}
+	std::shared_ptr<SEV_TcpAcceptor> socket;
+	try
+	{
+		sev::AcceptFunctor f((const sev::AcceptFunctorVt *)vt, ptr, forwardConstructor == vt->MoveConstructor);
+		socket = std::make_shared<SEV_TcpAcceptor>(el, fd, std::move(f));
+	}
+	catch (...)
+	{
+		close(fd);
+		return ENOMEM;
+	}
+	eno = watch(socket, SEV_FD_READ);
+	if (eno) return eno;
+	socket->Self = socket;
+	*acceptor = socket.get();
+	return 0;
+}
+
+errno_t SEV_TcpAcceptor_address(SEV_TcpAcceptor *acceptor, SEV_SocketAddress *address)
+{
+	return sev::impl::sock::localAddress(acceptor->Fd, address);
+}
+
+void SEV_TcpAcceptor_destroy(SEV_TcpAcceptor *acceptor)
+{
+	acceptor->Closed = true;
+	SEV_EventLoop_unwatchFd(acceptor->Loop, acceptor->Fd);
+	std::shared_ptr<SEV_TcpAcceptor> self = std::move(acceptor->Self);
+}
+
+namespace sev::impl::sock {
+
+namespace /* anonymous */ {
+
+errno_t streamStart(SEV_TcpStream **stream, SEV_EventLoop *el, int fd, bool connecting, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	std::shared_ptr<SEV_TcpStream> socket;
+	try
+	{
+		sev::TcpStreamFunctor f((const sev::TcpStreamFunctorVt *)vt, ptr, forwardConstructor == vt->MoveConstructor);
+		socket = std::make_shared<SEV_TcpStream>(el, fd, std::move(f));
+		socket->ReadBuffer.reset(new uint8_t[c_ReadBufferSize]);
+	}
+	catch (...)
+	{
+		if (!socket) close(fd);
+		return ENOMEM;
+	}
+	socket->Connecting = connecting;
+	errno_t eno = watch(socket, connecting ? SEV_FD_WRITE : SEV_FD_READ);
+	if (eno) return eno;
+	socket->Self = socket;
+	*stream = socket.get();
+	return 0;
+}
+
+}
+
+}
+
+errno_t SEV_TcpStream_create(SEV_TcpStream **stream, SEV_EventLoop *el, int fd, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::sock;
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK))
+	{
+		errno_t eno = errno;
+		close(fd);
+		return eno;
+	}
+	setNoDelay(fd);
+	return streamStart(stream, el, fd, false, vt, ptr, forwardConstructor);
+}
+
+errno_t SEV_TcpStream_connect(SEV_TcpStream **stream, SEV_EventLoop *el, const SEV_SocketAddress *address, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::sock;
+	int fd;
+	errno_t eno = openSocket(fd, address, SOCK_STREAM);
+	if (eno) return eno;
+	setNoDelay(fd);
+	if (connect(fd, (const sockaddr *)address->Data, (socklen_t)address->Length) && errno != EINPROGRESS)
+	{
+		eno = errno;
+		close(fd);
+		return eno;
+	}
+	// Also when connected immediately, CONNECTED is reported from the loop once writable
+	return streamStart(stream, el, fd, true, vt, ptr, forwardConstructor);
+}
+
+errno_t SEV_TcpStream_write(SEV_TcpStream *stream, const void *data, size_t size)
+{
+	SEV_SocketBuffer buffer = { data, size };
+	return stream->writev(&buffer, 1);
+}
+
+errno_t SEV_TcpStream_writev(SEV_TcpStream *stream, const SEV_SocketBuffer *buffers, int count)
+{
+	return stream->writev(buffers, count);
+}
+
+size_t SEV_TcpStream_pending(SEV_TcpStream *stream)
+{
+	std::unique_lock<std::mutex> lock(stream->WriteMutex);
+	return stream->Pending;
+}
+
+void SEV_TcpStream_destroy(SEV_TcpStream *stream)
+{
+	{
+		std::unique_lock<std::mutex> lock(stream->WriteMutex);
+		stream->Closed = true;
+		stream->WriteQueue.clear();
+		stream->Pending = 0;
+	}
+	SEV_EventLoop_unwatchFd(stream->Loop, stream->Fd);
+	std::shared_ptr<SEV_TcpStream> self = std::move(stream->Self);
+}
+
+errno_t SEV_UdpEndpoint_create(SEV_UdpEndpoint **endpoint, SEV_EventLoop *el, const SEV_SocketAddress *address, int maxDatagramSize, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::sock;
+	if (maxDatagramSize <= 0 || maxDatagramSize > 65536)
+		return EINVAL;
+	int fd;
+	errno_t eno = openSocket(fd, address, SOCK_DGRAM);
+	if (eno) return eno;
+	eno = bindSocket(fd, address);
+	if (eno)
+	{
+		close(fd);
+		return eno;
+	}
+	std::shared_ptr<SEV_UdpEndpoint> socket;
+	try
+	{
+		sev::UdpFunctor f((const sev::UdpFunctorVt *)vt, ptr, forwardConstructor == vt->MoveConstructor);
+		socket = std::make_shared<SEV_UdpEndpoint>(el, fd, maxDatagramSize, std::move(f));
+		socket->Buffers.reset(new uint8_t[(ptrdiff_t)c_UdpBatch * maxDatagramSize]);
+	}
+	catch (...)
+	{
+		if (!socket) close(fd);
+		return ENOMEM;
+	}
+	eno = watch(socket, SEV_FD_READ);
+	if (eno) return eno;
+	socket->Self = socket;
+	*endpoint = socket.get();
+	return 0;
+}
+
+errno_t SEV_UdpEndpoint_address(SEV_UdpEndpoint *endpoint, SEV_SocketAddress *address)
+{
+	return sev::impl::sock::localAddress(endpoint->Fd, address);
+}
+
+errno_t SEV_UdpEndpoint_send(SEV_UdpEndpoint *endpoint, const SEV_Datagram *datagrams, int count, int *sent)
+{
+	using namespace sev::impl::sock;
+	int total = 0;
+	errno_t eno = 0;
+	while (total < count)
+	{
+		mmsghdr msgs[c_UdpBatch];
+		iovec iov[c_UdpBatch];
+		const int batch = count - total < c_UdpBatch ? count - total : c_UdpBatch;
+		for (int i = 0; i < batch; ++i)
+		{
+			const SEV_Datagram &dg = datagrams[total + i];
+			iov[i].iov_base = dg.Data;
+			iov[i].iov_len = dg.Size;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = const_cast<uint8_t *>(dg.Address.Data);
+			msgs[i].msg_hdr.msg_namelen = (socklen_t)dg.Address.Length;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int n = sendmmsg(endpoint->Fd, msgs, batch, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			if (!total) eno = errno;
+			break;
+		}
+		total += n;
+		if (n < batch) break; // Socket buffer full
+	}
+	if (sent) *sent = total;
+	return eno;
+}
+
+void SEV_UdpEndpoint_destroy(SEV_UdpEndpoint *endpoint)
+{
+	endpoint->Closed = true;
+	SEV_EventLoop_unwatchFd(endpoint->Loop, endpoint->Fd);
+	std::shared_ptr<SEV_UdpEndpoint> self = std::move(endpoint->Self);
+}
+
+#else
+
+errno_t SEV_SocketAddress_parse(SEV_SocketAddress *address, const char *ip, int port)
+{
+	return ENOSYS;
+}
+
+int SEV_SocketAddress_port(const SEV_SocketAddress *address)
+{
+	return 0;
+}
+
+errno_t SEV_TcpAcceptor_create(SEV_TcpAcceptor **acceptor, SEV_EventLoop *el, const SEV_SocketAddress *address, int backlog, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return ENOSYS;
+}
+
+errno_t SEV_TcpAcceptor_address(SEV_TcpAcceptor *acceptor, SEV_SocketAddress *address)
+{
+	return ENOSYS;
+}
+
+void SEV_TcpAcceptor_destroy(SEV_TcpAcceptor *acceptor)
+{
+}
+
+errno_t SEV_TcpStream_create(SEV_TcpStream **stream, SEV_EventLoop *el, int fd, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return ENOSYS;
+}
+
+errno_t SEV_TcpStream_connect(SEV_TcpStream **stream, SEV_EventLoop *el, const SEV_SocketAddress *address, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return ENOSYS;
+}
+
+errno_t SEV_TcpStream_write(SEV_TcpStream *stream, const void *data, size_t size)
+{
+	return ENOSYS;
+}
+
+errno_t SEV_TcpStream_writev(SEV_TcpStream *stream, const SEV_SocketBuffer *buffers, int count)
+{
+	return ENOSYS;
+}
+
+size_t SEV_TcpStream_pending(SEV_TcpStream *stream)
+{
+	return 0;
+}
+
+void SEV_TcpStream_destroy(SEV_TcpStream *stream)
+{
+}
+
+errno_t SEV_UdpEndpoint_create(SEV_UdpEndpoint **endpoint, SEV_EventLoop *el, const SEV_SocketAddress *address, int maxDatagramSize, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return ENOSYS;
+}
+
+errno_t SEV_UdpEndpoint_address(SEV_UdpEndpoint *endpoint, SEV_SocketAddress *address)
+{
+	return ENOSYS;
+}
+
+errno_t SEV_UdpEndpoint_send(SEV_UdpEndpoint *endpoint, const SEV_Datagram *datagrams, int count, int *sent)
+{
+	if (sent) *sent = 0;
+	return ENOSYS;
+}
+
+void SEV_UdpEndpoint_destroy(SEV_UdpEndpoint *endpoint)
+{
+}
+
+#endif
+
+/* end of file */
@@ -0,0 +1,143 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Non-blocking sockets on the event loop fd readiness. Linux only for now, the
+functions return ENOSYS elsewhere.
+
+The acceptor accepts connections in batches on each readiness event, and stops
+watching for 100ms when out of fds, as the pending connection keeps the fd
+readable. The stream writes directly when nothing is queued, and otherwise
+copies the remainder into a write queue, flushed with gather writes when the
+socket becomes writable. The UDP endpoint receives and sends in batches with
+recvmmsg and sendmmsg.
+
+Callbacks for one socket never run concurrently. Destroying a socket stops its
+callbacks, also when called from one of them, a callback which is already
+running completes first, and the fd is closed after it returns.
+
+*/
+
+#pragma once
+#ifndef SEV_SOCKET_H
+#define SEV_SOCKET_H
+
+#include "platform.h"
+#include "event_loop.h"
+
+#define SEV_TCP_STREAM_CONNECTED 1 // Outgoing connection established
+#define SEV_TCP_STREAM_DATA 2 // Data received
+#define SEV_TCP_STREAM_DRAINED 3 // Write queue became empty
+#define SEV_TCP_STREAM_CLOSED 4 // Size is the errno, 0 when the peer closed the connection
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct SEV_SocketAddress
+{
+	uint8_t Data[128]; // sockaddr_storage
+	int32_t Length;
+
+};
+
+struct SEV_SocketBuffer
+{
+	const void *Data;
+	size_t Size;
+
+};
+
+struct SEV_Datagram
+{
+	void *Data;
+	size_t Size;
+	SEV_SocketAddress Address; // Source when receiving, destination when sending
+
+};
+
+struct SEV_TcpAcceptor;
+struct SEV_TcpStream;
+struct SEV_UdpEndpoint;
+
+SEV_LIB errno_t SEV_SocketAddress_parse(SEV_SocketAddress *address, const char *ip, int port); // Numeric IPv4 or IPv6, EINVAL if not valid
+SEV_LIB int SEV_SocketAddress_port(const SEV_SocketAddress *address);
+
+// Accepted connections are passed as non-blocking fds, errno_t(EventLoop &el, int fd, const SEV_SocketAddress *peer). The functor owns the fd
+SEV_LIB errno_t SEV_TcpAcceptor_create(SEV_TcpAcceptor **acceptor, SEV_EventLoop *el, const SEV_SocketAddress *address, int backlog, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_TcpAcceptor_address(SEV_TcpAcceptor *acceptor, SEV_SocketAddress *address); // Bound address, to get the port chosen when binding port 0
+SEV_LIB void SEV_TcpAcceptor_destroy(SEV_TcpAcceptor *acceptor);
+
+// Stream events are errno_t(EventLoop &el, SEV_TcpStream *stream, int event, const void *data, ptrdiff_t size)
+SEV_LIB errno_t SEV_TcpStream_create(SEV_TcpStream **stream, SEV_EventLoop *el, int fd, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Takes ownership of a connected fd
+SEV_LIB errno_t SEV_TcpStream_connect(SEV_TcpStream **stream, SEV_EventLoop *el, const SEV_SocketAddress *address, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Writes are queued until connected
+SEV_LIB errno_t SEV_TcpStream_write(SEV_TcpStream *stream, const void *data, size_t size); // Data is copied if it can't be sent immediately. EPIPE once closed
+SEV_LIB errno_t SEV_TcpStream_writev(SEV_TcpStream *stream, const SEV_SocketBuffer *buffers, int count);
+SEV_LIB size_t SEV_TcpStream_pending(SEV_TcpStream *stream); // Bytes in the write queue
+SEV_LIB void SEV_TcpStream_destroy(SEV_TcpStream *stream); // Closes the connection, queued data is discarded
+
+// Received datagrams are passed in batches, errno_t(EventLoop &el, SEV_UdpEndpoint *endpoint, const SEV_Datagram *datagrams, int count). Longer datagrams are truncated to maxDatagramSize
+SEV_LIB errno_t SEV_UdpEndpoint_create(SEV_UdpEndpoint **endpoint, SEV_EventLoop *el, const SEV_SocketAddress *address, int maxDatagramSize, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_UdpEndpoint_address(SEV_UdpEndpoint *endpoint, SEV_SocketAddress *address);
+SEV_LIB errno_t SEV_UdpEndpoint_send(SEV_UdpEndpoint *endpoint, const SEV_Datagram *datagrams, int count, int *sent); // Not queued, EAGAIN if nothing could be sent
+SEV_LIB void SEV_UdpEndpoint_destroy(SEV_UdpEndpoint *endpoint);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#ifdef __cplusplus
+
+namespace sev {
+
+typedef SEV_SocketAddress SocketAddress;
+typedef SEV_SocketBuffer SocketBuffer;
+typedef SEV_Datagram Datagram;
+typedef SEV_TcpAcceptor TcpAcceptor;
+typedef SEV_TcpStream TcpStream;
+typedef SEV_UdpEndpoint UdpEndpoint;
+
+typedef FunctorVt<errno_t(EventLoop &el, int fd, const SocketAddress *peer)> AcceptFunctorVt;
+typedef Functor<errno_t(EventLoop &el, int fd, const SocketAddress *peer)> AcceptFunctor;
+typedef FunctorView<errno_t(EventLoop &el, int fd, const SocketAddress *peer)> AcceptFunctorView;
+typedef FunctorVt<errno_t(EventLoop &el, TcpStream *stream, int event, const void *data, ptrdiff_t size)> TcpStreamFunctorVt;
+typedef Functor<errno_t(EventLoop &el, TcpStream *stream, int event, const void *data, ptrdiff_t size)> TcpStreamFunctor;
+typedef FunctorView<errno_t(EventLoop &el, TcpStream *stream, int event, const void *data, ptrdiff_t size)> TcpStreamFunctorView;
+typedef FunctorVt<errno_t(EventLoop &el, UdpEndpoint *endpoint, const Datagram *datagrams, int count)> UdpFunctorVt;
+typedef Functor<errno_t(EventLoop &el, UdpEndpoint *endpoint, const Datagram *datagrams, int count)> UdpFunctor;
+typedef FunctorView<errno_t(EventLoop &el, UdpEndpoint *endpoint, const Datagram *datagrams, int count)> UdpFunctorView;
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_SOCKET_H */
+
+/* end of file */
@@ -0,0 +1,227 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Strand, runs the functors posted to it one at a time, in posting order, on
+a loop with any number of threads. State which is only touched from one
+strand needs no locking.
+
+Posting pushes onto a lock-free list, and schedules a drain on the loop if
+none is scheduled yet. The drain runs up to a batch of functors, and
+reschedules itself when more are pending, so other work on the loop is not
+starved by a busy strand. On the work-stealing loop the rescheduled drain goes
+into the worker's own deque, which it pops LIFO, so the other work waiting on
+that worker is left to the other workers to steal.
+
+Functors that are still pending when the strand is destroyed will still run.
+
+*/
+
+#pragma once
+#ifndef SEV_STRAND_H
+#define SEV_STRAND_H
+
+#include "platform.h"
+#include "event_loop.h"
+
+#ifdef __cplusplus
+
+#include <memory>
+
+namespace sev {
+
+namespace impl::st {
+
+struct Item
+{
+	Item(EventFunctor &&f) : F(std::move(f))
+	{
+	}
+
+	Item *Next = null;
+	EventFunctor F;
+
+};
+
+inline thread_local const void *t_CurrentStrand = null;
+
+struct State : std::enable_shared_from_this<State>
+{
+	State(EventLoop &el, int batch) : Loop(el), Batch(batch), Pending(null), Local(null)
+	{
+	}
+
+	~State()
+	{
+		// Only left over when scheduling a drain failed
+		for (Item *item = Pending.exchange(null); item;)
+		{
+			Item *next = item->Next;
+			delete item;
+			item = next;
+		}
+		while (Local)
+		{
+			Item *next = Local->Next;
+			delete Local;
+			Local = next;
+		}
+	}
+
+	EventLoop &Loop;
+	const int Batch;
+
+	alignas(64) std::atomic<Item *> Pending; // Pushed by any thread, newest first
+	DrainSchedule Scheduled;
+
+	alignas(64) Item *Local; // Taken from Pending and put in order, only touched by the drain
+
+	errno_t push(Item *item) noexcept
+	{
+		Item *head = Pending.load(std::memory_order_relaxed);
+		do item->Next = head;
+		while (!Pending.compare_exchange_weak(head, item, std::memory_order_release, std::memory_order_relaxed));
+		return Scheduled.request([this]() -> errno_t {
+			return schedule();
+		});
+	}
+
+	errno_t schedule() noexcept
+	{
+		std::shared_ptr<State> self = shared_from_this();
+		return sev::post(Loop, [self](EventLoop &el) -> errno_t {
+			return self->drain(el);
+		});
+	}
+
+	// Called after a drain, schedules the next one if there is more work
+	void done() noexcept
+	{
+		const bool local = Local; // Only the first check may look at Local, the next drain owns it
+		Scheduled.finish([this, local]() -> bool {
+			return local || Pending.load(std::memory_order_acquire);
+		}, [this]() -> errno_t {
+			return schedule();
+		});
+	}
+
+	errno_t drain(EventLoop &el)
+	{
+		const void *const prevStrand = t_CurrentStrand;
+		t_CurrentStrand = this;
+		errno_t eno = 0;
+		try
+		{
+			for (int i = 0; i < Batch && !eno; ++i)
+			{
+				if (!Local)
+				{
+					// Take everything pushed so far, and reverse it into posting order
+					Item *item = Pending.exchange(null, std::memory_order_acquire);
+					while (item)
+					{
+						Item *next = item->Next;
+						item->Next = Local;
+						Local = item;
+						item = next;
+					}
+					if (!Local)
+						break;
+				}
+				std::unique_ptr<Item> item(Local);
+				Local = item->Next;
+				eno = item->F(el);
+			}
+		}
+		catch (...)
+		{
+			t_CurrentStrand = prevStrand;
+			done();
+			throw;
+		}
+		t_CurrentStrand = prevStrand;
+		done();
+		return eno;
+	}
+
+};
+
+}
+
+class Strand
+{
+public:
+	//! Batch is the number of functors run by one drain before it yields the loop thread
+	explicit Strand(EventLoop &el, int batch = 64) : m_State(std::make_shared<impl::st::State>(el, batch))
+	{
+	}
+
+	Strand(const Strand &other) = delete;
+	Strand &operator=(const Strand &other) = delete;
+
+	EventLoop &loop() const noexcept
+	{
+		return m_State->Loop;
+	}
+
+	//! Post a functor `errno_t(EventLoop &el)` to run after everything posted to this strand before it. Errors are returned to the loop
+	template<typename TFn>
+	errno_t post(TFn &&f) noexcept
+	{
+		impl::st::Item *item;
+		try
+		{
+			item = new impl::st::Item(makeEventFunctor(std::forward<TFn>(f)));
+		}
+		catch (std::bad_alloc)
+		{
+			return ENOMEM;
+		}
+		return m_State->push(item);
+	}
+
+	//! True when called from a functor running on this strand
+	bool runningInThisThread() const noexcept
+	{
+		return impl::st::t_CurrentStrand == m_State.get();
+	}
+
+private:
+	std::shared_ptr<impl::st::State> m_State;
+
+};
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_STRAND_H */
+
+/* end of file */
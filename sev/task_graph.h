@@ -0,0 +1,256 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Task graph. Nodes are functors `errno_t(EventLoop &el)`, and edges make a
+node wait for its predecessors. Each node keeps a counter of predecessors
+that have not completed yet, a node is posted to the loop by whichever
+predecessor completes last. One ready successor runs directly on the
+completing thread instead of being posted.
+
+The graph can be run again once a run completes, nodes and edges are only
+allocated while building it. The graph must outlive its runs.
+
+When a node fails, the nodes that have not started yet are skipped, and
+the run completes with the first error.
+
+*/
+
+#pragma once
+#ifndef SEV_TASK_GRAPH_H
+#define SEV_TASK_GRAPH_H
+
+#include "platform.h"
+#include "event_loop.h"
+#include "future.h"
+
+#ifdef __cplusplus
+
+#include <deque>
+#include <vector>
+#include <stdexcept>
+
+namespace sev {
+
+class TaskGraph
+{
+public:
+	typedef ptrdiff_t Node;
+
+	TaskGraph() : m_Dirty(false), m_Remaining(0), m_Failed(false), m_Running(false)
+	{
+	}
+
+	TaskGraph(const TaskGraph &other) = delete;
+	TaskGraph &operator=(const TaskGraph &other) = delete;
+
+	~TaskGraph()
+	{
+		SEV_ASSERT(!m_Running);
+	}
+
+	//! Add a node, not while running
+	template<typename TFn>
+	Node add(TFn &&f)
+	{
+		SEV_ASSERT(!m_Running);
+		m_Nodes.emplace_back(makeEventFunctor(std::forward<TFn>(f)));
+		m_Dirty = true;
+		return (Node)m_Nodes.size() - 1;
+	}
+
+	//! Make after wait for before, not while running
+	void precede(Node before, Node after)
+	{
+		SEV_ASSERT(!m_Running);
+		SEV_ASSERT(before >= 0 && before < (Node)m_Nodes.size());
+		SEV_ASSERT(after >= 0 && after < (Node)m_Nodes.size());
+		m_Nodes[before].Successors.push_back(after);
+		++m_Nodes[after].Predecessors;
+		m_Dirty = true;
+	}
+
+	ptrdiff_t size() const noexcept
+	{
+		return (ptrdiff_t)m_Nodes.size();
+	}
+
+	//! Post the nodes without predecessors to the loop, and return a future which is set when all nodes are done.
+	//! Throws std::invalid_argument if the graph has a cycle
+	Future<void> run(EventLoop &el)
+	{
+		SEV_ASSERT(!m_Running.load());
+		if (m_Dirty)
+			validate();
+		m_Done = Promise<void>();
+		Future<void> done = m_Done.future();
+		if (m_Nodes.empty())
+		{
+			m_Done.setValue();
+			return done;
+		}
+		m_Running = true;
+		m_Failed = false;
+		m_Exception = null;
+		for (NodeState &node : m_Nodes)
+			node.Pending.store(node.Predecessors, std::memory_order_relaxed);
+		m_Remaining = (ptrdiff_t)m_Nodes.size();
+		for (Node root : m_Roots)
+			schedule(el, root);
+		return done;
+	}
+
+private:
+	struct NodeState
+	{
+		NodeState(EventFunctor &&f) : F(std::move(f)), Predecessors(0), Pending(0)
+		{
+		}
+
+		EventFunctor F;
+		std::vector<Node> Successors;
+		int Predecessors;
+		std::atomic_int Pending;
+
+	};
+
+	void validate()
+	{
+		// Kahn's algorithm, every node must be reachable from the roots once its predecessors are done
+		std::vector<int> pending(m_Nodes.size());
+		std::vector<Node> ready;
+		m_Roots.clear();
+		for (Node i = 0; i < (Node)m_Nodes.size(); ++i)
+		{
+			pending[i] = m_Nodes[i].Predecessors;
+			if (!pending[i])
+			{
+				m_Roots.push_back(i);
+				ready.push_back(i);
+			}
+		}
+		ptrdiff_t visited = 0;
+		while (!ready.empty())
+		{
+			Node node = ready.back();
+			ready.pop_back();
+			++visited;
+			for (Node successor : m_Nodes[node].Successors)
+				if (!--pending[successor])
+					ready.push_back(successor);
+		}
+		if (visited != (ptrdiff_t)m_Nodes.size())
+			throw std::invalid_argument("Task graph has a cycle");
+		m_Dirty = false;
+	}
+
+	void schedule(EventLoop &el, Node node)
+	{
+		TaskGraph *graph = this;
+		errno_t eno = post(el, [graph, node](EventLoop &el) -> errno_t {
+			graph->execute(el, node);
+			return 0;
+		});
+		if (eno)
+			execute(el, node); // Out of memory, run it here instead
+	}
+
+	void execute(EventLoop &el, Node node)
+	{
+		while (node >= 0)
+		{
+			NodeState &state = m_Nodes[node];
+			if (!m_Failed.load(std::memory_order_relaxed))
+			{
+				try
+				{
+					ExceptionHandle::rethrow(state.F(el));
+				}
+				catch (...)
+				{
+					fail(std::current_exception());
+				}
+			}
+
+			// Post all ready successors but one, which runs next on this thread
+			Node next = -1;
+			for (Node successor : state.Successors)
+			{
+				if (m_Nodes[successor].Pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				{
+					if (next >= 0) schedule(el, next);
+					next = successor;
+				}
+			}
+			if (m_Remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				finish();
+				return; // The graph may be destroyed or run again from here
+			}
+			node = next;
+		}
+	}
+
+	void fail(std::exception_ptr ex) noexcept
+	{
+		std::unique_lock<AtomicMutex> lock(m_ExceptionMutex);
+		if (!m_Exception) m_Exception = std::move(ex);
+		m_Failed.store(true, std::memory_order_relaxed);
+	}
+
+	void finish() noexcept
+	{
+		Promise<void> done = std::move(m_Done);
+		std::exception_ptr ex = std::move(m_Exception);
+		m_Running = false;
+		if (ex) done.setException(std::move(ex));
+		else done.setValue();
+	}
+
+	std::deque<NodeState> m_Nodes; // Stable addresses for the atomic counters
+	std::vector<Node> m_Roots;
+	bool m_Dirty; // Roots need to be found again
+
+	alignas(64) std::atomic_ptrdiff_t m_Remaining; // Nodes not yet done in this run
+	std::atomic_bool m_Failed;
+	AtomicMutex m_ExceptionMutex;
+	std::exception_ptr m_Exception;
+	std::atomic_bool m_Running;
+	Promise<void> m_Done;
+
+};
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_TASK_GRAPH_H */
+
+/* end of file */
@@ -0,0 +1,184 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Chase-Lev work-stealing deque. The owner thread pushes and pops at the bottom,
+any other thread may steal from the top. Only suitable for trivially copyable
+values, such as pointers.
+
+Reference: Le, Pop, Cohen, Zappa Nardelli, "Correct and Efficient Work-Stealing
+for Weak Memory Models", PPoPP 2013.
+
+*/
+
+#pragma once
+#ifndef SEV_WORK_STEALING_DEQUE_H
+#define SEV_WORK_STEALING_DEQUE_H
+
+#include "platform.h"
+
+#ifdef __cplusplus
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <type_traits>
+
+namespace sev::impl {
+
+template<class T>
+class WorkStealingDeque
+{
+private:
+	static_assert(std::is_trivially_copyable_v<T>);
+
+	struct Array
+	{
+		Array(ptrdiff_t capacity) : Capacity(capacity), Mask(capacity - 1), Data(new std::atomic<T>[capacity])
+		{
+			SEV_ASSERT(!(capacity & (capacity - 1)));
+		}
+
+		SEV_FORCE_INLINE T get(ptrdiff_t i) const noexcept
+		{
+			return Data[i & Mask].load(std::memory_order_relaxed);
+		}
+
+		SEV_FORCE_INLINE void put(ptrdiff_t i, T v) noexcept
+		{
+			Data[i & Mask].store(v, std::memory_order_relaxed);
+		}
+
+		const ptrdiff_t Capacity;
+		const ptrdiff_t Mask;
+		std::unique_ptr<std::atomic<T>[]> Data;
+
+	};
+
+public:
+	inline WorkStealingDeque(ptrdiff_t capacity = 256) : m_Top(0), m_Bottom(0)
+	{
+		m_Retired.emplace_back(new Array(capacity));
+		m_Array.store(m_Retired.back().get(), std::memory_order_relaxed);
+	}
+
+	//! Owner only. May throw std::bad_alloc when the deque needs to grow
+	inline void push(T v)
+	{
+		ptrdiff_t b = m_Bottom.load(std::memory_order_relaxed);
+		ptrdiff_t t = m_Top.load(std::memory_order_acquire);
+		Array *a = m_Array.load(std::memory_order_relaxed);
+		if (b - t > a->Capacity - 1)
+			a = p_grow(a, b, t);
+		a->put(b, v);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_Bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	//! Owner only. Returns false if the deque is empty
+	inline bool pop(T &v) noexcept
+	{
+		ptrdiff_t b = m_Bottom.load(std::memory_order_relaxed) - 1;
+		Array *a = m_Array.load(std::memory_order_relaxed);
+		m_Bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		ptrdiff_t t = m_Top.load(std::memory_order_relaxed);
+		if (t > b)
+		{
+			// Empty
+			m_Bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+		v = a->get(b);
+		if (t == b)
+		{
+			// Last item, race against stealing threads
+			bool won = m_Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			m_Bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	//! Any thread. Returns false if the deque is empty, or if another thread won the race
+	inline bool steal(T &v) noexcept
+	{
+		ptrdiff_t t = m_Top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		ptrdiff_t b = m_Bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return false;
+		Array *a = m_Array.load(std::memory_order_acquire);
+		v = a->get(t);
+		return m_Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	//! Any thread. Approximate
+	inline bool empty() const noexcept
+	{
+		return m_Bottom.load(std::memory_order_relaxed) <= m_Top.load(std::memory_order_relaxed);
+	}
+
+private:
+	Array *p_grow(Array *a, ptrdiff_t b, ptrdiff_t t)
+	{
+		// Old arrays are kept alive until the deque is destroyed, stealing threads may still be reading from them
+		std::unique_ptr<Array> na(new Array(a->Capacity * 2));
+		for (ptrdiff_t i = t; i < b; ++i)
+			na->put(i, a->get(i));
+		m_Retired.reserve(m_Retired.size() + 1);
+		Array *res = na.get();
+		m_Retired.push_back(std::move(na));
+		m_Array.store(res, std::memory_order_release);
+		return res;
+	}
+
+private:
+	alignas(64) std::atomic_ptrdiff_t m_Top;
+	alignas(64) std::atomic_ptrdiff_t m_Bottom;
+	std::atomic<Array *> m_Array;
+	std::vector<std::unique_ptr<Array>> m_Retired;
+
+public:
+	WorkStealingDeque(const WorkStealingDeque &) = delete;
+	WorkStealingDeque(WorkStealingDeque &&) = delete;
+
+	WorkStealingDeque &operator= (const WorkStealingDeque &) = delete;
+	WorkStealingDeque &operator= (WorkStealingDeque &&) = delete;
+
+};
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_WORK_STEALING_DEQUE_H */
+
+/* end of file */
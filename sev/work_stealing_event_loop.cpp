@@ -0,0 +1,530 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Work-stealing event loop. Each worker thread owns a local deque, functors posted
+from a worker go into its own deque and are popped LIFO by the owner. Functors
+posted from outside the loop go into the shared injection queue. Idle workers
+first check the injection queue, then steal FIFO from the other workers.
+
+*/
+
+#include "event_loop.h"
+#include "event_loop_impl.h"
+
+namespace sev::impl::el {
+
+namespace /* anonymous */ {
+
+thread_local WorkStealingEventLoop *t_Loop = null;
+thread_local WorkStealingWorker *t_Worker = null;
+
+// Small tasks are recycled through a per-thread list, the thread which runs a task recycles it
+constexpr ptrdiff_t c_TaskRecycleCapacity = 256 - (ptrdiff_t)sizeof(WorkStealingTask);
+constexpr int c_TaskRecycleMax = 256;
+
+struct TaskRecycler
+{
+	WorkStealingTask *First = null;
+	int Count = 0;
+
+	~TaskRecycler()
+	{
+		while (First)
+		{
+			WorkStealingTask *task = First;
+			First = task->Next;
+			SEV_alignedFree(task);
+		}
+	}
+
+};
+
+thread_local TaskRecycler t_TaskRecycler;
+
+WorkStealingTask *allocTask(ptrdiff_t size)
+{
+	if (size <= c_TaskRecycleCapacity)
+	{
+		TaskRecycler &recycler = t_TaskRecycler;
+		if (recycler.First)
+		{
+			WorkStealingTask *task = recycler.First;
+			recycler.First = task->Next;
+			--recycler.Count;
+			return task;
+		}
+		size = c_TaskRecycleCapacity;
+	}
+	WorkStealingTask *task = (WorkStealingTask *)SEV_alignedMAlloc(sizeof(WorkStealingTask) + size, SEV_FUNCTOR_ALIGN);
+	if (!task) return null;
+	task->Vt = null;
+	task->Next = null;
+	task->Capacity = size;
+	return task;
+}
+
+void freeTask(WorkStealingTask *task)
+{
+	TaskRecycler &recycler = t_TaskRecycler;
+	if (task->Capacity == c_TaskRecycleCapacity && recycler.Count < c_TaskRecycleMax)
+	{
+		task->Vt = null;
+		task->Next = recycler.First;
+		recycler.First = task;
+		++recycler.Count;
+		return;
+	}
+	SEV_alignedFree(task);
+}
+
+SEV_FORCE_INLINE uint32_t nextRandom(uint32_t &seed)
+{
+	// xorshift32
+	uint32_t x = seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	seed = x;
+	return x;
+}
+
+WorkStealingWorker *acquireWorker(WorkStealingEventLoop *elp)
+{
+	std::unique_lock<std::mutex> lock(elp->WorkersMutex);
+	const int node = elp->NbNodes > 1 ? SEV_Numa_currentNode() : 0;
+	if (elp->NbNodes > 1 && !elp->NodeQueues[node].load(std::memory_order_relaxed))
+	{
+		EventFunctorQueue *queue = new (nothrow) EventFunctorQueue(nothrow);
+		if (queue && !queue->get()->ReadBlock)
+		{
+			delete queue;
+			queue = null;
+		}
+		if (queue) // Otherwise keep using the shared queue for this node
+			elp->NodeQueues[node].store(queue, std::memory_order_release);
+	}
+	const int nbWorkers = elp->NbWorkers.load(std::memory_order_relaxed);
+	for (int i = 0; i < nbWorkers; ++i)
+	{
+		// Reuse the slot of a worker that has left the loop, any functors left in its deque are picked up again
+		WorkStealingWorker *worker = elp->Workers[i].load(std::memory_order_relaxed);
+		if (!worker->Active.load(std::memory_order_acquire)) // Pairs with the release when the previous thread left, its deque operations are visible
+		{
+			worker->Node = node;
+			worker->Active = true;
+			return worker;
+		}
+	}
+	if (nbWorkers >= WorkStealingEventLoop::c_MaxWorkers)
+		return null;
+	WorkStealingWorker *worker;
+	try
+	{
+		worker = new WorkStealingWorker();
+	}
+	catch (...)
+	{
+		return null;
+	}
+	worker->Node = node;
+	worker->Active = true;
+	worker->Seed = 2463534242u + (uint32_t)nbWorkers * 0x9E3779B9u;
+	elp->Workers[nbWorkers].store(worker, std::memory_order_release);
+	elp->NbWorkers.store(nbWorkers + 1, std::memory_order_release);
+	return worker;
+}
+
+bool stealTask(WorkStealingEventLoop *elp, WorkStealingWorker *self, WorkStealingTask *&task)
+{
+	const int nbWorkers = elp->NbWorkers.load(std::memory_order_acquire);
+	if (nbWorkers <= 1)
+		return false;
+	const int start = (int)(nextRandom(self->Seed) % (uint32_t)nbWorkers);
+	const bool numa = elp->NbNodes > 1;
+	for (int pass = numa ? 0 : 1; pass < 2; ++pass)
+	{
+		// On NUMA systems, try victims on the same node first
+		for (int i = 0; i < nbWorkers; ++i)
+		{
+			WorkStealingWorker *victim = elp->Workers[(start + i) % nbWorkers].load(std::memory_order_acquire);
+			if (victim == self || victim->Deque.empty())
+				continue;
+			if (numa && ((victim->Node == self->Node) != !pass))
+				continue;
+			if (victim->Deque.steal(task))
+				return true;
+		}
+	}
+	return false;
+}
+
+bool tryCallAndPop(WorkStealingEventLoop *elp, EventFunctorQueue *queue, SEV_ExceptionHandle *eh)
+{
+	bool success;
+	errno_t eno = queue->tryCallAndPop(*(sev::ExceptionHandle *)eh, success, &t_Metrics->Running, &elp->Pending, *elp);
+	if (success)
+	{
+		--elp->QueueItems;
+		taskCompleted(elp);
+		if (!*eh && eno) *eh = SEV_Exception_capture(eno);
+	}
+	return success;
+}
+
+bool popInjected(WorkStealingEventLoop *elp, WorkStealingWorker *worker, SEV_ExceptionHandle *eh)
+{
+	// Own node first, then the shared queue, then the other nodes
+	EventFunctorQueue *queue;
+	if (elp->NbNodes > 1 && (queue = elp->NodeQueues[worker->Node].load(std::memory_order_acquire)))
+	{
+		if (tryCallAndPop(elp, queue, eh) || *eh)
+			return true;
+	}
+	if (tryCallAndPop(elp, &elp->Queue, eh) || *eh)
+		return true;
+	for (int node = 0; node < elp->NbNodes && elp->NbNodes > 1; ++node)
+	{
+		if (node != worker->Node && (queue = elp->NodeQueues[node].load(std::memory_order_acquire)))
+		{
+			if (tryCallAndPop(elp, queue, eh) || *eh)
+				return true;
+		}
+	}
+	return false;
+}
+
+void runTask(WorkStealingEventLoop *elp, WorkStealingTask *task, SEV_ExceptionHandle *eh)
+{
+	--elp->Pending;
+	t_Metrics->Running.store(task->Vt, std::memory_order_relaxed);
+	errno_t eno = ((sev::EventFunctorVt *)task->Vt)->invoke(task->data(), *(sev::ExceptionHandle *)eh, *elp);
+	task->Vt->Destroy(task->data());
+	freeTask(task);
+	--elp->QueueItems;
+	taskCompleted(elp);
+	if (!*eh && eno) *eh = SEV_Exception_capture(eno);
+}
+
+} /* anonymous namespace */
+
+WorkStealingEventLoop::~WorkStealingEventLoop()
+{
+	const int nbWorkers = NbWorkers.load(std::memory_order_acquire);
+	for (int i = 0; i < nbWorkers; ++i)
+	{
+		WorkStealingWorker *worker = Workers[i].load(std::memory_order_relaxed);
+		WorkStealingTask *task;
+		while (worker->Deque.pop(task))
+		{
+			task->Vt->Destroy(task->data());
+			freeTask(task);
+		}
+		delete worker;
+	}
+	for (std::atomic<EventFunctorQueue *> &queue : NodeQueues)
+		delete queue.load(std::memory_order_relaxed);
+}
+
+SEV_EventLoopVt WorkStealingEventLoopVt = {
+	SEV_IMPL_WorkStealingEventLoop_destroy,
+
+	SEV_IMPL_EventLoopBase_post,
+	SEV_IMPL_EventLoopBase_invoke,
+	SEV_IMPL_EventLoopBase_timeout,
+	SEV_IMPL_EventLoopBase_interval,
+
+	SEV_IMPL_WorkStealingEventLoop_postFunctor,
+	SEV_IMPL_WorkStealingEventLoop_invokeFunctor,
+	SEV_IMPL_EventLoopBase_timeoutFunctor,
+	SEV_IMPL_EventLoopBase_intervalFunctor,
+
+	SEV_IMPL_EventLoop_join,
+
+	SEV_IMPL_EventLoop_run, // Run
+	SEV_IMPL_WorkStealingEventLoop_loop, // Loop
+	SEV_IMPL_WorkStealingEventLoop_stop, // Stop
+
+	SEV_IMPL_EventLoop_runOnCpus, // RunOnCpus
+	SEV_IMPL_EventLoop_setWaitPolicy, // SetWaitPolicy
+
+	SEV_IMPL_EventLoop_watchFd, // WatchFd
+	SEV_IMPL_EventLoop_modifyFd, // ModifyFd
+	SEV_IMPL_EventLoop_unwatchFd, // UnwatchFd
+
+	SEV_IMPL_EventLoop_runElastic, // RunElastic
+
+};
+
+}
+
+SEV_EventLoop *SEV_WorkStealingEventLoop_create()
+{
+	try
+	{
+		return new sev::impl::el::WorkStealingEventLoop();
+	}
+	catch (...)
+	{
+		return null;
+	}
+}
+
+void SEV_IMPL_WorkStealingEventLoop_destroy(SEV_EventLoop *el)
+{
+	sev::impl::el::timerRelease((sev::impl::el::EventLoopBase *)el);
+	el->Vt->Stop(el);
+	delete (sev::impl::el::WorkStealingEventLoop *)el;
+}
+
+namespace /* anonymous */ {
+
+errno_t postDirect(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	using namespace sev::impl::el;
+	WorkStealingEventLoop *elp = (WorkStealingEventLoop *)el;
+	if (t_Loop == elp)
+	{
+		// Posted from one of our own workers, keep it local
+		WorkStealingTask *task = allocTask(vt->Size);
+		if (!task) return ENOMEM;
+		try
+		{
+			forwardConstructor(task->data(), ptr);
+		}
+		catch (...)
+		{
+			freeTask(task);
+			return EOTHER;
+		}
+		task->Vt = vt;
+		++elp->QueueItems;
+		++elp->Pending;
+		try
+		{
+			t_Worker->Deque.push(task);
+		}
+		catch (...)
+		{
+			--elp->Pending;
+			--elp->QueueItems;
+			vt->Destroy(task->data());
+			freeTask(task);
+			return ENOMEM;
+		}
+		++elp->Posted;
+	}
+	else
+	{
+		EventFunctorQueue *queue = elp->NbNodes > 1 ? elp->NodeQueues[SEV_Numa_currentNode()].load(std::memory_order_acquire) : null;
+		if (!queue) queue = &elp->Queue;
+		++elp->QueueItems;
+		++elp->Pending;
+		errno_t res = SEV_ConcurrentFunctorQueue_pushFunctor(queue->get(), vt, ptr, forwardConstructor);
+		if (res)
+		{
+			--elp->Pending;
+			--elp->QueueItems;
+			return res;
+		}
+		++elp->Posted;
+	}
+	if (elp->ThreadsWaiting) // Pairs with the Pending check when parking
+		wakeOne(elp);
+	return 0;
+}
+
+errno_t postMeasured(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	sev::impl::el::WorkStealingEventLoop *elp = (sev::impl::el::WorkStealingEventLoop *)el;
+	if (elp->MetricsEnabled.load(std::memory_order_relaxed) || elp->Tracing.load(std::memory_order_relaxed))
+		return sev::impl::el::postInstrumented(elp, vt, ptr, forwardConstructor, postDirect);
+	return postDirect(el, vt, ptr, forwardConstructor);
+}
+
+}
+
+errno_t SEV_IMPL_WorkStealingEventLoop_postFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	sev::impl::el::WorkStealingEventLoop *elp = (sev::impl::el::WorkStealingEventLoop *)el;
+	if (elp->Barriers.load(std::memory_order_relaxed))
+		return sev::impl::el::postLate(elp, vt, ptr, forwardConstructor, postMeasured);
+	return postMeasured(el, vt, ptr, forwardConstructor);
+}
+
+void SEV_IMPL_WorkStealingEventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *vt, void *ptr)
+{
+	// NOTE: Invoke catches any errors, and passes them down!
+	SEV_ASSERT(eh);
+	SEV_ASSERT(!*eh);
+	if (sev::impl::el::t_CurrentLoop == (sev::impl::el::EventLoopBase *)el)
+	{
+		// Called from a worker of this loop, run on its stack
+		errno_t res = ((sev::EventFunctorVt *)vt)->invoke(ptr, *(sev::ExceptionHandle *)eh, *el);
+		if (!*eh && res) *eh = SEV_Exception_capture(res);
+		return;
+	}
+	sev::EventFlag flag;
+	auto call = [=, &flag](sev::EventLoop &elref) -> errno_t {
+		errno_t res = ((sev::EventFunctorVt *)vt)->invoke(ptr, *(sev::ExceptionHandle *)eh, elref);
+		if (!*eh && res) *eh = SEV_Exception_capture(res);
+		flag.set();
+		return SEV_ESUCCESS;
+	};
+	sev::EventFunctorView fv = std::move(call);
+	const sev::EventFunctorVt *fvt;
+	void *fptr;
+	bool movable;
+	fv.extract(fvt, fptr, movable, true);
+	errno_t eno = SEV_IMPL_WorkStealingEventLoop_postFunctor(el, fvt->get(), fptr, movable ? fvt->get()->MoveConstructor : fvt->get()->CopyConstructor);
+	if (eno)
+		*eh = SEV_Exception_capture(eno);
+	else
+		flag.wait();
+}
+
+void SEV_IMPL_WorkStealingEventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh)
+{
+	using namespace sev::impl::el;
+	WorkStealingEventLoop *elp = (WorkStealingEventLoop *)el;
+	if (elp->Stopping)
+		return;
+	elp->Running = true;
+	if (elp->Stopping)
+	{
+		elp->Running = false;
+		return;
+	}
+	WorkStealingWorker *worker = acquireWorker(elp);
+	if (!worker)
+	{
+		*eh = SEV_Exception_capture(ENOMEM);
+		return;
+	}
+	MetricsSlot *const metrics = acquireMetrics(elp);
+	if (!metrics)
+	{
+		worker->Active = false;
+		*eh = SEV_Exception_capture(ENOMEM);
+		return;
+	}
+	WorkStealingEventLoop *const prevLoop = t_Loop;
+	WorkStealingWorker *const prevWorker = t_Worker;
+	EventLoopBase *const prevCurrent = t_CurrentLoop;
+	t_Loop = elp;
+	t_Worker = worker;
+	t_CurrentLoop = elp;
+	MetricsSlot *const prevMetrics = t_Metrics;
+	t_Metrics = metrics;
+	++elp->Threads;
+#ifdef SEV_EVENT_LOOP_EPOLL
+	int sincePoll = 0;
+#endif
+	while (elp->Running)
+	{
+#ifdef SEV_EVENT_LOOP_EPOLL
+		if (++sincePoll >= c_PollInterval)
+		{
+			// No thread parks while the loop is saturated, so poll the watched fds here
+			sincePoll = 0;
+			pollNow(elp);
+		}
+#endif
+		if (elp->Pending)
+		{
+			// Local deque first, then the injection queue, then steal from the other workers
+			const bool timed = elp->MetricsEnabled.load(std::memory_order_relaxed);
+			std::chrono::steady_clock::time_point start;
+			if (timed) start = std::chrono::steady_clock::now();
+			WorkStealingTask *task;
+			bool found = worker->Deque.pop(task);
+			if (!found)
+			{
+				bool success = popInjected(elp, worker, eh);
+				if (success || *eh)
+				{
+					metricsAdd<uint64_t>(metrics->Tasks, 1);
+					if (timed) metricsTask(metrics, start);
+				}
+				if (*eh) break; // Break out of loop due to error!
+				if (success) continue;
+				found = stealTask(elp, worker, task);
+			}
+			if (found)
+			{
+				runTask(elp, task, eh);
+				metricsAdd<uint64_t>(metrics->Tasks, 1);
+				if (timed) metricsTask(metrics, start);
+				if (*eh) break; // Break out of loop due to error!
+				continue;
+			}
+			if (elp->Pending)
+			{
+				// Functors are being pushed, or a steal lost a race. Functors which are already running do not count, so this does not spin behind a long functor
+				SEV_Thread_yield();
+				continue;
+			}
+		}
+
+		// Wait
+		metrics->Running.store(null, std::memory_order_relaxed);
+		const bool idle = elp->SpinAdaptive;
+		const bool timed = elp->MetricsEnabled.load(std::memory_order_relaxed);
+		std::chrono::steady_clock::time_point idleStart;
+		if (idle || timed) idleStart = std::chrono::steady_clock::now();
+		if (!spinWait(elp))
+		{
+			if (parkOrRetire(elp, &worker->Parking))
+				break; // Elastic thread retired
+			metricsAdd<uint64_t>(metrics->Wakeups, 1);
+		}
+		if (idle) idleEnded(elp, idleStart);
+		if (timed) metricsAdd<int64_t>(metrics->IdleNs, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - idleStart).count());
+	}
+	--elp->Threads;
+	metrics->Running.store(null, std::memory_order_relaxed);
+	worker->Active = false;
+	t_Loop = prevLoop;
+	t_Worker = prevWorker;
+	t_CurrentLoop = prevCurrent;
+	t_Metrics = prevMetrics;
+	releaseMetrics(elp, metrics);
+	elp->LoopEndedFlag.set();
+}
+
+void SEV_IMPL_WorkStealingEventLoop_stop(SEV_EventLoop *el)
+{
+	sev::impl::el::WorkStealingEventLoop *elp = (sev::impl::el::WorkStealingEventLoop *)el;
+	elp->Stopping = true;
+	elp->Running = false;
+	SEV_IMPL_EventLoop_stop(el); // Wakes parked workers
+}
+
+/* end of file */
@@ -0,0 +1,126 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Work-stealing event loop.
+Functors posted from outside and from the workers all run once, join waits
+for them, and idle workers do not spin while a long functor runs.
+*/
+
+#include <sev/event_loop.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+#ifdef __linux__
+static int64_t cpuTimeMs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+#endif
+
+int main()
+{
+	sev::EventLoop *el = SEV_WorkStealingEventLoop_create();
+	TEST_CHECK(el);
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	{
+		// Outside posts go to the injection queue, the nested posts to the local deques
+		std::atomic_int count = 0;
+		for (int i = 0; i < 1000; ++i)
+		{
+			TEST_CHECK(!sev::post(*el, [&count](sev::EventLoop &el) -> errno_t {
+				for (int j = 0; j < 100; ++j)
+				{
+					errno_t eno = sev::post(el, [&count](sev::EventLoop &) -> errno_t {
+						++count;
+						return 0;
+					});
+					if (eno) return eno;
+				}
+				++count;
+				return 0;
+			}));
+		}
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		std::cout << "Count: " << count << std::endl;
+		TEST_CHECK(count == 1000 * 101);
+	}
+
+#ifdef __linux__
+	{
+		// The other workers park while one functor runs for a while
+		std::atomic_bool started = false;
+		TEST_CHECK(!sev::post(*el, [&started](sev::EventLoop &) -> errno_t {
+			started = true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(300));
+			return 0;
+		}));
+		while (!started) std::this_thread::yield();
+		const int64_t cpuStart = cpuTimeMs();
+		TEST_CHECK(!SEV_EventLoop_join(el, false));
+		const int64_t cpuMs = cpuTimeMs() - cpuStart;
+		std::cout << "CPU time while one functor runs: " << cpuMs << "ms" << std::endl;
+		TEST_CHECK(cpuMs < 100);
+	}
+#endif
+
+	{
+		// Workers that left the loop are reused by the next threads
+		SEV_EventLoop_stop(el);
+		for (int i = 0; i < 4; ++i)
+			TEST_CHECK(!run(*el));
+		std::atomic_int count = 0;
+		for (int i = 0; i < 10000; ++i)
+		{
+			TEST_CHECK(!sev::post(*el, [&count](sev::EventLoop &) -> errno_t {
+				++count;
+				return 0;
+			}));
+		}
+		TEST_CHECK(!SEV_EventLoop_join(el, false));
+		TEST_CHECK(count == 10000);
+	}
+
+	SEV_EventLoop_destroy(el);
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
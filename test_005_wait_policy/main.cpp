@@ -0,0 +1,140 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Wait policy of the event loop.
+Idle threads spin, yield, then park. They stop spinning while a long functor
+runs, and with an adaptive policy the spin shrinks when work arrives rarely.
+*/
+
+#include <sev/event_loop.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+#ifdef __linux__
+static int64_t cpuTimeMs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// CPU time used by the loop threads while a functor is posted every few milliseconds
+static int64_t sparseWorkCpuMs(sev::EventLoop *el)
+{
+	std::atomic_int count = 0;
+	const int64_t cpuStart = cpuTimeMs();
+	for (int i = 0; i < 20; ++i)
+	{
+		sev::post(*el, [&count](sev::EventLoop &) -> errno_t {
+			++count;
+			return 0;
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	SEV_EventLoop_join(el, false);
+	return count == 20 ? cpuTimeMs() - cpuStart : -1;
+}
+#endif
+
+int main()
+{
+	sev::EventLoop *el = SEV_EventLoop_create();
+	TEST_CHECK(el);
+
+	SEV_EventLoopWaitPolicy policy = {};
+	policy.SpinIterations = -1;
+	TEST_CHECK(SEV_EventLoop_setWaitPolicy(el, &policy) == EINVAL);
+	policy.SpinIterations = 4096;
+	policy.YieldIterations = 64;
+	TEST_CHECK(!SEV_EventLoop_setWaitPolicy(el, &policy));
+	for (int i = 0; i < 2; ++i)
+		TEST_CHECK(!run(*el));
+
+	{
+		std::atomic_int count = 0;
+		for (int i = 0; i < 10000; ++i)
+		{
+			TEST_CHECK(!sev::post(*el, [&count](sev::EventLoop &) -> errno_t {
+				++count;
+				return 0;
+			}));
+		}
+		TEST_CHECK(!SEV_EventLoop_join(el, false));
+		TEST_CHECK(count == 10000);
+	}
+
+#ifdef __linux__
+	{
+		// The other thread spins once, then parks, instead of spinning until the running functor returns
+		std::atomic_bool started = false;
+		TEST_CHECK(!sev::post(*el, [&started](sev::EventLoop &) -> errno_t {
+			started = true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(300));
+			return 0;
+		}));
+		while (!started) std::this_thread::yield();
+		const int64_t cpuStart = cpuTimeMs();
+		TEST_CHECK(!SEV_EventLoop_join(el, false));
+		const int64_t cpuMs = cpuTimeMs() - cpuStart;
+		std::cout << "CPU time while one functor runs: " << cpuMs << "ms" << std::endl;
+		TEST_CHECK(cpuMs < 100);
+	}
+
+	{
+		// A long spin burns most of each gap between functors, the adaptive policy shortens it to about twice the idle average, which is capped at 1ms
+		policy.SpinIterations = 1 << 22;
+		policy.YieldIterations = 0;
+		policy.Adaptive = false;
+		TEST_CHECK(!SEV_EventLoop_setWaitPolicy(el, &policy));
+		const int64_t fixedMs = sparseWorkCpuMs(el);
+		policy.Adaptive = true;
+		TEST_CHECK(!SEV_EventLoop_setWaitPolicy(el, &policy));
+		sparseWorkCpuMs(el); // Measure the spin and the idle time
+		const int64_t adaptiveMs = sparseWorkCpuMs(el);
+		std::cout << "CPU time with sparse work, fixed: " << fixedMs << "ms, adaptive: " << adaptiveMs << "ms" << std::endl;
+		TEST_CHECK(fixedMs >= 0 && adaptiveMs >= 0);
+		TEST_CHECK(adaptiveMs * 2 < fixedMs);
+	}
+#endif
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
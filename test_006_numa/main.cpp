@@ -0,0 +1,118 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+NUMA layout and thread affinity.
+Every CPU of a node maps back to that node, a pinned thread runs on the node
+of its CPU, and a loop run on a node runs its functors there.
+*/
+
+#include <sev/event_loop.h>
+#include "test_common.h"
+#include <iostream>
+#include <atomic>
+
+static errno_t runOnNode(sev::EventLoop &el, int node)
+{
+	auto onError = [](SEV_ExceptionHandle *eh) -> void {
+		std::cout << "Unexpected exception" << std::endl;
+		std::terminate();
+	};
+	sev::FunctorView<void(SEV_ExceptionHandle *)> fv = std::move(onError);
+	const sev::FunctorVt<void(SEV_ExceptionHandle *)> *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return SEV_EventLoop_runOnNode(&el, node, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+}
+
+int main()
+{
+	const int nodeCount = SEV_Numa_nodeCount();
+	std::cout << "Nodes: " << nodeCount << std::endl;
+	TEST_CHECK(nodeCount >= 1 && nodeCount <= SEV_NUMA_NODE_MAX);
+
+	int firstNode = -1;
+	int firstCpu = -1;
+	int nbCpus = 0;
+	for (int node = 0; node < nodeCount; ++node)
+	{
+		SEV_CpuSet cpus;
+		TEST_CHECK(!SEV_Numa_nodeCpus(node, &cpus));
+		std::cout << "Node " << node << ": " << SEV_CpuSet_count(&cpus) << " CPUs" << std::endl;
+		for (int cpu = 0; cpu < SEV_CPU_SET_MAX; ++cpu)
+		{
+			if (!SEV_CpuSet_contains(&cpus, cpu))
+				continue;
+			TEST_CHECK(SEV_Numa_cpuNode(cpu) == node);
+			if (firstCpu < 0)
+			{
+				firstNode = node;
+				firstCpu = cpu;
+			}
+			++nbCpus;
+		}
+	}
+	TEST_CHECK(nbCpus > 0);
+	TEST_CHECK(SEV_Numa_nodeCpus(nodeCount, null) == EINVAL);
+	const int current = SEV_Numa_currentNode();
+	TEST_CHECK(current >= 0 && current < nodeCount);
+
+	{
+		SEV_CpuSet cpus;
+		SEV_CpuSet_clear(&cpus);
+		TEST_CHECK(SEV_Thread_setAffinity(&cpus) == EINVAL);
+		SEV_CpuSet_add(&cpus, firstCpu);
+		TEST_CHECK(!SEV_Thread_setAffinity(&cpus));
+		TEST_CHECK(SEV_Numa_currentNode() == firstNode);
+	}
+
+	{
+		sev::EventLoop *el = SEV_EventLoop_create();
+		TEST_CHECK(el);
+		TEST_CHECK(runOnNode(*el, nodeCount) == EINVAL);
+		TEST_CHECK(!runOnNode(*el, firstNode));
+		sev::EventFlag flag;
+		std::atomic_int node = -1;
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t {
+			node = SEV_Numa_currentNode();
+			flag.set();
+			return 0;
+		}));
+		flag.wait();
+		TEST_CHECK(node == firstNode);
+		SEV_EventLoop_stop(el);
+		SEV_EventLoop_destroy(el);
+	}
+
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,147 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Fd readiness on the event loops.
+A watched pipe calls its functor when data arrives, never concurrently with
+itself, and the watch can be changed and removed.
+*/
+
+#include <sev/event_loop.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+template<typename TFn>
+static errno_t watchFd(sev::EventLoop &el, int fd, uint32_t events, TFn &&f)
+{
+	sev::FdFunctorView fv = std::forward<TFn>(f);
+	const sev::FdFunctorVt *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return SEV_EventLoop_watchFd(&el, fd, events, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+}
+
+#ifdef __linux__
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	int fds[2];
+	TEST_CHECK(!pipe2(fds, O_NONBLOCK | O_CLOEXEC));
+
+	// Read everything on each wakeup, the watch is re-armed when the functor returns
+	std::atomic_int received = 0;
+	std::atomic_int inside = 0;
+	std::atomic_bool overlapped = false;
+	TEST_CHECK(!watchFd(*el, fds[0], SEV_FD_READ, [&](sev::EventLoop &, int fd, uint32_t events) -> errno_t {
+		if (++inside > 1) overlapped = true;
+		char buffer[256];
+		ptrdiff_t nb;
+		while ((nb = read(fd, buffer, sizeof(buffer))) > 0)
+			received += (int)nb;
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+		--inside;
+		return 0;
+	}));
+	TEST_CHECK(watchFd(*el, fds[0], SEV_FD_READ, [](sev::EventLoop &, int, uint32_t) -> errno_t { return 0; }) == EEXIST);
+
+	for (int i = 0; i < 1000; ++i)
+	{
+		char c = (char)i;
+		TEST_CHECK(write(fds[1], &c, 1) == 1);
+		if (!(i % 100)) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	for (int i = 0; i < 5000 && received < 1000; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	std::cout << "Received: " << received << std::endl;
+	TEST_CHECK(received == 1000);
+	TEST_CHECK(!overlapped);
+
+	// Write readiness, an empty pipe is writable right away
+	sev::EventFlag writable;
+	TEST_CHECK(!watchFd(*el, fds[1], 0, [&](sev::EventLoop &el, int fd, uint32_t events) -> errno_t {
+		if (events & SEV_FD_WRITE)
+		{
+			SEV_EventLoop_modifyFd(&el, fd, 0);
+			writable.set();
+		}
+		return 0;
+	}));
+	TEST_CHECK(!SEV_EventLoop_modifyFd(el, fds[1], SEV_FD_WRITE));
+	writable.wait();
+
+	TEST_CHECK(!SEV_EventLoop_unwatchFd(el, fds[0]));
+	TEST_CHECK(!SEV_EventLoop_unwatchFd(el, fds[1]));
+	TEST_CHECK(SEV_EventLoop_unwatchFd(el, fds[0]) == ENOENT);
+	TEST_CHECK(SEV_EventLoop_modifyFd(el, fds[0], SEV_FD_READ) == ENOENT);
+
+	// Nothing is delivered after unwatching
+	const int before = received;
+	char c = 0;
+	TEST_CHECK(write(fds[1], &c, 1) == 1);
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	TEST_CHECK(received == before);
+
+	close(fds[0]);
+	close(fds[1]);
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+#endif
+
+int main()
+{
+#ifdef __linux__
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+#else
+	sev::EventLoop *el = SEV_EventLoop_create();
+	TEST_CHECK(watchFd(*el, 0, SEV_FD_READ, [](sev::EventLoop &, int, uint32_t) -> errno_t { return 0; }) == ENOSYS);
+	SEV_EventLoop_destroy(el);
+#endif
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
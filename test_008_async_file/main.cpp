@@ -0,0 +1,172 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Asynchronous file I/O.
+Writes, reads, fsync and openat complete on the chosen loop with their result,
+errors come back as a negative errno, and destroy delivers what was staged.
+*/
+
+#include <sev/async_file.h>
+#include "test_common.h"
+#include <iostream>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+// Completion storing its result and setting a flag
+struct Completion
+{
+	std::atomic<int64_t> Result{ INT64_MIN };
+	sev::EventFlag Done;
+
+	template<typename TFn>
+	errno_t stage(TFn &&f)
+	{
+		auto onDone = [this](sev::EventLoop &, int64_t result) -> errno_t {
+			Result = result;
+			Done.set();
+			return 0;
+		};
+		sev::AsyncIoFunctorView fv = std::move(onDone);
+		const sev::AsyncIoFunctorVt *vt;
+		void *ptr;
+		bool movable;
+		fv.extract(vt, ptr, movable, true);
+		return f(vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+	}
+
+	int64_t wait()
+	{
+		Done.wait();
+		return Result;
+	}
+
+};
+
+#endif
+
+int main()
+{
+#ifdef _WIN32
+	TEST_CHECK(!SEV_AsyncIo_create(64, 2));
+	TEST_CHECK(errno == ENOSYS);
+#else
+	sev::EventLoop *el = SEV_EventLoop_create();
+	TEST_CHECK(el);
+	TEST_CHECK(!run(*el));
+
+	SEV_AsyncIo *aio = SEV_AsyncIo_create(64, 2);
+	TEST_CHECK(aio);
+	std::cout << (SEV_AsyncIo_isUring(aio) ? "io_uring" : "Thread pool") << std::endl;
+
+	char dir[] = "/tmp/sev_test_008_XXXXXX";
+	TEST_CHECK(mkdtemp(dir));
+	const std::string path = std::string(dir) + "/file";
+
+	// Open
+	Completion opened;
+	TEST_CHECK(!opened.stage([&](const SEV_FunctorVt *vt, void *ptr, void(*fc)(void *, void *)) -> errno_t {
+		return SEV_AsyncIo_openAt(aio, el, AT_FDCWD, path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600, vt, ptr, fc);
+	}));
+	TEST_CHECK(!SEV_AsyncIo_submit(aio));
+	const int fd = (int)opened.wait();
+	TEST_CHECK(fd >= 0);
+
+	// Write two halves in one submit, then sync
+	const std::string text = "The quick brown fox jumps over the lazy dog";
+	const size_t half = text.size() / 2;
+	Completion write1, write2, synced;
+	TEST_CHECK(!write1.stage([&](const SEV_FunctorVt *vt, void *ptr, void(*fc)(void *, void *)) -> errno_t {
+		return SEV_AsyncIo_writeAt(aio, el, fd, text.data(), half, 0, vt, ptr, fc);
+	}));
+	TEST_CHECK(!write2.stage([&](const SEV_FunctorVt *vt, void *ptr, void(*fc)(void *, void *)) -> errno_t {
+		return SEV_AsyncIo_writeAt(aio, el, fd, text.data() + half, text.size() - half, (int64_t)half, vt, ptr, fc);
+	}));
+	TEST_CHECK(!SEV_AsyncIo_submit(aio));
+	TEST_CHECK(write1.wait() == (int64_t)half);
+	TEST_CHECK(write2.wait() == (int64_t)(text.size() - half));
+	TEST_CHECK(!synced.stage([&](const SEV_FunctorVt *vt, void *ptr, void(*fc)(void *, void *)) -> errno_t {
+		return SEV_AsyncIo_fsync(aio, el, fd, true, vt, ptr, fc);
+	}));
+	TEST_CHECK(!SEV_AsyncIo_submit(aio));
+	TEST_CHECK(synced.wait() == 0);
+
+	// Read back through a registered buffer
+	std::vector<char> buffer(4096);
+	SEV_AsyncIoBuffer registered = { buffer.data(), buffer.size() };
+	TEST_CHECK(!SEV_AsyncIo_registerBuffers(aio, &registered, 1));
+	TEST_CHECK(SEV_AsyncIo_registerBuffers(aio, &registered, 1) == EBUSY);
+	Completion readBack;
+	TEST_CHECK(!readBack.stage([&](const SEV_FunctorVt *vt, void *ptr, void(*fc)(void *, void *)) -> errno_t {
+		return SEV_AsyncIo_readAtFixed(aio, el, fd, 0, 16, buffer.size() - 16, 4, vt, ptr, fc);
+	}));
+	TEST_CHECK(!SEV_AsyncIo_submit(aio));
+	TEST_CHECK(readBack.wait() == (int64_t)text.size() - 4);
+	TEST_CHECK(std::string(buffer.data() + 16, text.size() - 4) == text.substr(4));
+	Completion invalid;
+	TEST_CHECK(invalid.stage([&](const SEV_FunctorVt *vt, void *ptr, void(*fc)(void *, void *)) -> errno_t {
+		return SEV_AsyncIo_readAtFixed(aio, el, fd, 1, 0, 16, 0, vt, ptr, fc);
+	}) == EINVAL);
+
+	// Errors complete with a negative errno
+	Completion bad;
+	TEST_CHECK(!bad.stage([&](const SEV_FunctorVt *vt, void *ptr, void(*fc)(void *, void *)) -> errno_t {
+		return SEV_AsyncIo_readAt(aio, el, -1, buffer.data(), 16, 0, vt, ptr, fc);
+	}));
+	TEST_CHECK(!SEV_AsyncIo_submit(aio));
+	TEST_CHECK(bad.wait() == -EBADF);
+
+	// Destroy sends what is still staged, and waits for its completion
+	Completion last;
+	TEST_CHECK(!last.stage([&](const SEV_FunctorVt *vt, void *ptr, void(*fc)(void *, void *)) -> errno_t {
+		return SEV_AsyncIo_readAt(aio, el, fd, buffer.data(), 3, 0, vt, ptr, fc);
+	}));
+	SEV_AsyncIo_destroy(aio);
+	TEST_CHECK(last.wait() == 3);
+	TEST_CHECK(std::string(buffer.data(), 3) == "The");
+
+	close(fd);
+	unlink(path.c_str());
+	rmdir(dir);
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+#endif
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,342 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Loopback sockets.
+A TCP stream echoes through an accepted connection, destroying a stream from
+its own callback stops the callbacks, the acceptor doesn't spin when out of
+fds, and UDP datagrams arrive with their source address.
+*/
+
+#include <sev/socket.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <mutex>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#endif
+
+template<typename TFn>
+static errno_t listen(sev::TcpAcceptor **acceptor, sev::EventLoop &el, const sev::SocketAddress &address, TFn &&f)
+{
+	sev::AcceptFunctorView fv = std::forward<TFn>(f);
+	const sev::AcceptFunctorVt *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return SEV_TcpAcceptor_create(acceptor, &el, &address, 64, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+}
+
+template<typename TFn>
+static errno_t stream(sev::TcpStream **stream, sev::EventLoop &el, int fd, const sev::SocketAddress *address, TFn &&f)
+{
+	sev::TcpStreamFunctorView fv = std::forward<TFn>(f);
+	const sev::TcpStreamFunctorVt *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return address
+		? SEV_TcpStream_connect(stream, &el, address, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor)
+		: SEV_TcpStream_create(stream, &el, fd, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+}
+
+template<typename TFn>
+static errno_t udp(sev::UdpEndpoint **endpoint, sev::EventLoop &el, const sev::SocketAddress &address, TFn &&f)
+{
+	sev::UdpFunctorView fv = std::forward<TFn>(f);
+	const sev::UdpFunctorVt *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return SEV_UdpEndpoint_create(endpoint, &el, &address, 1500, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+}
+
+#ifdef __linux__
+
+static int64_t cpuTimeNs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int highestFd()
+{
+	int highest = 0;
+	DIR *dir = opendir("/proc/self/fd");
+	if (!dir) return 1023;
+	while (dirent *entry = readdir(dir))
+	{
+		int fd = atoi(entry->d_name);
+		if (fd > highest) highest = fd;
+	}
+	closedir(dir);
+	return highest;
+}
+
+static void wait(const std::atomic_bool &cond, int ms = 5000)
+{
+	for (int i = 0; i < ms && !cond; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+struct Server
+{
+	std::mutex Mutex;
+	std::vector<sev::TcpStream *> Streams;
+	std::atomic_int Accepted = 0;
+
+};
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	sev::SocketAddress any;
+	TEST_CHECK(!SEV_SocketAddress_parse(&any, "127.0.0.1", 0));
+	sev::SocketAddress invalid;
+	TEST_CHECK(SEV_SocketAddress_parse(&invalid, "localhost", 0) == EINVAL);
+
+	// Echo server, or sends a large block right away when the peer asks for it by sending 'B'
+	Server server;
+	std::vector<uint8_t> block(1024 * 1024);
+	for (size_t i = 0; i < block.size(); ++i)
+		block[i] = (uint8_t)(i * 7);
+	sev::TcpAcceptor *acceptor;
+	TEST_CHECK(!listen(&acceptor, *el, any, [&](sev::EventLoop &el, int fd, const sev::SocketAddress *peer) -> errno_t {
+		sev::TcpStream *s;
+		errno_t eno = stream(&s, el, fd, null, [&](sev::EventLoop &, sev::TcpStream *s, int event, const void *data, ptrdiff_t size) -> errno_t {
+			if (event == SEV_TCP_STREAM_DATA)
+			{
+				if (size == 1 && *(const char *)data == 'B')
+					return SEV_TcpStream_write(s, block.data(), block.size());
+				return SEV_TcpStream_write(s, data, size);
+			}
+			return 0;
+		});
+		if (eno) return eno;
+		std::unique_lock<std::mutex> lock(server.Mutex);
+		server.Streams.push_back(s);
+		++server.Accepted;
+		return 0;
+	}));
+	sev::SocketAddress address;
+	TEST_CHECK(!SEV_TcpAcceptor_address(acceptor, &address));
+	TEST_CHECK(SEV_SocketAddress_port(&address) > 0);
+
+	// Echo, written before the connection is established, destroyed from the callback receiving the last byte
+	{
+		std::atomic_bool connected = false;
+		std::atomic_bool done = false;
+		std::atomic_bool afterDestroy = false;
+		std::atomic_bool mismatch = false;
+		size_t received = 0;
+		const size_t total = 256 * 1024;
+		sev::TcpStream *client;
+		TEST_CHECK(!stream(&client, *el, -1, &address, [&](sev::EventLoop &, sev::TcpStream *s, int event, const void *data, ptrdiff_t size) -> errno_t {
+			if (done)
+			{
+				afterDestroy = true;
+				return 0;
+			}
+			if (event == SEV_TCP_STREAM_CONNECTED)
+				connected = true;
+			if (event == SEV_TCP_STREAM_DATA)
+			{
+				for (ptrdiff_t i = 0; i < size; ++i)
+					if (((const uint8_t *)data)[i] != (uint8_t)((received + i) * 3))
+						mismatch = true;
+				received += size;
+				if (received >= total)
+				{
+					SEV_TcpStream_destroy(s);
+					done = true;
+				}
+			}
+			return 0;
+		}));
+		std::vector<uint8_t> data(total);
+		for (size_t i = 0; i < total; ++i)
+			data[i] = (uint8_t)(i * 3);
+		for (size_t offset = 0; offset < total; offset += 16 * 1024)
+			TEST_CHECK(!SEV_TcpStream_write(client, data.data() + offset, 16 * 1024));
+		wait(done);
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		std::cout << "Echoed: " << received << std::endl;
+		TEST_CHECK(connected);
+		TEST_CHECK(done);
+		TEST_CHECK(received == total);
+		TEST_CHECK(!mismatch);
+		TEST_CHECK(!afterDestroy);
+	}
+
+	// Destroyed in the first data callback while the socket still holds much more data
+	{
+		int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		TEST_CHECK(fd >= 0);
+		int rcvbuf = (int)block.size();
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		TEST_CHECK(!connect(fd, (const sockaddr *)address.Data, (socklen_t)address.Length));
+		TEST_CHECK(send(fd, "B", 1, 0) == 1);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		TEST_CHECK(!fcntl(fd, F_SETFL, O_NONBLOCK));
+		std::atomic_bool done = false;
+		std::atomic_int calls = 0;
+		sev::TcpStream *client;
+		TEST_CHECK(!stream(&client, *el, fd, null, [&](sev::EventLoop &, sev::TcpStream *s, int event, const void *data, ptrdiff_t size) -> errno_t {
+			++calls;
+			SEV_TcpStream_destroy(s);
+			done = true;
+			return 0;
+		}));
+		wait(done);
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		TEST_CHECK(done);
+		TEST_CHECK(calls == 1);
+	}
+
+	// Out of fds, the pending connections can't be accepted and the acceptor must not spin meanwhile
+	{
+		const int accepted = server.Accepted;
+		int clients[4];
+		for (int i = 0; i < 4; ++i)
+			TEST_CHECK((clients[i] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0);
+		rlimit limit;
+		TEST_CHECK(!getrlimit(RLIMIT_NOFILE, &limit));
+		rlimit lowered = limit;
+		lowered.rlim_cur = highestFd() + 1;
+		TEST_CHECK(!setrlimit(RLIMIT_NOFILE, &lowered));
+		std::vector<int> fillers; // The fds closed earlier are still below the limit
+		for (int fd; (fd = dup(0)) >= 0; )
+			fillers.push_back(fd);
+		for (int i = 0; i < 4; ++i)
+			TEST_CHECK(!connect(clients[i], (const sockaddr *)address.Data, (socklen_t)address.Length));
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		const int64_t start = cpuTimeNs();
+		std::this_thread::sleep_for(std::chrono::milliseconds(300));
+		const int64_t cpu = cpuTimeNs() - start;
+		for (int fd : fillers)
+			close(fd);
+		TEST_CHECK(!setrlimit(RLIMIT_NOFILE, &limit));
+		std::cout << "CPU while out of fds: " << cpu / 1000000 << "ms" << std::endl;
+		TEST_CHECK(server.Accepted == accepted);
+		TEST_CHECK(cpu < 100 * 1000000);
+		for (int i = 0; i < 500 && server.Accepted < accepted + 4; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		TEST_CHECK(server.Accepted == accepted + 4);
+		for (int i = 0; i < 4; ++i)
+			close(clients[i]);
+	}
+
+	// Datagrams
+	{
+		std::atomic_bool done = false;
+		std::atomic_int received = 0;
+		std::atomic_int source = 0;
+		sev::UdpEndpoint *a;
+		sev::UdpEndpoint *b;
+		TEST_CHECK(!udp(&a, *el, any, [](sev::EventLoop &, sev::UdpEndpoint *, const sev::Datagram *, int) -> errno_t { return 0; }));
+		TEST_CHECK(!udp(&b, *el, any, [&](sev::EventLoop &, sev::UdpEndpoint *, const sev::Datagram *datagrams, int count) -> errno_t {
+			for (int i = 0; i < count; ++i)
+			{
+				if (datagrams[i].Size == 4 && *(const int *)datagrams[i].Data == received)
+					++received;
+				source = SEV_SocketAddress_port(&datagrams[i].Address);
+			}
+			if (received == 100)
+				done = true;
+			return 0;
+		}));
+		sev::SocketAddress fromA, toB;
+		TEST_CHECK(!SEV_UdpEndpoint_address(a, &fromA));
+		TEST_CHECK(!SEV_UdpEndpoint_address(b, &toB));
+		int values[100];
+		sev::Datagram datagrams[100];
+		for (int i = 0; i < 100; ++i)
+		{
+			values[i] = i;
+			datagrams[i].Data = &values[i];
+			datagrams[i].Size = sizeof(int);
+			datagrams[i].Address = toB;
+		}
+		int sent = 0;
+		TEST_CHECK(!SEV_UdpEndpoint_send(a, datagrams, 100, &sent));
+		TEST_CHECK(sent == 100);
+		wait(done);
+		TEST_CHECK(received == 100);
+		TEST_CHECK(source == SEV_SocketAddress_port(&fromA));
+		SEV_UdpEndpoint_destroy(a);
+		SEV_UdpEndpoint_destroy(b);
+	}
+
+	SEV_TcpAcceptor_destroy(acceptor);
+	{
+		std::unique_lock<std::mutex> lock(server.Mutex);
+		for (sev::TcpStream *s : server.Streams)
+			SEV_TcpStream_destroy(s);
+	}
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+#endif
+
+int main()
+{
+#ifdef __linux__
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+#else
+	sev::EventLoop *el = SEV_EventLoop_create();
+	sev::SocketAddress address;
+	TEST_CHECK(!SEV_SocketAddress_parse(&address, "127.0.0.1", 0));
+	sev::TcpAcceptor *acceptor;
+	TEST_CHECK(listen(&acceptor, *el, address, [](sev::EventLoop &, int, const sev::SocketAddress *) -> errno_t { return 0; }) == ENOSYS);
+	SEV_EventLoop_destroy(el);
+#endif
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,163 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Coroutines on the event loops.
+Tasks hop between loop threads, await each other, sleep, and propagate
+exceptions to the awaiting coroutine. Built as C++20.
+*/
+
+#include <sev/coroutine.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+#ifdef SEV_COROUTINE
+
+static void wait(const std::atomic_int &count, int expected, int ms = 10000)
+{
+	for (int i = 0; i < ms && count < expected; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static sev::Task<int> square(sev::EventLoop &el, int v)
+{
+	co_await sev::schedule(el);
+	co_return v * v;
+}
+
+static sev::Task<> fail(sev::EventLoop &el)
+{
+	co_await sev::schedule(el);
+	throw std::runtime_error("fail");
+}
+
+// Each hop posts the frame to another thread, which may resume it before the awaiter returns
+static sev::Task<> hop(sev::EventLoop &el, int hops, std::atomic_int &done)
+{
+	for (int i = 0; i < hops; ++i)
+		co_await sev::schedule(el);
+	++done;
+}
+
+static sev::Task<> chain(sev::EventLoop &el, std::atomic_int &sum, std::atomic_int &caught, std::atomic_int &done)
+{
+	for (int i = 1; i <= 10; ++i)
+		sum += co_await square(el, i);
+	try
+	{
+		co_await fail(el);
+	}
+	catch (const std::runtime_error &)
+	{
+		++caught;
+	}
+	++done;
+}
+
+static sev::Task<> sleeper(sev::EventLoop &el, std::atomic_int &elapsedMs, std::atomic_int &done)
+{
+	auto start = std::chrono::steady_clock::now();
+	co_await sev::sleepFor(el, std::chrono::microseconds(20500));
+	elapsedMs = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	++done;
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	{
+		std::atomic_int sum = 0;
+		std::atomic_int caught = 0;
+		std::atomic_int done = 0;
+		chain(*el, sum, caught, done).start(*el);
+		wait(done, 1);
+		TEST_CHECK(done == 1);
+		TEST_CHECK(sum == 385);
+		TEST_CHECK(caught == 1);
+	}
+
+	{
+		std::atomic_int done = 0;
+		for (int i = 0; i < 1000; ++i)
+			hop(*el, 100, done).start(*el);
+		wait(done, 1000);
+		TEST_CHECK(done == 1000);
+	}
+
+	{
+		std::atomic_int elapsedMs = 0;
+		std::atomic_int done = 0;
+		sleeper(*el, elapsedMs, done).start(*el);
+		wait(done, 1);
+		std::cout << "Slept: " << elapsedMs << "ms" << std::endl;
+		TEST_CHECK(done == 1);
+		TEST_CHECK(elapsedMs >= 20);
+	}
+
+	{
+		// Never started, the frame is released with the task
+		std::atomic_int done = 0;
+		sev::Task<> task = hop(*el, 1, done);
+		task = sev::Task<>();
+		TEST_CHECK(done == 0);
+	}
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+#endif
+
+int main()
+{
+	void *frame = SEV_Coroutine_allocFrame(300);
+	TEST_CHECK(frame);
+	SEV_Coroutine_freeFrame(frame, 300);
+	TEST_CHECK(SEV_Coroutine_allocFrame(400) == frame); // Same size class, reused from the free list
+	SEV_Coroutine_freeFrame(frame, 400);
+#ifdef SEV_COROUTINE
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+#else
+	std::cout << "No coroutine support" << std::endl;
+#endif
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
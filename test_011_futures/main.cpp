@@ -0,0 +1,190 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Promises and futures.
+Continuations run on the loop with the value or pass the exception on,
+whenAll and whenAny combine futures, and all the shared state is released
+once the futures are done.
+*/
+
+#include <sev/future.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+
+// Counts live instances, captured by the continuations to find leaked state
+static std::atomic_int s_Live = 0;
+
+struct Tracked
+{
+	Tracked() { ++s_Live; }
+	Tracked(const Tracked &) { ++s_Live; }
+	Tracked(Tracked &&) noexcept { ++s_Live; }
+	~Tracked() { --s_Live; }
+
+};
+
+// The loop releases a continuation just after it sets the next future
+static bool released()
+{
+	for (int i = 0; i < 1000 && s_Live; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return !s_Live;
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	// Chained continuations, each on the loop
+	{
+		sev::Promise<int> promise;
+		Tracked tracked;
+		sev::Future<size_t> f = promise.future()
+			.then(*el, [tracked](int v) -> std::string { return std::to_string(v * 2); })
+			.then(*el, [tracked](std::string s) -> size_t { return s.size(); });
+		TEST_CHECK(!f.ready());
+		std::thread([&]() -> void { promise.setValue(12345); }).join();
+		TEST_CHECK(f.get() == 5);
+	}
+	TEST_CHECK(released());
+
+	// Continuation attached once the value is already set
+	{
+		sev::Future<int> ready = sev::makeReadyFuture<int>(7);
+		TEST_CHECK(ready.ready());
+		Tracked tracked;
+		TEST_CHECK(ready.then(*el, [tracked](int v) -> int { return v + 1; }).get() == 8);
+	}
+	TEST_CHECK(released());
+
+	// Exceptions skip the continuations
+	{
+		sev::Promise<void> promise;
+		std::atomic_bool called = false;
+		Tracked tracked;
+		sev::Future<int> f = promise.future().then(*el, [&called, tracked]() -> int { called = true; return 1; });
+		promise.setException(std::make_exception_ptr(std::runtime_error("fail")));
+		bool thrown = false;
+		try
+		{
+			f.get();
+		}
+		catch (const std::runtime_error &)
+		{
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+		TEST_CHECK(!called);
+		sev::Future<int> g = sev::makeReadyFuture<int>(1).then(*el, [tracked](int) -> int { throw std::logic_error("fail"); });
+		thrown = false;
+		try
+		{
+			g.get();
+		}
+		catch (const std::logic_error &)
+		{
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+	}
+	TEST_CHECK(released());
+
+	// A promise destroyed without a value breaks the future
+	{
+		sev::Future<int> f;
+		{
+			sev::Promise<int> promise;
+			f = promise.future();
+		}
+		bool broken = false;
+		try
+		{
+			f.get();
+		}
+		catch (const std::future_error &e)
+		{
+			broken = e.code() == std::future_errc::broken_promise;
+		}
+		TEST_CHECK(broken);
+	}
+
+	// Combined futures, completed from the loop
+	{
+		std::vector<sev::Promise<int>> promises(100);
+		std::vector<sev::Future<int>> futures;
+		for (sev::Promise<int> &promise : promises)
+			futures.push_back(promise.future().then(*el, [tracked = Tracked()](int v) -> int { return v * v; }));
+		sev::Future<std::vector<int>> all = sev::whenAll(std::move(futures));
+		for (int i = 0; i < 100; ++i)
+			TEST_CHECK(!sev::post(*el, [&promises, i](sev::EventLoop &) -> errno_t { promises[i].setValue(i); return 0; }));
+		std::vector<int> values = all.get();
+		TEST_CHECK(values.size() == 100);
+		for (int i = 0; i < 100; ++i)
+			TEST_CHECK(values[i] == i * i);
+	}
+	TEST_CHECK(released());
+
+	{
+		sev::Promise<void> slow;
+		sev::Promise<void> fast;
+		std::vector<sev::Future<void>> futures;
+		futures.push_back(slow.future().then(*el, [tracked = Tracked()]() -> void { }));
+		futures.push_back(fast.future().then(*el, [tracked = Tracked()]() -> void { }));
+		sev::Future<size_t> any = sev::whenAny(std::move(futures));
+		fast.setValue();
+		TEST_CHECK(any.get() == 1);
+		slow.setValue();
+		std::vector<sev::Future<void>> none;
+		sev::whenAll(std::move(none)).get();
+	}
+	TEST_CHECK(released());
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,155 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Parallel-for kernels.
+Each index runs exactly once across the loop threads, an exception stops the
+kernel and is rethrown, and a loop thread calling parallelFor on its own loop
+takes part instead of deadlocking.
+*/
+
+#include <sev/parallel.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+	for (int i = 0; i < 1000 && SEV_EventLoop_threads(el) < 4; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	TEST_CHECK(SEV_EventLoop_threads(el) == 4);
+	TEST_CHECK(SEV_EventLoop_current() == null);
+
+	// Every index once, spread over the threads
+	{
+		const ptrdiff_t count = 1000000;
+		std::vector<int> hits(count);
+		std::mutex mutex;
+		std::set<std::thread::id> threads;
+		sev::parallelFor(*el, 0, count, [&](ptrdiff_t i) -> void {
+			++hits[i];
+			if (!(i % 1000))
+			{
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					threads.insert(std::this_thread::get_id());
+				}
+				std::this_thread::sleep_for(std::chrono::microseconds(50)); // Long enough for the other threads to wake up
+			}
+		});
+		for (ptrdiff_t i = 0; i < count; ++i)
+			TEST_CHECK(hits[i] == 1);
+		std::cout << "Threads: " << threads.size() << std::endl;
+		TEST_CHECK(threads.size() > 1);
+	}
+
+	// Explicit grain, offset and empty ranges
+	{
+		std::atomic_ptrdiff_t sum = 0;
+		sev::parallelFor(*el, 100, 200, [&](ptrdiff_t i) -> void { sum += i; }, 7);
+		TEST_CHECK(sum == 14950);
+		sev::parallelFor(*el, 5, 5, [&](ptrdiff_t) -> void { sum = -1; });
+		TEST_CHECK(sum == 14950);
+	}
+
+	// The first exception stops the remaining chunks
+	{
+		std::atomic_ptrdiff_t ran = 0;
+		bool thrown = false;
+		try
+		{
+			sev::parallelFor(*el, 0, 100000, [&](ptrdiff_t i) -> void {
+				++ran;
+				if (i == 10) throw std::runtime_error("fail");
+			}, 10);
+		}
+		catch (const std::runtime_error &)
+		{
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+		TEST_CHECK(ran < 100000);
+	}
+
+	// Asynchronous, the continuation runs on the loop
+	{
+		std::atomic_ptrdiff_t sum = 0;
+		std::atomic<sev::EventLoop *> current = null;
+		sev::parallelForAsync(*el, 0, 1000, [&](ptrdiff_t i) -> void { sum += i; }).then(*el, [&]() -> void {
+			current = SEV_EventLoop_current();
+		}).get();
+		TEST_CHECK(sum == 499500);
+		TEST_CHECK(current == el);
+	}
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+// A single loop thread calling parallelFor on its own loop runs all the chunks itself
+static int testNested(sev::EventLoop *el)
+{
+	TEST_CHECK(!run(*el));
+	std::atomic_ptrdiff_t sum = 0;
+	sev::Promise<void> done;
+	sev::Future<void> f = done.future();
+	TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &el) -> errno_t {
+		sev::parallelFor(el, 0, 10000, [&](ptrdiff_t i) -> void { sum += i; });
+		done.setValue();
+		return 0;
+	}));
+	f.get();
+	TEST_CHECK(sum == 49995000);
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	if (testNested(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	if (testNested(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
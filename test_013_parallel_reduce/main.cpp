@@ -0,0 +1,141 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Parallel reduce and inclusive scan.
+Chunks are combined in order, so operations which are only associative give
+the sequential result, and the asynchronous reduce releases its state once
+done.
+*/
+
+#include <sev/parallel.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <numeric>
+#include <stdexcept>
+
+// Counts live instances, captured by the operation to find a leaked state
+static std::atomic_int s_Live = 0;
+
+struct Tracked
+{
+	Tracked() { ++s_Live; }
+	Tracked(const Tracked &) { ++s_Live; }
+	Tracked(Tracked &&) noexcept { ++s_Live; }
+	~Tracked() { --s_Live; }
+
+};
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	std::vector<int64_t> values(100000);
+	std::iota(values.begin(), values.end(), 1);
+
+	// Sum, and a concatenation which is associative but not commutative
+	{
+		TEST_CHECK(sev::parallelReduce(*el, values.begin(), values.end(), (int64_t)0, [](int64_t a, int64_t b) -> int64_t { return a + b; }) == 5000050000);
+		std::vector<std::string> letters;
+		for (int i = 0; i < 1000; ++i)
+			letters.push_back(std::string(1, (char)('a' + i % 26)));
+		const std::string expected = std::accumulate(letters.begin(), letters.end(), std::string());
+		TEST_CHECK(sev::parallelReduce(*el, letters.begin(), letters.end(), std::string(), [](std::string a, const std::string &b) -> std::string { return a + b; }, 7) == expected);
+		TEST_CHECK(sev::parallelReduce(*el, values.begin(), values.begin(), (int64_t)42, [](int64_t a, int64_t b) -> int64_t { return a + b; }) == 42);
+	}
+
+	// Scan into another range and in place
+	{
+		std::vector<int64_t> out(values.size());
+		TEST_CHECK(sev::parallelInclusiveScan(*el, values.begin(), values.end(), out.begin(), [](int64_t a, int64_t b) -> int64_t { return a + b; }, 333) == out.end());
+		std::vector<int64_t> expected(values.size());
+		std::partial_sum(values.begin(), values.end(), expected.begin());
+		TEST_CHECK(out == expected);
+		std::vector<int64_t> inPlace = values;
+		sev::parallelInclusiveScan(*el, inPlace.begin(), inPlace.end(), inPlace.begin(), [](int64_t a, int64_t b) -> int64_t { return a + b; });
+		TEST_CHECK(inPlace == expected);
+		std::vector<std::string> words = { "a", "b", "c", "d", "e" };
+		sev::parallelInclusiveScan(*el, words.begin(), words.end(), words.begin(), [](std::string a, const std::string &b) -> std::string { return a + b; }, 2);
+		TEST_CHECK(words.back() == "abcde" && words[2] == "abc");
+	}
+
+	// Exceptions are rethrown
+	{
+		bool thrown = false;
+		try
+		{
+			sev::parallelReduce(*el, values.begin(), values.end(), (int64_t)0, [](int64_t a, int64_t b) -> int64_t {
+				if (b == 5000) throw std::runtime_error("fail");
+				return a + b;
+			});
+		}
+		catch (const std::runtime_error &)
+		{
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+	}
+
+	// Asynchronous, the state is released once the result is taken
+	{
+		sev::Future<int64_t> f = sev::parallelReduceAsync(*el, values.begin(), values.end(), (int64_t)0, [tracked = Tracked()](int64_t a, int64_t b) -> int64_t { return a + b; });
+		TEST_CHECK(f.get() == 5000050000);
+	}
+	for (int i = 0; i < 1000 && s_Live; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	TEST_CHECK(s_Live == 0);
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+
+	// A loop with its own vtable has no thread count to report
+	SEV_EventLoopVt vt = {};
+	SEV_EventLoop custom = { &vt };
+	TEST_CHECK(SEV_EventLoop_threads(&custom) == 0);
+
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
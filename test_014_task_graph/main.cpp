@@ -0,0 +1,170 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Task graph.
+Every node runs after its predecessors, the graph runs again with the same
+nodes, a failing node skips the nodes after it, and cycles are rejected.
+*/
+
+#include <sev/task_graph.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <random>
+#include <stdexcept>
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	// Random DAG, edges only go from lower to higher nodes
+	{
+		const int count = 500;
+		std::atomic_int clock = 0;
+		std::unique_ptr<std::atomic_int[]> started(new std::atomic_int[count]);
+		std::unique_ptr<std::atomic_int[]> finished(new std::atomic_int[count]);
+		sev::TaskGraph graph;
+		for (int i = 0; i < count; ++i)
+		{
+			TEST_CHECK(graph.add([&, i](sev::EventLoop &) -> errno_t {
+				started[i] = ++clock;
+				finished[i] = ++clock;
+				return 0;
+			}) == i);
+		}
+		std::mt19937 rng(42);
+		std::vector<std::pair<int, int>> edges;
+		for (int i = 1; i < count; ++i)
+		{
+			for (int j = 0; j < 3; ++j)
+			{
+				const int before = (int)(rng() % i);
+				graph.precede(before, i);
+				edges.emplace_back(before, i);
+			}
+		}
+		TEST_CHECK(graph.size() == count);
+		for (int pass = 0; pass < 3; ++pass)
+		{
+			for (int i = 0; i < count; ++i)
+				started[i] = finished[i] = 0;
+			graph.run(*el).get();
+			for (int i = 0; i < count; ++i)
+				TEST_CHECK(finished[i] > 0);
+			for (const std::pair<int, int> &edge : edges)
+				TEST_CHECK(finished[edge.first] < started[edge.second]);
+		}
+	}
+
+	// Independent nodes run concurrently
+	{
+		std::atomic_int inside = 0;
+		std::atomic_int most = 0;
+		sev::TaskGraph graph;
+		for (int i = 0; i < 4; ++i)
+		{
+			graph.add([&](sev::EventLoop &) -> errno_t {
+				int n = ++inside;
+				for (int m = most; n > m && !most.compare_exchange_weak(m, n); );
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				--inside;
+				return 0;
+			});
+		}
+		graph.run(*el).get();
+		TEST_CHECK(most > 1);
+	}
+
+	// The first error completes the run, the nodes after it are skipped
+	{
+		std::atomic_int ran = 0;
+		sev::TaskGraph graph;
+		sev::TaskGraph::Node a = graph.add([&](sev::EventLoop &) -> errno_t { ++ran; return 0; });
+		sev::TaskGraph::Node b = graph.add([&](sev::EventLoop &) -> errno_t { ++ran; return EINVAL; });
+		sev::TaskGraph::Node c = graph.add([&](sev::EventLoop &) -> errno_t { ++ran; return 0; });
+		graph.precede(a, b);
+		graph.precede(b, c);
+		bool thrown = false;
+		try
+		{
+			graph.run(*el).get();
+		}
+		catch (...)
+		{
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+		TEST_CHECK(ran == 2);
+	}
+
+	// Empty, and cyclic
+	{
+		sev::TaskGraph empty;
+		empty.run(*el).get();
+		sev::TaskGraph graph;
+		sev::TaskGraph::Node a = graph.add([](sev::EventLoop &) -> errno_t { return 0; });
+		sev::TaskGraph::Node b = graph.add([](sev::EventLoop &) -> errno_t { return 0; });
+		sev::TaskGraph::Node c = graph.add([](sev::EventLoop &) -> errno_t { return 0; });
+		graph.precede(a, b);
+		graph.precede(b, c);
+		graph.precede(c, b);
+		bool thrown = false;
+		try
+		{
+			graph.run(*el);
+		}
+		catch (const std::invalid_argument &)
+		{
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+	}
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
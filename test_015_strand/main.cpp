@@ -0,0 +1,179 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Strands.
+Functors posted to a strand never overlap and run in posting order, separate
+strands run in parallel, a busy strand yields the loop thread, and pending
+functors still run after the strand is destroyed.
+*/
+
+#include <sev/strand.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <memory>
+
+static void wait(const std::atomic_int &count, int expected, int ms = 10000)
+{
+	for (int i = 0; i < ms && count < expected; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	// Posting order per producer, and no overlap, with no locking around the state
+	{
+		const int producers = 4;
+		const int count = 20000;
+		sev::Strand strand(*el);
+		std::vector<int> last(producers, -1);
+		std::atomic_int inside = 0;
+		std::atomic_bool overlapped = false;
+		std::atomic_bool disordered = false;
+		std::atomic_bool foreign = false;
+		std::atomic_int done = 0;
+		std::vector<std::thread> threads;
+		for (int p = 0; p < producers; ++p)
+		{
+			threads.emplace_back([&, p]() -> void {
+				for (int i = 0; i < count; ++i)
+				{
+					while (strand.post([&, p, i](sev::EventLoop &) -> errno_t {
+						if (++inside > 1) overlapped = true;
+						if (!strand.runningInThisThread()) foreign = true;
+						if (last[p] != i - 1) disordered = true;
+						last[p] = i;
+						--inside;
+						++done;
+						return 0;
+					}))
+						std::this_thread::yield();
+				}
+			});
+		}
+		for (std::thread &t : threads)
+			t.join();
+		wait(done, producers * count);
+		TEST_CHECK(done == producers * count);
+		TEST_CHECK(!overlapped);
+		TEST_CHECK(!disordered);
+		TEST_CHECK(!foreign);
+		TEST_CHECK(!strand.runningInThisThread());
+	}
+
+	// Separate strands share the loop threads
+	{
+		std::atomic_int inside = 0;
+		std::atomic_int most = 0;
+		std::atomic_int done = 0;
+		std::vector<std::unique_ptr<sev::Strand>> strands;
+		for (int s = 0; s < 4; ++s)
+		{
+			strands.emplace_back(new sev::Strand(*el));
+			TEST_CHECK(!strands.back()->post([&](sev::EventLoop &) -> errno_t {
+				int n = ++inside;
+				for (int m = most; n > m && !most.compare_exchange_weak(m, n); );
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				--inside;
+				++done;
+				return 0;
+			}));
+		}
+		wait(done, 4);
+		TEST_CHECK(done == 4);
+		TEST_CHECK(most > 1);
+	}
+
+	// Still pending when destroyed
+	{
+		std::atomic_int done = 0;
+		{
+			sev::Strand strand(*el);
+			for (int i = 0; i < 1000; ++i)
+				TEST_CHECK(!strand.post([&](sev::EventLoop &) -> errno_t { ++done; return 0; }));
+		}
+		wait(done, 1000);
+		TEST_CHECK(done == 1000);
+	}
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+// On a single loop thread, functors posted to the loop run between the batches of a busy strand.
+// Not on the work-stealing loop, where the worker pops the rescheduled drain first
+static int testYield(sev::EventLoop *el)
+{
+	TEST_CHECK(!run(*el));
+	sev::Strand strand(*el, 16);
+	std::atomic_int done = 0;
+	std::atomic_int seenAt = -1;
+	for (int i = 0; i < 1000; ++i)
+	{
+		TEST_CHECK(!strand.post([&](sev::EventLoop &el) -> errno_t {
+			if (!done++)
+			{
+				return sev::post(el, [&](sev::EventLoop &) -> errno_t {
+					seenAt = done.load();
+					return 0;
+				});
+			}
+			return 0;
+		}));
+	}
+	wait(done, 1000);
+	for (int i = 0; i < 1000 && seenAt < 0; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	std::cout << "Loop functor ran after " << seenAt << " strand functors" << std::endl;
+	TEST_CHECK(seenAt > 0 && seenAt < 1000);
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	if (testYield(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,112 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Elastic thread count.
+The loop starts with the minimum number of threads, adds threads up to the
+maximum while work stays queued, and retires the extra threads once idle.
+*/
+
+#include <sev/event_loop.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+static errno_t runElastic(sev::EventLoop &el, const sev::EventLoopElasticPolicy &policy)
+{
+	auto onError = [](SEV_ExceptionHandle *eh) -> void {
+		std::cout << "Unexpected exception" << std::endl;
+		std::terminate();
+	};
+	sev::FunctorView<void(SEV_ExceptionHandle *)> fv = std::move(onError);
+	const sev::FunctorVt<void(SEV_ExceptionHandle *)> *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return SEV_EventLoop_runElastic(&el, &policy, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+}
+
+static bool waitThreads(sev::EventLoop *el, int expected, int ms)
+{
+	for (int i = 0; i < ms && SEV_EventLoop_threads(el) != expected; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return SEV_EventLoop_threads(el) == expected;
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	sev::EventLoopElasticPolicy invalid = { 2, 1, 10, 0 };
+	TEST_CHECK(runElastic(*el, invalid) == EINVAL);
+	sev::EventLoopElasticPolicy policy = { 1, 4, 20, 100 };
+	TEST_CHECK(!runElastic(*el, policy));
+	TEST_CHECK(runElastic(*el, policy) == EALREADY);
+	TEST_CHECK(waitThreads(el, 1, 1000));
+
+	// Blocking functors keep work queued, threads are added up to the maximum
+	std::atomic_int done = 0;
+	std::atomic_int most = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &el) -> errno_t {
+			const int threads = SEV_EventLoop_threads(&el);
+			for (int m = most; threads > m && !most.compare_exchange_weak(m, threads); );
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			++done;
+			return 0;
+		}));
+	}
+	for (int i = 0; i < 10000 && done < 16; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	std::cout << "Most threads: " << most << std::endl;
+	TEST_CHECK(done == 16);
+	TEST_CHECK(most > 1);
+	TEST_CHECK(most <= 4);
+
+	// Back to the minimum once idle
+	TEST_CHECK(waitThreads(el, 1, 2000));
+
+	SEV_EventLoop_stop(el);
+	TEST_CHECK(waitThreads(el, 0, 1000));
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,120 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Invoke.
+From outside, the functor runs on a loop thread and invoke returns once it is
+done. From a thread of the same loop it runs inline, so a single threaded
+loop invoking on itself does not deadlock. Errors are passed back.
+*/
+
+#include <sev/event_loop.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+template<typename TFn>
+static errno_t invoke(sev::EventLoop &el, TFn &&f)
+{
+	sev::EventFunctorView fv = std::forward<TFn>(f);
+	const sev::EventFunctorVt *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	SEV_ExceptionHandle eh = null;
+	SEV_EventLoop_invokeFunctor(&el, &eh, vt->get(), ptr);
+	return SEV_Exception_rethrow(eh);
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	TEST_CHECK(!run(*el));
+
+	// From outside the loop
+	std::atomic<sev::EventLoop *> current = null;
+	std::thread::id loopThread;
+	bool ran = false;
+	TEST_CHECK(!invoke(*el, [&](sev::EventLoop &el) -> errno_t {
+		current = SEV_EventLoop_current();
+		loopThread = std::this_thread::get_id();
+		ran = true;
+		return 0;
+	}));
+	TEST_CHECK(ran);
+	TEST_CHECK(current == el);
+	TEST_CHECK(loopThread != std::this_thread::get_id());
+	TEST_CHECK(invoke(*el, [](sev::EventLoop &) -> errno_t { return EINVAL; }) == EINVAL);
+
+	// From the only loop thread, nested
+	std::atomic_int depth = 0;
+	std::atomic_bool sameThread = true;
+	std::atomic_bool done = false;
+	std::atomic<errno_t> outerError = -1;
+	std::atomic<errno_t> nestedError = 0;
+	TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &el) -> errno_t {
+		const std::thread::id outer = std::this_thread::get_id();
+		outerError = invoke(el, [&](sev::EventLoop &el) -> errno_t {
+			++depth;
+			if (std::this_thread::get_id() != outer) sameThread = false;
+			return invoke(el, [&](sev::EventLoop &) -> errno_t {
+				++depth;
+				if (std::this_thread::get_id() != outer) sameThread = false;
+				return 0;
+			});
+		});
+		nestedError = invoke(el, [](sev::EventLoop &) -> errno_t { return ENOENT; });
+		done = true;
+		return 0;
+	}));
+	for (int i = 0; i < 5000 && !done; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	TEST_CHECK(done);
+	TEST_CHECK(!outerError);
+	TEST_CHECK(depth == 2);
+	TEST_CHECK(sameThread);
+	TEST_CHECK(nestedError == ENOENT);
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
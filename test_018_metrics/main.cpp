@@ -0,0 +1,159 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Event loop metrics.
+Functors are counted per thread, their latency and execution time land in
+the histogram buckets while timing is enabled, and the queue depth follows
+the functors that are waiting.
+*/
+
+#include <sev/event_loop.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+static uint64_t sum(const uint64_t *histogram)
+{
+	uint64_t total = 0;
+	for (int i = 0; i < SEV_EVENT_LOOP_METRICS_BUCKETS; ++i)
+		total += histogram[i];
+	return total;
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+	for (int i = 0; i < 1000 && SEV_EventLoop_threads(el) < 4; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	// Counts without timing
+	std::atomic_int done = 0;
+	for (int i = 0; i < 1000; ++i)
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t { ++done; return 0; }));
+	for (int i = 0; i < 5000 && done < 1000; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	SEV_EventLoopMetrics metrics;
+	TEST_CHECK(!SEV_EventLoop_getMetrics(el, &metrics, null, null));
+	TEST_CHECK(metrics.Total.Tasks >= 1000);
+	TEST_CHECK(sum(metrics.Total.ExecutionHistogram) == 0);
+	TEST_CHECK(metrics.Threads == 4);
+
+	// Timed, 2ms functors land around bucket 21, [2^20, 2^21) ns
+	TEST_CHECK(!SEV_EventLoop_enableMetrics(el, true));
+	done = 0;
+	for (int i = 0; i < 20; ++i)
+	{
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t {
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			++done;
+			return 0;
+		}));
+	}
+	for (int i = 0; i < 5000 && done < 20; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t { ++done; return 0; })); // Ends the idle periods
+	for (int i = 0; i < 5000 && done < 24; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	SEV_EventLoopThreadMetrics threads[4];
+	int nbThreads = 4;
+	TEST_CHECK(!SEV_EventLoop_getMetrics(el, &metrics, threads, &nbThreads));
+	TEST_CHECK(nbThreads == 4);
+	uint64_t tasks = 0;
+	for (int i = 0; i < nbThreads; ++i)
+		tasks += threads[i].Tasks;
+	TEST_CHECK(tasks == metrics.Total.Tasks);
+	TEST_CHECK(sum(metrics.Total.ExecutionHistogram) == 24);
+	TEST_CHECK(sum(metrics.Total.LatencyHistogram) == 24);
+	uint64_t slow = 0;
+	for (int i = 21; i < SEV_EVENT_LOOP_METRICS_BUCKETS; ++i)
+		slow += metrics.Total.ExecutionHistogram[i];
+	TEST_CHECK(slow == 20);
+	std::cout << "Busy: " << metrics.Total.BusyNs / 1000000 << "ms, idle: " << metrics.Total.IdleNs / 1000000 << "ms" << std::endl;
+	TEST_CHECK(metrics.Total.BusyNs >= 40 * 1000000);
+	TEST_CHECK(metrics.Total.IdleNs > 0);
+	nbThreads = 1;
+	TEST_CHECK(SEV_EventLoop_getMetrics(el, &metrics, threads, &nbThreads) == ERANGE);
+	TEST_CHECK(nbThreads == 4);
+	TEST_CHECK(!SEV_EventLoop_enableMetrics(el, false));
+
+	// Queue depth while all threads are blocked
+	std::atomic_bool release = false;
+	done = 0;
+	for (int i = 0; i < 10; ++i)
+	{
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t {
+			while (!release)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			++done;
+			return 0;
+		}));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	TEST_CHECK(!SEV_EventLoop_getMetrics(el, &metrics, null, null));
+	std::cout << "Queue depth: " << metrics.QueueDepth << std::endl;
+	TEST_CHECK(metrics.QueueDepth == 10);
+	TEST_CHECK(metrics.ThreadsWaiting == 0);
+	release = true;
+	for (int i = 0; i < 5000 && done < 10; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	TEST_CHECK(!SEV_EventLoop_getMetrics(el, &metrics, null, null));
+	TEST_CHECK(metrics.QueueDepth == 0);
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+
+	// A loop with its own vtable has no metrics
+	SEV_EventLoopVt vt = {};
+	SEV_EventLoop custom = { &vt };
+	SEV_EventLoopMetrics metrics;
+	TEST_CHECK(SEV_EventLoop_enableMetrics(&custom, true) == ENOSYS);
+	TEST_CHECK(SEV_EventLoop_getMetrics(&custom, &metrics, null, null) == ENOSYS);
+
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
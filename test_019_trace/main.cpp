@@ -0,0 +1,191 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Trace export.
+Each traced functor writes a post, a start and an end event, the trace can be
+written while threads keep tracing, and a thread alternating between loops
+keeps one ring per loop.
+*/
+
+#include <sev/event_loop.h>
+#include "test_common.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct TraceCounts
+{
+	int Threads = 0;
+	int Posts = 0;
+	int Starts = 0;
+	int Flows = 0;
+	int Ends = 0;
+	int Other = 0;
+	double MaxUs = 0;
+	bool Complete = false;
+
+};
+
+static TraceCounts readTrace(const std::string &path)
+{
+	TraceCounts counts;
+	std::ifstream f(path);
+	std::string line;
+	std::string last;
+	while (std::getline(f, line))
+	{
+		last = line;
+		if (line.find("\"ph\":\"M\"") != std::string::npos) ++counts.Threads;
+		else if (line.find("\"ph\":\"s\"") != std::string::npos) ++counts.Posts;
+		else if (line.find("\"ph\":\"B\"") != std::string::npos) ++counts.Starts;
+		else if (line.find("\"ph\":\"f\"") != std::string::npos) ++counts.Flows;
+		else if (line.find("\"ph\":\"E\"") != std::string::npos) ++counts.Ends;
+		else if (line.find("traceEvents") == std::string::npos && line.find("displayTimeUnit") == std::string::npos) ++counts.Other;
+		size_t ts = line.find("\"ts\":");
+		if (ts != std::string::npos)
+		{
+			double us = atof(line.c_str() + ts + 5);
+			if (us > counts.MaxUs || us < 0) counts.MaxUs = us < 0 ? 1e18 : us;
+		}
+	}
+	counts.Complete = last.find("displayTimeUnit") != std::string::npos;
+	return counts;
+}
+
+static void wait(const std::atomic_int &count, int expected)
+{
+	for (int i = 0; i < 5000 && count < expected; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static int testLoop(sev::EventLoop *el, const std::string &path)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+	TEST_CHECK(SEV_EventLoop_enableTracing(el, -1) == EINVAL);
+	TEST_CHECK(!SEV_EventLoop_enableTracing(el, 1000));
+
+	// Every functor posted while tracing
+	std::atomic_int done = 0;
+	for (int i = 0; i < 100; ++i)
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t { ++done; return 0; }));
+	wait(done, 100);
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	TEST_CHECK(!SEV_EventLoop_writeTrace(el, path.c_str()));
+	TraceCounts counts = readTrace(path);
+	TEST_CHECK(counts.Complete);
+	TEST_CHECK(counts.Posts == 100);
+	TEST_CHECK(counts.Starts == 100);
+	TEST_CHECK(counts.Flows == 100);
+	TEST_CHECK(counts.Ends == 100);
+	TEST_CHECK(counts.Other == 0);
+	TEST_CHECK(counts.Threads >= 2); // The posting thread, and at least one loop thread
+
+	// Written while the rings wrap around, overwritten events are left out rather than torn
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::atomic_bool stop = false;
+	std::thread poster([&]() -> void {
+		while (!stop)
+			sev::post(*el, [](sev::EventLoop &) -> errno_t { return 0; });
+	});
+	for (int i = 0; i < 20; ++i)
+	{
+		TEST_CHECK(!SEV_EventLoop_writeTrace(el, path.c_str()));
+		counts = readTrace(path);
+		const double elapsedUs = (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() + 1000000;
+		TEST_CHECK(counts.Complete);
+		TEST_CHECK(counts.Other == 0);
+		TEST_CHECK(counts.MaxUs < elapsedUs);
+	}
+	stop = true;
+	poster.join();
+
+	TEST_CHECK(!SEV_EventLoop_enableTracing(el, 0));
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+// One thread posting to two loops in turn gets one ring in each
+static int testAlternating(const std::string &path)
+{
+	sev::EventLoop *a = SEV_EventLoop_create();
+	sev::EventLoop *b = SEV_EventLoop_create();
+	TEST_CHECK(!run(*a));
+	TEST_CHECK(!run(*b));
+	TEST_CHECK(!SEV_EventLoop_enableTracing(a, 4096));
+	TEST_CHECK(!SEV_EventLoop_enableTracing(b, 4096));
+	std::atomic_int done = 0;
+	for (int i = 0; i < 1000; ++i)
+		TEST_CHECK(!sev::post(i % 2 ? *a : *b, [&](sev::EventLoop &) -> errno_t { ++done; return 0; }));
+	wait(done, 1000);
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	TEST_CHECK(!SEV_EventLoop_writeTrace(a, path.c_str()));
+	TraceCounts counts = readTrace(path);
+	TEST_CHECK(counts.Posts == 500);
+	TEST_CHECK(counts.Threads == 2);
+	TEST_CHECK(!SEV_EventLoop_writeTrace(b, path.c_str()));
+	counts = readTrace(path);
+	TEST_CHECK(counts.Posts == 500);
+	TEST_CHECK(counts.Threads == 2);
+	SEV_EventLoop_stop(a);
+	SEV_EventLoop_stop(b);
+	SEV_EventLoop_destroy(a);
+	SEV_EventLoop_destroy(b);
+	return 0;
+}
+
+int main()
+{
+	const std::string path = "test_019_trace.json";
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create(), path)) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create(), path)) return 1;
+	std::cout << "Alternating loops" << std::endl;
+	if (testAlternating(path)) return 1;
+	remove(path.c_str());
+
+	// A loop with its own vtable can't be traced
+	SEV_EventLoopVt vt = {};
+	SEV_EventLoop custom = { &vt };
+	TEST_CHECK(SEV_EventLoop_enableTracing(&custom, 1000) == ENOSYS);
+	TEST_CHECK(SEV_EventLoop_writeTrace(&custom, path.c_str()) == ENOSYS);
+
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,134 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Slow functor watchdog.
+A functor running past the threshold is reported once, fast functors are
+not reported, and stopping the watchdog stops the reports.
+*/
+
+#include <sev/event_loop.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+template<typename TFn>
+static errno_t setWatchdog(sev::EventLoop &el, int thresholdMs, TFn &&f)
+{
+	sev::FunctorView<void(const SEV_FunctorVt *, int64_t)> fv = std::forward<TFn>(f);
+	const sev::FunctorVt<void(const SEV_FunctorVt *, int64_t)> *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return SEV_EventLoop_setWatchdog(&el, thresholdMs, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+}
+
+static void wait(const std::atomic_int &count, int expected)
+{
+	for (int i = 0; i < 5000 && count < expected; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	std::atomic_int reports = 0;
+	std::atomic<int64_t> longest = 0;
+	std::atomic_bool named = true;
+	auto onSlow = [&](const SEV_FunctorVt *vt, int64_t durationMs) -> void {
+		if (!vt) named = false;
+		if (durationMs > longest) longest = durationMs;
+		++reports;
+	};
+	TEST_CHECK(setWatchdog(*el, -1, onSlow) == EINVAL);
+	TEST_CHECK(SEV_EventLoop_setWatchdog(el, 50, null, null, null) == EINVAL);
+	TEST_CHECK(!setWatchdog(*el, 50, onSlow));
+
+	// Fast functors
+	std::atomic_int done = 0;
+	for (int i = 0; i < 1000; ++i)
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t { ++done; return 0; }));
+	wait(done, 1000);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	TEST_CHECK(reports == 0);
+
+	// Two slow functors on separate threads, each reported once
+	done = 0;
+	for (int i = 0; i < 2; ++i)
+	{
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t {
+			std::this_thread::sleep_for(std::chrono::milliseconds(300));
+			++done;
+			return 0;
+		}));
+	}
+	wait(done, 2);
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	std::cout << "Reports: " << reports << ", longest: " << longest << "ms" << std::endl;
+	TEST_CHECK(reports == 2);
+	TEST_CHECK(named);
+	TEST_CHECK(longest >= 50 && longest < 300);
+
+	// Stopped
+	TEST_CHECK(!setWatchdog(*el, 0, onSlow));
+	done = 0;
+	TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t {
+		std::this_thread::sleep_for(std::chrono::milliseconds(150));
+		++done;
+		return 0;
+	}));
+	wait(done, 1);
+	TEST_CHECK(reports == 2);
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+
+	// A loop with its own vtable has no watchdog
+	SEV_EventLoopVt vt = {};
+	SEV_EventLoop custom = { &vt };
+	TEST_CHECK(setWatchdog(custom, 50, [](const SEV_FunctorVt *, int64_t) -> void { }) == ENOSYS);
+
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,196 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Join.
+Join returns once every functor posted before it completed, even when later
+functors complete first, or with empty once nothing is queued or running,
+without spinning meanwhile. Joining from a loop thread fails instead of
+deadlocking.
+*/
+
+#include <sev/event_loop.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+#ifdef __linux__
+static int64_t cpuTimeNs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+static errno_t chain(sev::EventLoop &el, std::atomic_int &count, int remaining)
+{
+	++count;
+	if (!remaining)
+		return 0;
+	return sev::post(el, [&count, remaining](sev::EventLoop &el) -> errno_t {
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+		return chain(el, count, remaining - 1);
+	});
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	// Nothing posted
+	TEST_CHECK(!SEV_EventLoop_join(el, false));
+	TEST_CHECK(!SEV_EventLoop_join(el, true));
+
+	// Completion
+	std::atomic_int done = 0;
+	for (int i = 0; i < 1000; ++i)
+	{
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+			++done;
+			return 0;
+		}));
+	}
+	TEST_CHECK(!SEV_EventLoop_join(el, false));
+	TEST_CHECK(done == 1000);
+
+	// An early functor blocks while later ones complete, and functors posted while joining are not waited for
+	{
+		std::atomic_bool release = false;
+		std::atomic_bool early = false;
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t {
+			while (!release)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			early = true;
+			return 0;
+		}));
+		std::atomic_int later = 0;
+		for (int i = 0; i < 100; ++i)
+		{
+			TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t {
+				++later;
+				return 0;
+			}));
+		}
+		std::atomic_bool joined = false;
+		std::atomic<errno_t> joinEno = 0;
+		std::atomic_bool earlySeen = false;
+		std::thread joiner([&]() -> void {
+			joinEno = SEV_EventLoop_join(el, false);
+			earlySeen = early.load();
+			joined = true;
+		});
+		for (int i = 0; i < 5000 && later < 100; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		TEST_CHECK(later == 100);
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		TEST_CHECK(!joined);
+
+		// Posted while joining, completing these does not stand in for the early one
+		for (int i = 0; i < 10; ++i)
+		{
+			TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t {
+				++later;
+				return 0;
+			}));
+		}
+		for (int i = 0; i < 5000 && later < 110; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		TEST_CHECK(later == 110);
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		TEST_CHECK(!joined);
+
+		// Posted while joining, blocks until the join returned
+		std::atomic_bool lateDone = false;
+		TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &) -> errno_t {
+			while (!joined)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			lateDone = true;
+			return 0;
+		}));
+		release = true;
+		joiner.join();
+		TEST_CHECK(!joinEno);
+		TEST_CHECK(earlySeen);
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		TEST_CHECK(lateDone);
+	}
+
+	// Functors posting more functors, empty waits for all of them
+	std::atomic_int count = 0;
+	TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &el) -> errno_t { return chain(el, count, 100); }));
+	TEST_CHECK(!SEV_EventLoop_join(el, true));
+	TEST_CHECK(count == 101);
+
+	// From a loop thread
+	std::atomic<errno_t> eno = 0;
+	TEST_CHECK(!sev::post(*el, [&](sev::EventLoop &el) -> errno_t {
+		eno = SEV_EventLoop_join(&el, false);
+		return 0;
+	}));
+	TEST_CHECK(!SEV_EventLoop_join(el, true));
+	TEST_CHECK(eno == EDEADLK);
+
+#ifdef __linux__
+	// Parked while a long functor runs
+	TEST_CHECK(!sev::post(*el, [](sev::EventLoop &) -> errno_t {
+		std::this_thread::sleep_for(std::chrono::milliseconds(300));
+		return 0;
+	}));
+	const int64_t start = cpuTimeNs();
+	TEST_CHECK(!SEV_EventLoop_join(el, false));
+	const int64_t cpu = cpuTimeNs() - start;
+	std::cout << "CPU while joining: " << cpu / 1000000 << "ms" << std::endl;
+	TEST_CHECK(cpu < 100 * 1000000);
+#endif
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
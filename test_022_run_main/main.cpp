@@ -0,0 +1,140 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Running a loop on the main thread.
+SIGINT and SIGTERM sent to the process reach the signal functor, even with
+other loop threads and the timer thread running, and stop the loop when
+there is no functor. A loop with its own vtable is not supported.
+*/
+
+#include <sev/event_loop.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#ifdef __linux__
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+template<typename TFn>
+static errno_t runMain(sev::EventLoop &el, TFn &&f)
+{
+	sev::FunctorView<errno_t(sev::EventLoop &, int)> fv = std::forward<TFn>(f);
+	const sev::FunctorVt<errno_t(sev::EventLoop &, int)> *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	SEV_ExceptionHandle eh = null;
+	SEV_EventLoop_runMain(&el, &eh, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+	return eh ? SEV_Exception_rethrow(eh) : 0;
+}
+
+static errno_t runMain(sev::EventLoop &el)
+{
+	SEV_ExceptionHandle eh = null;
+	SEV_EventLoop_runMain(&el, &eh, null, null, null);
+	return eh ? SEV_Exception_rethrow(eh) : 0;
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	// Loop threads started before, they must not take the signals
+	for (int i = 0; i < 3; ++i)
+		TEST_CHECK(!run(*el));
+
+	// Stopped from a functor
+	TEST_CHECK(!sev::post(*el, [](sev::EventLoop &el) -> errno_t {
+		SEV_EventLoop_stop(&el);
+		return 0;
+	}));
+	TEST_CHECK(!runMain(*el));
+
+#ifdef __linux__
+	// Signals to the functor, sent from the timer thread, stopping on SIGTERM
+	for (int i = 0; i < 3; ++i)
+		TEST_CHECK(!run(*el));
+	std::atomic_int interrupts = 0;
+	std::atomic_int terminates = 0;
+	TEST_CHECK(!sev::timeout(*el, [](sev::EventLoop &el) -> errno_t {
+		kill(getpid(), SIGINT);
+		return 0;
+	}, 50));
+	TEST_CHECK(!runMain(*el, [&](sev::EventLoop &el, int signo) -> errno_t {
+		if (signo == SIGINT)
+		{
+			if (++interrupts < 3)
+				kill(getpid(), SIGINT);
+			else
+				kill(getpid(), SIGTERM);
+		}
+		else if (signo == SIGTERM)
+		{
+			++terminates;
+			SEV_EventLoop_stop(&el);
+		}
+		return 0;
+	}));
+	TEST_CHECK(interrupts == 3);
+	TEST_CHECK(terminates == 1);
+
+	// Stopping without a functor
+	for (int i = 0; i < 3; ++i)
+		TEST_CHECK(!run(*el));
+	TEST_CHECK(!sev::timeout(*el, [](sev::EventLoop &el) -> errno_t {
+		kill(getpid(), SIGINT);
+		return 0;
+	}, 50));
+	TEST_CHECK(!runMain(*el));
+#endif
+
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+
+	// Loop with its own vtable
+	SEV_EventLoopVt vt = {};
+	SEV_EventLoop custom = { &vt };
+	TEST_CHECK(runMain(custom) == ENOSYS);
+
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
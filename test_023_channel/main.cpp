@@ -0,0 +1,199 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Channel.
+Values from a single producer arrive in order, values from several
+producers all arrive once, a full channel refuses values, runs of values
+are received contiguously, and every value is destroyed.
+*/
+
+#include <sev/event_loop.h>
+#include <sev/channel.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+static std::atomic_int s_Live = 0;
+
+struct Tracked
+{
+	Tracked(int v) noexcept : Value(v) { ++s_Live; }
+	Tracked(Tracked &&other) noexcept : Value(other.Value) { ++s_Live; }
+	~Tracked() { --s_Live; }
+	int Value;
+
+};
+
+template<typename TChannel>
+static void sendAll(TChannel &channel, int value)
+{
+	while (channel.emplace(value) == EAGAIN)
+		std::this_thread::yield();
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	// Single producer, in order
+	{
+		constexpr int count = 100000;
+		std::atomic_int received = 0;
+		std::atomic_bool ordered = true;
+		int expected = 0; // Only touched by the drain, which runs one at a time
+		sev::Channel<Tracked> channel(*el, 64, [&](sev::EventLoop &, Tracked &v) -> errno_t {
+			if (v.Value != expected++) ordered = false;
+			++received;
+			return 0;
+		}, 16);
+		for (int i = 0; i < count; ++i)
+			sendAll(channel, i);
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		TEST_CHECK(received == count);
+		TEST_CHECK(ordered);
+	}
+	TEST_CHECK(s_Live == 0);
+
+	// Several producers, each value once
+	{
+		constexpr int producers = 4;
+		constexpr int count = 50000;
+		std::atomic_int received = 0;
+		std::atomic<int64_t> sum = 0;
+		sev::Channel<int, true> channel(*el, 128, [&](sev::EventLoop &, int &v) -> errno_t {
+			sum += v;
+			++received;
+			return 0;
+		});
+		std::vector<std::thread> threads;
+		for (int p = 0; p < producers; ++p)
+		{
+			threads.emplace_back([&channel]() -> void {
+				for (int i = 1; i <= count; ++i)
+					sendAll(channel, i);
+			});
+		}
+		for (std::thread &t : threads)
+			t.join();
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		TEST_CHECK(received == producers * count);
+		TEST_CHECK(sum == (int64_t)producers * count * (count + 1) / 2);
+	}
+
+	// Full while the receiver is busy
+	{
+		std::atomic_bool release = false;
+		std::atomic_int received = 0;
+		sev::Channel<int> channel(*el, 4, [&](sev::EventLoop &, int &v) -> errno_t {
+			while (!release)
+				std::this_thread::yield();
+			++received;
+			return 0;
+		}, 1);
+		int sent = 0;
+		while (!channel.send(sent)) // The drain holds the first value, and its slot, until released
+			++sent;
+		TEST_CHECK(sent == 4);
+		TEST_CHECK(channel.send(sent) == EAGAIN);
+		release = true;
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		TEST_CHECK(received == sent);
+	}
+
+	// A single slot holds one value until received
+	{
+		std::atomic_bool release = false;
+		std::atomic_int received = 0;
+		std::atomic_bool ordered = true;
+		int expected = 0;
+		sev::Channel<Tracked> channel(*el, 1, [&](sev::EventLoop &, Tracked &v) -> errno_t {
+			while (!release)
+				std::this_thread::yield();
+			if (v.Value != expected++) ordered = false;
+			++received;
+			return 0;
+		});
+		TEST_CHECK(!channel.emplace(0));
+		TEST_CHECK(channel.emplace(1) == EAGAIN);
+		TEST_CHECK(s_Live == 1);
+		release = true;
+		for (int i = 1; i < 1000; ++i)
+			sendAll(channel, i);
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		TEST_CHECK(received == 1000);
+		TEST_CHECK(ordered);
+	}
+	TEST_CHECK(s_Live == 0);
+
+	// Runs of values, contiguous and in order, at most a batch at a time
+	{
+		constexpr int count = 100000;
+		std::atomic_int received = 0;
+		std::atomic_int calls = 0;
+		std::atomic_bool ordered = true;
+		std::atomic_bool bounded = true;
+		int expected = 0;
+		sev::Channel<Tracked> channel(*el, 256, [&](sev::EventLoop &, Tracked *values, size_t n) -> errno_t {
+			if (n < 1 || n > 32) bounded = false;
+			for (size_t i = 0; i < n; ++i)
+				if (values[i].Value != expected++) ordered = false;
+			received += (int)n;
+			++calls;
+			return 0;
+		}, 32);
+		for (int i = 0; i < count; ++i)
+			sendAll(channel, i);
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		TEST_CHECK(received == count);
+		TEST_CHECK(ordered);
+		TEST_CHECK(bounded);
+		std::cout << "Runs: " << calls << std::endl;
+	}
+	TEST_CHECK(s_Live == 0);
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
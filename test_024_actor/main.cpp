@@ -0,0 +1,156 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Actor.
+Messages from one sender are processed in order, messages from several
+senders are each processed once and never concurrently, messages larger
+than a mailbox block are accepted, and captured state is released.
+*/
+
+#include <sev/event_loop.h>
+#include <sev/actor.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <array>
+
+static std::atomic_int s_Live = 0;
+
+struct Tracked
+{
+	Tracked() noexcept { ++s_Live; }
+	Tracked(const Tracked &) noexcept { ++s_Live; }
+	~Tracked() { --s_Live; }
+
+};
+
+struct Counter
+{
+	int64_t Total = 0;
+	int Messages = 0;
+	std::vector<int> Last; // Last value per sender
+	int Inside = 0; // Messages running, more than one if processed concurrently
+	bool Ordered = true;
+	bool Exclusive = true;
+
+};
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	// Several senders, in order per sender, one message at a time
+	constexpr int senders = 4;
+	constexpr int count = 20000;
+	{
+		Counter initial;
+		initial.Last.resize(senders, -1);
+		sev::Actor<Counter> actor(*el, std::move(initial), 16);
+		std::vector<std::thread> threads;
+		for (int s = 0; s < senders; ++s)
+		{
+			threads.emplace_back([&actor, s]() -> void {
+				for (int i = 0; i < count; ++i)
+				{
+					while (actor.tell([s, i](sev::EventLoop &, Counter &c) -> errno_t {
+						if (++c.Inside != 1) c.Exclusive = false;
+						if (c.Last[s] != i - 1) c.Ordered = false;
+						c.Last[s] = i;
+						c.Total += i;
+						++c.Messages;
+						--c.Inside;
+						return 0;
+					}))
+						std::this_thread::yield();
+				}
+			});
+		}
+		for (std::thread &t : threads)
+			t.join();
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		std::atomic_bool checked = false;
+		std::atomic_bool ok = false;
+		TEST_CHECK(!actor.tell([&](sev::EventLoop &, Counter &c) -> errno_t {
+			ok = c.Messages == senders * count && c.Total == (int64_t)senders * count * (count - 1) / 2 && c.Ordered && c.Exclusive;
+			checked = true;
+			return 0;
+		}));
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		TEST_CHECK(checked);
+		TEST_CHECK(ok);
+	}
+
+	// Messages larger than a mailbox block, with captured state released after processing
+	{
+		sev::Actor<int64_t> actor(*el);
+		for (int i = 0; i < 100; ++i)
+		{
+			std::array<uint8_t, 4096> payload;
+			payload.fill((uint8_t)i);
+			Tracked tracked;
+			TEST_CHECK(!actor.tell([payload, tracked](sev::EventLoop &, int64_t &sum) -> errno_t {
+				for (uint8_t b : payload)
+					sum += b;
+				return 0;
+			}));
+			TEST_CHECK(!actor.tell([tracked](sev::EventLoop &, int64_t &sum) -> errno_t {
+				return 0;
+			}));
+		}
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		std::atomic<int64_t> result = 0;
+		TEST_CHECK(!actor.tell([&](sev::EventLoop &, int64_t &sum) -> errno_t {
+			result = sum;
+			return 0;
+		}));
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		TEST_CHECK(result == (int64_t)4096 * 99 * 100 / 2);
+	}
+	TEST_CHECK(s_Live == 0);
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,159 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Rate limited executor.
+A burst is admitted at once and the rest at the rate, a full waiting list
+rejects or drops the oldest, out of range arguments are clamped, and
+functors still waiting when the executor is destroyed run.
+*/
+
+#include <sev/event_loop.h>
+#include <sev/rate_limited_executor.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+static void wait(const std::atomic_int &count, int expected)
+{
+	for (int i = 0; i < 5000 && count < expected; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	// Burst at once, the rest at the rate
+	{
+		sev::RateLimitedExecutor executor(*el, 200.0, 10);
+		std::atomic_int ran = 0;
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < 60; ++i)
+			TEST_CHECK(!executor.post([&](sev::EventLoop &) -> errno_t { ++ran; return 0; }));
+		TEST_CHECK(!SEV_EventLoop_join(el, true));
+		TEST_CHECK(ran >= 10 && ran < 30);
+		wait(ran, 60);
+		const int64_t elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		TEST_CHECK(ran == 60);
+		TEST_CHECK(elapsedMs >= 200); // 50 functors at 200 per second
+	}
+
+	// Reject when full
+	{
+		sev::RateLimitedExecutor executor(*el, 20.0, 1, 2);
+		std::atomic_int ran = 0;
+		auto f = [&](sev::EventLoop &) -> errno_t { ++ran; return 0; };
+		TEST_CHECK(!executor.post(f)); // Admitted
+		TEST_CHECK(!executor.post(f));
+		TEST_CHECK(!executor.post(f));
+		TEST_CHECK(executor.post(f) == EAGAIN);
+		TEST_CHECK(executor.dropped() == 0);
+		wait(ran, 3);
+		TEST_CHECK(ran == 3);
+	}
+
+	// Drop the oldest when full
+	{
+		sev::RateLimitedExecutor executor(*el, 50.0, 1, 2, sev::RateLimitOverflow::DropOldest);
+		std::mutex mutex;
+		std::vector<int> ids;
+		std::atomic_int ran = 0;
+		for (int i = 0; i < 5; ++i)
+		{
+			TEST_CHECK(!executor.post([&, i](sev::EventLoop &) -> errno_t {
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					ids.push_back(i);
+				}
+				++ran;
+				return 0;
+			}));
+		}
+		TEST_CHECK(executor.dropped() == 2);
+		wait(ran, 3);
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		std::unique_lock<std::mutex> lock(mutex);
+		std::sort(ids.begin(), ids.end());
+		TEST_CHECK(ids == std::vector<int>({ 0, 3, 4 }));
+	}
+
+	// No waiting with DropOldest
+	{
+		sev::RateLimitedExecutor executor(*el, 1.0, 1, 0, sev::RateLimitOverflow::DropOldest);
+		std::atomic_int ran = 0;
+		for (int i = 0; i < 3; ++i)
+			TEST_CHECK(!executor.post([&](sev::EventLoop &) -> errno_t { ++ran; return 0; }));
+		TEST_CHECK(executor.dropped() == 2);
+		wait(ran, 1);
+		TEST_CHECK(ran == 1);
+	}
+
+	// Clamped arguments, the burst is one functor and none may wait
+	{
+		sev::RateLimitedExecutor executor(*el, 0.0, 0, -1);
+		std::atomic_int ran = 0;
+		TEST_CHECK(!executor.post([&](sev::EventLoop &) -> errno_t { ++ran; return 0; }));
+		TEST_CHECK(executor.post([&](sev::EventLoop &) -> errno_t { ++ran; return 0; }) == EAGAIN);
+		wait(ran, 1);
+		TEST_CHECK(ran == 1);
+	}
+
+	// Destroyed with functors waiting
+	std::atomic_int late = 0;
+	{
+		sev::RateLimitedExecutor executor(*el, 100.0, 1);
+		for (int i = 0; i < 5; ++i)
+			TEST_CHECK(!executor.post([&](sev::EventLoop &) -> errno_t { ++late; return 0; }));
+	}
+	wait(late, 5);
+	TEST_CHECK(late == 5);
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,154 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Pipeline.
+Every pushed or pulled item passes through every stage once, single worker
+stages on strands keep the order, and a slow stage stops the stages before
+it and makes pushes fail instead of buffering without bound.
+*/
+
+#include <sev/event_loop.h>
+#include <sev/pipeline.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+static void wait(const std::atomic_int &count, int expected)
+{
+	for (int i = 0; i < 10000 && count < expected; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	// Pushed items through concurrent stages
+	{
+		constexpr int count = 20000;
+		std::atomic_int received = 0;
+		std::atomic<int64_t> sum = 0;
+		auto pipeline = sev::makePipeline<int>()
+			.stage(*el, [](int &&v) -> std::string { return std::to_string(v); }, 32, 4)
+			.stage(*el, [](std::string &&s) -> int64_t { return std::stoll(s); }, 32, 2)
+			.sink(*el, [&](int64_t &&v) -> void {
+				sum += v;
+				++received;
+			}, 32, 4);
+		TEST_CHECK(pipeline.stages() == 3);
+		for (int i = 0; i < count; ++i)
+		{
+			while (pipeline.push(i) == EAGAIN)
+				std::this_thread::yield();
+		}
+		wait(received, count);
+		TEST_CHECK(received == count);
+		TEST_CHECK(sum == (int64_t)count * (count - 1) / 2);
+		for (int s = 0; s < pipeline.stages(); ++s)
+		{
+			sev::PipelineStageStats stats = pipeline.stats(s);
+			TEST_CHECK(stats.Processed == count);
+			TEST_CHECK(stats.Queued == 0);
+		}
+	}
+
+	// Pulled source, in order through single worker stages on strands
+	{
+		constexpr int count = 10000;
+		sev::Strand strand(*el);
+		int next = 0;
+		int expected = 0; // Only touched on the strand
+		std::atomic_bool ordered = true;
+		std::atomic_int received = 0;
+		auto pipeline = sev::makePipeline(*el, [&next]() -> std::optional<int> {
+			if (next == count) return std::nullopt;
+			return next++;
+		})
+			.stage(strand, [](int &&v) -> int { return v * 2; }, 16)
+			.sink(strand, [&](int &&v) -> void {
+				if (v != expected * 2) ordered = false;
+				++expected;
+				++received;
+			}, 16);
+		pipeline.start();
+		wait(received, count);
+		TEST_CHECK(received == count);
+		TEST_CHECK(ordered);
+		TEST_CHECK(pipeline.stats(0).Processed == count);
+	}
+
+	// A slow sink stops the stage before it, then pushes fail
+	{
+		std::atomic_bool release = false;
+		std::atomic_int received = 0;
+		auto pipeline = sev::makePipeline<int>()
+			.stage(*el, [](int &&v) -> int { return v; }, 4)
+			.sink(*el, [&](int &&v) -> void {
+				while (!release)
+					std::this_thread::yield();
+				++received;
+			}, 4);
+		int pushed = 0;
+		for (; pushed < 1000 && !pipeline.push(pushed); ++pushed)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1)); // Let the stage fill the sink
+		TEST_CHECK(pushed < 1000);
+		TEST_CHECK(pipeline.push(pushed) == EAGAIN);
+		TEST_CHECK(pipeline.stats(0).Stalls > 0);
+		TEST_CHECK(pipeline.stats(0).Queued <= 4);
+		TEST_CHECK(pipeline.stats(1).Queued <= 4);
+		release = true;
+		wait(received, pushed);
+		TEST_CHECK(received == pushed);
+		TEST_CHECK(!pipeline.push(pushed)); // Room again
+		wait(received, pushed + 1);
+		TEST_CHECK(received == pushed + 1);
+	}
+
+	TEST_CHECK(!SEV_EventLoop_join(el, true));
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,174 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Debouncer and throttler.
+A burst of triggers runs the debounced functor once after the delay, a
+trigger while running is never lost even within the same millisecond, the
+throttled functor runs at most once per window, and destroying either one
+cancels its pending run.
+*/
+
+#include <sev/event_loop.h>
+#include <sev/debounce.h>
+#include "test_common.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+static void wait(const std::atomic_int &count, int expected)
+{
+	for (int i = 0; i < 5000 && count < expected; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static int64_t nowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int testLoop(sev::EventLoop *el)
+{
+	for (int i = 0; i < 4; ++i)
+		TEST_CHECK(!run(*el));
+
+	// A burst runs once, after the delay since the last trigger
+	{
+		std::atomic_int runs = 0;
+		std::atomic<int64_t> ranAt = 0;
+		sev::Debouncer debouncer(*el, 50, [&](sev::EventLoop &) -> errno_t {
+			ranAt = nowMs();
+			++runs;
+			return 0;
+		});
+		int64_t lastTrigger = 0;
+		for (int b = 0; b < 2; ++b)
+		{
+			for (int i = 0; i < 20; ++i)
+			{
+				lastTrigger = nowMs();
+				TEST_CHECK(!debouncer.trigger());
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			}
+			wait(runs, b + 1);
+			TEST_CHECK(runs == b + 1);
+			TEST_CHECK(ranAt - lastTrigger >= 49);
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			TEST_CHECK(runs == b + 1);
+		}
+	}
+
+	// Without a delay, a trigger while running is not lost, even within the same millisecond
+	{
+		std::atomic_int runs = 0;
+		std::unique_ptr<sev::Debouncer> debouncer;
+		debouncer = std::make_unique<sev::Debouncer>(*el, 0, [&](sev::EventLoop &) -> errno_t {
+			if (++runs < 100)
+				debouncer->trigger();
+			return 0;
+		});
+		TEST_CHECK(!debouncer->trigger());
+		wait(runs, 100);
+		TEST_CHECK(runs == 100);
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		TEST_CHECK(runs == 100);
+	}
+
+	// Destroying the debouncer cancels the pending run
+	{
+		std::atomic_int runs = 0;
+		{
+			sev::Debouncer debouncer(*el, 30, [&](sev::EventLoop &) -> errno_t {
+				++runs;
+				return 0;
+			});
+			TEST_CHECK(!debouncer.trigger());
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		TEST_CHECK(runs == 0);
+	}
+
+	// At most once per window, the first trigger runs right away and the rest are coalesced
+	{
+		std::atomic_int runs = 0;
+		std::atomic<int64_t> firstAt = 0;
+		std::atomic<int64_t> secondAt = 0;
+		sev::Throttler throttler(*el, 100, [&](sev::EventLoop &) -> errno_t {
+			(runs ? secondAt : firstAt) = nowMs();
+			++runs;
+			return 0;
+		});
+		const int64_t start = nowMs();
+		for (int i = 0; i < 10; ++i)
+		{
+			TEST_CHECK(!throttler.trigger());
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		wait(runs, 2);
+		TEST_CHECK(runs == 2);
+		TEST_CHECK(firstAt - start < 50);
+		TEST_CHECK(secondAt - firstAt >= 99);
+		std::this_thread::sleep_for(std::chrono::milliseconds(150));
+		TEST_CHECK(runs == 2);
+	}
+
+	// Destroying the throttler cancels the run at the end of the window
+	{
+		std::atomic_int runs = 0;
+		{
+			sev::Throttler throttler(*el, 50, [&](sev::EventLoop &) -> errno_t {
+				++runs;
+				return 0;
+			});
+			TEST_CHECK(!throttler.trigger());
+			wait(runs, 1);
+			TEST_CHECK(!throttler.trigger());
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(120));
+		TEST_CHECK(runs == 1);
+	}
+
+	SEV_EventLoop_stop(el);
+	SEV_EventLoop_destroy(el);
+	return 0;
+}
+
+int main()
+{
+	std::cout << "Event loop" << std::endl;
+	if (testLoop(SEV_EventLoop_create())) return 1;
+	std::cout << "Work-stealing event loop" << std::endl;
+	if (testLoop(SEV_WorkStealingEventLoop_create())) return 1;
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+/* end of file */
@@ -0,0 +1,63 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+Shared by the tests.
+TEST_CHECK fails the calling test function, which returns an int, and run
+adds a thread to a loop which treats any error returned to the loop as a
+test failure.
+*/
+
+#pragma once
+#ifndef SEV_TEST_COMMON_H
+#define SEV_TEST_COMMON_H
+
+#include <sev/event_loop.h>
+#include <iostream>
+#include <exception>
+
+#define TEST_CHECK(cond) do { if (!(cond)) { std::cout << "FAILED: " #cond ", line: " << __LINE__ << std::endl; return 1; } } while (false)
+
+inline errno_t run(sev::EventLoop &el)
+{
+	auto onError = [](SEV_ExceptionHandle *eh) -> void {
+		std::cout << "Unexpected exception" << std::endl;
+		std::terminate();
+	};
+	sev::FunctorView<void(SEV_ExceptionHandle *)> fv = std::move(onError);
+	const sev::FunctorVt<void(SEV_ExceptionHandle *)> *vt;
+	void *ptr;
+	bool movable;
+	fv.extract(vt, ptr, movable, true);
+	return SEV_EventLoop_run(&el, vt->get(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+}
+
+#endif /* #ifndef SEV_TEST_COMMON_H */
+
+/* end of file */